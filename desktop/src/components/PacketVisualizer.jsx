@@ -1,86 +1,94 @@
 import React, { useState, useEffect, useRef } from 'react';
 import * as usbDecoder from '../utils/usb-decoder';
 import TransactionAnalyzer from '../utils/transaction-analyzer';
+import { PacketIndex, LiveFilter, LiveSelection, compileFilter } from '../utils/packet-index';
+import { DescriptorCache } from '../utils/descriptor-cache';
+import { ClassDecoderRegistry } from '../utils/class-decoders';
 import './PacketVisualizer.css';
 
 /**
  * Component for visualizing USB packets and transactions
  */
 const PacketVisualizer = ({ packets, selectedPacketId, onPacketSelect }) => {
-  const [transactions, setTransactions] = useState([]);
   const [filter, setFilter] = useState({
     pid: '',
     deviceAddress: '',
     endpoint: '',
+    expression: '',
     showTokens: true,
     showData: true,
     showHandshake: true,
     showSof: false
   });
   const [view, setView] = useState('transactions'); // 'transactions' or 'packets'
+  const [storeVersion, setStoreVersion] = useState(0);
   const analyzer = useRef(new TransactionAnalyzer());
+  const packetIndex = useRef(new PacketIndex());
+  const descriptorCache = useRef(new DescriptorCache());
+  const classDecoders = useRef(new ClassDecoderRegistry(descriptorCache.current));
   
-  // Process packets into transactions whenever packets change
+  // Index new packets as they arrive, only a replaced capture is rebuilt
   useEffect(() => {
-    if (!packets || packets.length === 0) {
-      setTransactions([]);
-      return;
-    }
+    const index = packetIndex.current;
+    const list = packets || [];
     
-    analyzer.current.reset();
-    analyzer.current.processPackets(packets);
-    setTransactions(analyzer.current.getAllTransactions());
-  }, [packets]);
-  
-  // Apply filters to packets
-  const filteredPackets = React.useMemo(() => {
-    if (!packets) return [];
+    // Filters on decoded fields decode through the registry on demand
+    index.decoder = classDecoders.current;
     
-    return packets.filter(packet => {
-      // Filter by PID type
-      if (packet.pid) {
-        const packetType = usbDecoder.getPacketType(packet.pid);
-        if (packetType === 'Token' && !filter.showTokens) return false;
-        if (packetType === 'Data' && !filter.showData) return false;
-        if (packetType === 'Handshake' && !filter.showHandshake) return false;
-        if (packet.pid === usbDecoder.PID.SOF && !filter.showSof) return false;
-      }
-      
-      // Filter by specific PID
-      if (filter.pid && packet.pid !== parseInt(filter.pid, 16)) return false;
+    if (index.size > list.length || (index.size > 0 && index.packets[0] !== list[0])) {
+      index.reset();
+      analyzer.current.reset();
+      descriptorCache.current.reset();
+      classDecoders.current.reset();
+    }
+    
+    for (let i = index.size; i < list.length; i++) {
+      index.append(list[i]);
+      classDecoders.current.track(list[i]);
       
-      // Filter by device address and endpoint
-      if (packet.deviceAddress !== undefined) {
-        if (filter.deviceAddress && packet.deviceAddress !== parseInt(filter.deviceAddress)) return false;
-        if (filter.endpoint && packet.endpoint !== parseInt(filter.endpoint)) return false;
+      for (const transaction of analyzer.current.processPacket(list[i])) {
+        index.addTransaction(transaction);
+        descriptorCache.current.processTransaction(transaction);
       }
-      
-      return true;
-    });
-  }, [packets, filter]);
+    }
+    
+    setStoreVersion(version => version + 1);
+  }, [packets]);
   
-  // Apply filters to transactions
-  const filteredTransactions = React.useMemo(() => {
-    if (!transactions) return [];
+  // The toolbar controls and the typed expression form one display filter
+  const filterText = React.useMemo(() => {
+    const clauses = [];
     
-    return transactions.filter(transaction => {
-      // Filter by transaction type
-      if (transaction.type === 'SOF' && !filter.showSof) return false;
-      
-      // Filter by device address and endpoint
-      if (filter.deviceAddress && transaction.deviceAddress !== parseInt(filter.deviceAddress)) return false;
-      if (filter.endpoint && transaction.endpoint !== parseInt(filter.endpoint)) return false;
-      
-      // Filter by specific PID (if any packet in the transaction matches)
-      if (filter.pid) {
-        const pidValue = parseInt(filter.pid, 16);
-        const hasMatchingPid = transaction.packets.some(p => p.pid === pidValue);
-        if (!hasMatchingPid) return false;
-      }
-      
-      return true;
-    });
-  }, [transactions, filter]);
+    if (!filter.showTokens) clauses.push('!(type == token && pid != SOF)');
+    if (!filter.showData) clauses.push('type != data');
+    if (!filter.showHandshake) clauses.push('type != handshake');
+    if (!filter.showSof) clauses.push('pid != SOF');
+    if (filter.pid) clauses.push(`pid == 0x${filter.pid.replace(/^0x/i, '')}`);
+    if (filter.deviceAddress) clauses.push(`addr == ${filter.deviceAddress}`);
+    if (filter.endpoint) clauses.push(`ep == ${filter.endpoint}`);
+    if (filter.expression.trim()) clauses.push(`(${filter.expression})`);
+    
+    return clauses.join(' && ');
+  }, [filter]);
+  
+  // Compiled once per filter change, then only updated for new packets
+  const liveFilter = React.useMemo(() => {
+    try {
+      const filter = new LiveFilter(packetIndex.current, compileFilter(filterText));
+      return { selection: new LiveSelection(filter), error: null };
+    } catch (err) {
+      return { selection: null, error: err.message };
+    }
+  }, [filterText]);
+  
+  // New matches are appended to the kept lists, a transaction is shown if
+  // any of its packets passes the filter
+  const selection = React.useMemo(
+    () => liveFilter.selection ? liveFilter.selection.update() : null,
+    [liveFilter, storeVersion]
+  );
+  const filteredPackets = selection ? selection.packets : [];
+  const filteredTransactions = selection ? selection.transactions : [];
   
   // Handle filter changes
   const handleFilterChange = (e) => {
@@ -195,6 +203,7 @@ const PacketVisualizer = ({ packets, selectedPacketId, onPacketSelect }) => {
     
     const pidName = packet.pid ? usbDecoder.getPidName(packet.pid) : 'Unknown';
     const packetType = packet.pid ? usbDecoder.getPacketType(packet.pid) : 'Unknown';
+    const decoded = classDecoders.current.decode(packet);
     
     let detailsContent = null;
     
@@ -264,6 +273,13 @@ const PacketVisualizer = ({ packets, selectedPacketId, onPacketSelect }) => {
           <div><span>Time:</span> {formatTimestamp(packet.timestamp)}</div>
         </div>
         
+        {decoded && (
+          <div className="details-class">
+            <h4>{decoded.protocol.toUpperCase()}</h4>
+            <div>{decoded.summary}</div>
+          </div>
+        )}
+        
         {detailsContent}
       </div>
     );
@@ -337,6 +353,16 @@ const PacketVisualizer = ({ packets, selectedPacketId, onPacketSelect }) => {
               placeholder="PID (hex)"
               size="8"
             />
+            <input 
+              type="text" 
+              name="expression" 
+              value={filter.expression} 
+              onChange={handleFilterChange} 
+              placeholder="Filter, e.g. addr == 3 && status == nak"
+              className={liveFilter.error ? 'filter-error' : ''}
+              title={liveFilter.error || ''}
+              size="32"
+            />
           </div>
           
           <button onClick={toggleView} className="view-toggle-btn">
@@ -2,6 +2,8 @@ const { app, BrowserWindow, ipcMain, Menu } = require('electron');
 const path = require('path');
 const Store = require('electron-store');
 const { SerialPort } = require('serialport');
+const commProtocol = require('./utils/comm-protocol');
+const { ticksToUs } = require('./utils/timestamps');
 
 const store = new Store();
 
@@ -9,6 +11,13 @@ let mainWindow;
 let serialConnection = null;
 let deviceConnected = false;
 let captureActive = false;
+let linkBaudRate = commProtocol.BOOT_BAUD_RATE;
+let lastFrameTime = 0;
+let linkSupervisor = null;
+const commandChannel = new commProtocol.CommandChannel(
+  (frame) => serialConnection.write(frame),
+  (code) => parseErrorReport([code, 0]).errorCode
+);
 
 function createWindow() {
   mainWindow = new BrowserWindow({
@@ -19,6 +28,7 @@ function createWindow() {
     webPreferences: {
       nodeIntegration: true,
       contextIsolation: false,
+      nodeIntegrationInWorker: true,
       enableRemoteModule: true
     },
     icon: path.join(__dirname, 'assets/icon.png'),
@@ -102,10 +112,17 @@ async function scanPorts() {
 }
 
 function connectToDevice(port, baudRate) {
+  const requestedBaudRate = parseInt(baudRate, 10);
+  
   try {
+    // The firmware always boots at the same rate, anything else is negotiated
+    linkBaudRate = commProtocol.BOOT_BAUD_RATE;
+    frameDecoder.reset();
+    usbPayloadDecoder.reset();
+    
     serialConnection = new SerialPort({
       path: port,
-      baudRate: parseInt(baudRate, 10),
+      baudRate: linkBaudRate,
       autoOpen: false
     });
 
@@ -128,18 +145,208 @@ function connectToDevice(port, baudRate) {
       });
       
       serialConnection.on('close', () => {
+        clearInterval(linkSupervisor);
+        linkSupervisor = null;
         deviceConnected = false;
+        commandChannel.rejectAll('Connection closed');
         updateMenu();
         mainWindow.webContents.send('device:disconnected');
       });
+      
+      lastFrameTime = 0;
+      linkSupervisor = setInterval(superviseLink, commProtocol.LINK_SILENCE_MS / 3);
+      configureLink(requestedBaudRate);
     });
   } catch (err) {
     mainWindow.webContents.send('device:connection-error', err.message);
   }
 }
 
+/**
+ * Send a framed command and wait for the device to acknowledge it
+ * Commands are pipelined, up to COMMAND_WINDOW of them are in flight at once
+ * @param {number} type Packet type
+ * @param {Array} data Payload
+ * @param {number} retries Retransmissions, the channel default if omitted
+ * @returns {Promise} Resolves on ACK, rejects on NACK or timeout
+ */
+function sendCommand(type, data = [], retries) {
+  if (!serialConnection || !serialConnection.isOpen) {
+    return Promise.reject(new Error('No device connected'));
+  }
+  
+  return commandChannel.send(type, data, retries);
+}
+
+/**
+ * Change the serial port rate on the host side
+ * @param {number} baudRate New baud rate
+ * @returns {Promise}
+ */
+function updatePortBaudRate(baudRate) {
+  return new Promise((resolve, reject) => {
+    serialConnection.update({ baudRate }, (err) => {
+      if (err) {
+        reject(err);
+        return;
+      }
+      linkBaudRate = baudRate;
+      frameDecoder.reset();
+      resolve();
+    });
+  });
+}
+
+/**
+ * Start the session once the device answers at the boot rate. A board reset
+ * by DTR on open is still in its bootloader, and a device left at another
+ * rate by an earlier session only falls back after a run of framing errors.
+ * The reset also clears the commands the device remembers from before.
+ */
+async function waitForDevice() {
+  const deadline = Date.now() + commProtocol.LINK_READY_TIMEOUT_MS;
+  
+  for (;;) {
+    try {
+      await sendCommand(commProtocol.PACKET_TYPE.CMD_RESET);
+      return;
+    } catch (err) {
+      if (Date.now() >= deadline || !serialConnection || !serialConnection.isOpen) {
+        throw err;
+      }
+    }
+  }
+}
+
+/**
+ * Drop back to the boot rate when a negotiated link goes quiet. The device
+ * reports its status every second, so silence means it fell back after
+ * framing errors and everything it sends is garbage at the faster rate.
+ */
+async function superviseLink() {
+  if (linkBaudRate === commProtocol.BOOT_BAUD_RATE ||
+      Date.now() - lastFrameTime < commProtocol.LINK_SILENCE_MS) {
+    return;
+  }
+  
+  const lostBaudRate = linkBaudRate;
+  
+  try {
+    await updatePortBaudRate(commProtocol.BOOT_BAUD_RATE);
+    lastFrameTime = Date.now();
+    mainWindow.webContents.send('device:error', `Link lost at ${lostBaudRate} baud, back at the boot rate`);
+    mainWindow.webContents.send('device:link-speed', commProtocol.BOOT_BAUD_RATE);
+  } catch (err) {
+    mainWindow.webContents.send('device:error', `Link speed: ${err.message}`);
+  }
+}
+
+/**
+ * Negotiate a faster link: the device ACKs at the current rate and switches
+ * as soon as the ACK has left its UART, then the host follows and verifies
+ * @param {number} baudRate Requested baud rate
+ */
+async function negotiateLinkSpeed(baudRate) {
+  if (!commProtocol.LINK_BAUD_RATES.includes(baudRate)) {
+    throw new Error('Rate outside the firmware error budget');
+  }
+  
+  const config = [
+    commProtocol.CONFIG_KEY.LINK_BAUD,
+    (baudRate >>> 24) & 0xFF,
+    (baudRate >>> 16) & 0xFF,
+    (baudRate >>> 8) & 0xFF,
+    baudRate & 0xFF
+  ];
+  
+  // Never retransmitted: if the ACK was lost the device is already at the
+  // new rate and would only see framing errors at the old one
+  await sendCommand(commProtocol.PACKET_TYPE.CMD_SET_CONFIG, config, 0);
+  await updatePortBaudRate(baudRate);
+  
+  try {
+    await sendCommand(commProtocol.PACKET_TYPE.CMD_GET_STATUS);
+  } catch (err) {
+    // The device falls back to the boot rate after repeated framing errors
+    await updatePortBaudRate(commProtocol.BOOT_BAUD_RATE);
+    throw err;
+  }
+  
+  mainWindow.webContents.send('device:link-speed', baudRate);
+}
+
+/**
+ * Apply link settings after connecting: once the device answers at the
+ * boot rate, speed first, then compression
+ * @param {number} requestedBaudRate Rate selected by the user
+ */
+async function configureLink(requestedBaudRate) {
+  try {
+    await waitForDevice();
+  } catch (err) {
+    mainWindow.webContents.send('device:error', `No answer at ${linkBaudRate} baud: ${err.message}`);
+    return;
+  }
+  
+  if (requestedBaudRate && requestedBaudRate !== linkBaudRate) {
+    try {
+      await negotiateLinkSpeed(requestedBaudRate);
+    } catch (err) {
+      mainWindow.webContents.send('device:error', `Link speed ${requestedBaudRate}: ${err.message}`);
+    }
+  }
+  
+  const compression = store.get('compression', true);
+  
+  try {
+    await sendCommand(commProtocol.PACKET_TYPE.CMD_SET_CONFIG, [
+      commProtocol.CONFIG_KEY.COMPRESSION,
+      compression ? 1 : 0
+    ]);
+  } catch (err) {
+    mainWindow.webContents.send('device:error', `Compression: ${err.message}`);
+  }
+}
+
+/**
+ * Limit how many data stage bytes the device sends for an endpoint
+ * @param {number} endpoint Endpoint number, or ENDPOINT_ALL
+ * @param {number} bytes Bytes to keep, or SNAPLEN_NONE
+ */
+async function setSnapLength(endpoint, bytes) {
+  try {
+    await sendCommand(commProtocol.PACKET_TYPE.CMD_SET_CONFIG, [
+      commProtocol.CONFIG_KEY.SNAPLEN,
+      endpoint & 0xFF,
+      bytes & 0xFF
+    ]);
+  } catch (err) {
+    mainWindow.webContents.send('device:error', `Snap length: ${err.message}`);
+  }
+}
+
+/**
+ * Arm the device trigger, or turn trigger mode off
+ * @param {Object} trigger { condition, arg0, arg1, postCount }
+ */
+async function setTrigger({ condition, arg0 = 0, arg1 = 0, postCount = 0 }) {
+  try {
+    await sendCommand(commProtocol.PACKET_TYPE.CMD_SET_CONFIG, [
+      commProtocol.CONFIG_KEY.TRIGGER,
+      condition & 0xFF,
+      arg0 & 0xFF,
+      arg1 & 0xFF,
+      (postCount >> 8) & 0xFF,
+      postCount & 0xFF
+    ]);
+  } catch (err) {
+    mainWindow.webContents.send('device:error', `Trigger: ${err.message}`);
+  }
+}
+
 function disconnectFromDevice() {
   if (serialConnection && serialConnection.isOpen) {
+    commandChannel.rejectAll('Disconnected');
     serialConnection.close();
     deviceConnected = false;
     captureActive = false;
@@ -147,15 +354,18 @@ function disconnectFromDevice() {
   }
 }
 
-function startCapture(config) {
+/**
+ * Start capturing, the UI follows once the device acknowledges
+ * @param {Object} config Capture configuration from the renderer
+ */
+async function startCapture(config) {
   if (!deviceConnected || !serialConnection || !serialConnection.isOpen) {
     mainWindow.webContents.send('capture:error', 'No device connected');
     return;
   }
   
   try {
-    const startCmd = Buffer.from([0xAA, 0x02, config.dataLength, 0x00, ...config.data]);
-    serialConnection.write(startCmd);
+    await sendCommand(commProtocol.PACKET_TYPE.CMD_START_CAPTURE, config.data);
     captureActive = true;
     updateMenu();
     mainWindow.webContents.send('capture:started');
@@ -164,14 +374,29 @@ function startCapture(config) {
   }
 }
 
-function stopCapture() {
+/**
+ * Change the filters of a running capture, the device marks the switch
+ * in the stream with a FILTER_CHANGE frame
+ * @param {Array} data Monitor configuration bytes
+ */
+async function setCaptureFilter(data) {
+  try {
+    await sendCommand(commProtocol.PACKET_TYPE.CMD_SET_FILTER, data);
+  } catch (err) {
+    mainWindow.webContents.send('capture:error', `Filter: ${err.message}`);
+  }
+}
+
+/**
+ * Stop capturing
+ */
+async function stopCapture() {
   if (!deviceConnected || !serialConnection || !serialConnection.isOpen) {
     return;
   }
   
   try {
-    const stopCmd = Buffer.from([0xAA, 0x03, 0x00, 0x00]);
-    serialConnection.write(stopCmd);
+    await sendCommand(commProtocol.PACKET_TYPE.CMD_STOP_CAPTURE);
     captureActive = false;
     updateMenu();
     mainWindow.webContents.send('capture:stopped');
@@ -188,69 +413,42 @@ const PACKET_TYPES = {
   0x84: 'BUFFER_OVERFLOW',
   0x85: 'DEV_DESCRIPTOR',
   0x86: 'CONFIG_DESCRIPTOR',
-  0x87: 'STRING_DESCRIPTOR'
+  0x87: 'STRING_DESCRIPTOR',
+  0x88: 'TRIGGER',
+  0x89: 'PROFILE',
+  0x8A: 'FILTER_CHANGE',
+  0xF0: 'ACK',
+  0xF1: 'NACK'
 };
 
-let packetBuffer = Buffer.alloc(0);
-let expectedPacketLength = 0;
-let parsingHeader = true;
-let currentPacketType = 0;
+const frameDecoder = new commProtocol.FrameDecoder(parsePacket);
+const usbPayloadDecoder = new commProtocol.UsbPayloadDecoder();
 
 function processIncomingData(data) {
-  packetBuffer = Buffer.concat([packetBuffer, data]);
-  
-  while (packetBuffer.length > 0) {
-    if (parsingHeader) {
-      if (packetBuffer.length < 4) {
-        // Not enough data for header yet
-        return;
-      }
-      
-      // Check for sync byte
-      if (packetBuffer[0] !== 0xAA) {
-        // Invalid sync byte, try to find a valid one
-        const nextSyncIndex = packetBuffer.indexOf(0xAA, 1);
-        if (nextSyncIndex === -1) {
-          // No sync byte found, discard all data
-          packetBuffer = Buffer.alloc(0);
-          return;
-        }
-        // Found a sync byte, discard data up to it
-        packetBuffer = packetBuffer.slice(nextSyncIndex);
-        continue;
-      }
-      
-      currentPacketType = packetBuffer[1];
-      expectedPacketLength = packetBuffer[2] + 6; // Header (4) + Length + CRC (2)
-      parsingHeader = false;
-    }
-    
-    if (packetBuffer.length < expectedPacketLength) {
-      // Not enough data for complete packet yet
-      return;
-    }
-    
-    // We have a complete packet
-    const packet = packetBuffer.slice(0, expectedPacketLength);
-    packetBuffer = packetBuffer.slice(expectedPacketLength);
-    parsingHeader = true;
-    
-    // Parse the packet based on its type
-    parsePacket(packet);
-  }
+  frameDecoder.push(data);
 }
 
-function parsePacket(packet) {
-  const type = packet[1];
-  const length = packet[2];
-  const sequence = packet[3];
-  const data = packet.slice(4, 4 + length);
+function parsePacket(frame) {
+  const { type, sequence, data } = frame;
   
   let parsedData = null;
   
+  // Only frames that passed the CRC get here, the link is alive
+  lastFrameTime = Date.now();
+  
+  usbPayloadDecoder.track(sequence);
+  
   switch (type) {
+    case 0xF0: // ACK
+    case 0xF1: // NACK
+      commandChannel.complete(type, data);
+      return;
     case 0x80: // USB_PACKET
-      parsedData = parseUsbPacket(data);
+      parsedData = parseUsbPacket(frame);
+      // Too short to say which packet it was, nothing to show
+      if (!parsedData) {
+        return;
+      }
       break;
     case 0x81: // STATE_CHANGE
       parsedData = parseStateChange(data);
@@ -261,6 +459,15 @@ function parsePacket(packet) {
     case 0x83: // ERROR_REPORT
       parsedData = parseErrorReport(data);
       break;
+    case 0x88: // TRIGGER
+      parsedData = parseTriggerStatus(data);
+      break;
+    case 0x89: // PROFILE
+      parsedData = parseProfileReport(data);
+      break;
+    case 0x8A: // FILTER_CHANGE
+      parsedData = parseFilterChange(data);
+      break;
     default:
       parsedData = { rawData: Array.from(data) };
   }
@@ -274,25 +481,48 @@ function parsePacket(packet) {
   mainWindow.webContents.send('packet:received', packetInfo);
 }
 
-function parseUsbPacket(data) {
-  if (data.length < 8) {
-    return { error: 'Invalid USB packet size' };
+function parseUsbPacket(frame) {
+  const { data } = frame;
+  
+  if (data.length < commProtocol.USB_HEADER_SIZE) {
+    return null;
   }
   
-  const timestamp = (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+  // Device ticks become microseconds here, once for every consumer
+  const timestamp = ticksToUs((data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3]);
   const pid = data[4];
   const devAddr = data[5];
   const endpoint = data[6];
-  const crcValid = !!(data[7] & 0x80);
-  const packetData = data.length > 8 ? data.slice(8) : null;
+  const flags = data[7];
+  const payload = usbPayloadDecoder.decode(frame);
+  
+  // The header survived but a compressed payload lost its reference
+  if (!payload) {
+    return {
+      timestamp,
+      pid,
+      devAddr,
+      endpoint,
+      crcValid: !!(flags & commProtocol.USB_FLAG.CRC_VALID),
+      truncated: false,
+      gap: !!(flags & commProtocol.USB_FLAG.GAP),
+      lost: true,
+      originalLength: 0,
+      data: Buffer.alloc(0)
+    };
+  }
   
   return {
     timestamp,
     pid,
     devAddr,
     endpoint,
-    crcValid,
-    data: packetData ? Array.from(packetData) : []
+    crcValid: !!(payload.flags & commProtocol.USB_FLAG.CRC_VALID),
+    truncated: !!(payload.flags & commProtocol.USB_FLAG.TRUNCATED),
+    gap: !!(payload.flags & commProtocol.USB_FLAG.GAP),
+    lost: false,
+    originalLength: payload.originalLength,
+    data: Buffer.from(payload.data)
   };
 }
 
@@ -321,7 +551,10 @@ function parseStatusReport(data) {
   const captureState = data[1] ? 'ACTIVE' : 'IDLE';
   const bufferUsage = (data[2] << 8) | data[3];
   
-  return { deviceCount, captureState, bufferUsage };
+  // Worst-case firmware main loop pass since the last periodic report
+  const loopLatencyUs = data.length >= 6 ? (data[4] << 8) | data[5] : null;
+  
+  return { deviceCount, captureState, bufferUsage, loopLatencyUs };
 }
 
 function parseErrorReport(data) {
@@ -337,15 +570,73 @@ function parseErrorReport(data) {
     'INVALID_STATE',
     'USB_ERROR',
     'TIMEOUT',
-    'INTERNAL'
+    'UNSUPPORTED'
   ];
   
-  const errorCode = data[0] < errorCodes.length ? errorCodes[data[0]] : `UNKNOWN(${data[0]})`;
+  let errorCode = data[0] < errorCodes.length ? errorCodes[data[0]] : `UNKNOWN(${data[0]})`;
+  if (data[0] === 0xFF) {
+    errorCode = 'INTERNAL';
+  }
   const context = data[1];
   
   return { errorCode, context };
 }
 
+function parseTriggerStatus(data) {
+  if (data.length < 11) {
+    return { error: 'Invalid trigger status packet' };
+  }
+  
+  const state = commProtocol.TRIGGER_STATES[data[0]] || `UNKNOWN(${data[0]})`;
+  const timestamp = ticksToUs((data[1] << 24) | (data[2] << 16) | (data[3] << 8) | data[4]);
+  const preCount = (data[5] << 8) | data[6];
+  const postCount = (data[7] << 8) | data[8];
+  const dropped = (data[9] << 8) | data[10];
+  
+  return { state, timestamp, preCount, postCount, dropped };
+}
+
+function parseFilterChange(data) {
+  if (data.length < 13) {
+    return { error: 'Invalid filter change packet' };
+  }
+  
+  // Timestamp of the first packet checked against the new filter, then
+  // the filter in the START_CAPTURE/SET_FILTER layout
+  const timestamp = ticksToUs((data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3]);
+  
+  return {
+    timestamp,
+    captureControl: !!data[5],
+    captureBulk: !!data[6],
+    captureInterrupt: !!data[7],
+    captureIsoc: !!data[8],
+    addrFilter: data[9],
+    epFilter: data[10],
+    filterIn: !!data[11],
+    filterOut: !!data[12]
+  };
+}
+
+function parseProfileReport(data) {
+  // Per section: id, count, min, avg, max (cycles, big endian)
+  const sections = [];
+  
+  for (let offset = 0; offset + 9 <= data.length; offset += 9) {
+    const id = data[offset];
+    
+    sections.push({
+      section: commProtocol.PROFILE_SECTIONS[id] || `section ${id}`,
+      count: (data[offset + 1] << 8) | data[offset + 2],
+      minCycles: (data[offset + 3] << 8) | data[offset + 4],
+      avgCycles: (data[offset + 5] << 8) | data[offset + 6],
+      maxCycles: (data[offset + 7] << 8) | data[offset + 8]
+    });
+  }
+  
+  return { sections };
+}
+
 // IPC Event Handlers
 ipcMain.handle('serial:scan-ports', async () => {
   return await scanPorts();
@@ -359,6 +650,14 @@ ipcMain.on('serial:disconnect', () => {
   disconnectFromDevice();
 });
 
+ipcMain.on('device:set-snaplen', (event, { endpoint, bytes }) => {
+  setSnapLength(endpoint, bytes);
+});
+
+ipcMain.on('device:set-trigger', (event, trigger) => {
+  setTrigger(trigger);
+});
+
 ipcMain.on('capture:start', (event, config) => {
   startCapture(config);
 });
@@ -367,6 +666,10 @@ ipcMain.on('capture:stop', () => {
   stopCapture();
 });
 
+ipcMain.on('capture:set-filter', (event, config) => {
+  setCaptureFilter(config.data);
+});
+
 app.on('ready', createWindow);
 
 app.on('window-all-closed', () => {
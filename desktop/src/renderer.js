@@ -1,4 +1,13 @@
 const { ipcRenderer } = require('electron');
+const Chart = require('chart.js');
+const { TrafficRollup, TOTAL } = require('./utils/traffic-rollup');
+const TransactionAnalyzer = require('./utils/transaction-analyzer');
+const { DescriptorCache, ENDPOINT_DIR_IN } = require('./utils/descriptor-cache');
+const { getClassName } = require('./utils/usb-decoder');
+const { ClassDecoderRegistry } = require('./utils/class-decoders');
+const MscReassembler = require('./utils/msc-reassembler');
+const { transferPayload } = require('./utils/control-transfers');
+const DataTransferAssembler = require('./utils/data-transfers');
 
 // DOM elements
 const connectBtn = document.getElementById('connect-btn');
@@ -7,12 +16,16 @@ const startCaptureBtn = document.getElementById('start-capture-btn');
 const stopCaptureBtn = document.getElementById('stop-capture-btn');
 const clearDataBtn = document.getElementById('clear-data-btn');
 const applyFiltersBtn = document.getElementById('apply-filters-btn');
+const applySnaplenBtn = document.getElementById('apply-snaplen-btn');
+const armTriggerBtn = document.getElementById('arm-trigger-btn');
+const triggerStatusEl = document.getElementById('trigger-status');
 const statusIndicator = document.getElementById('status-indicator');
 const statusText = document.getElementById('status-text');
 const packetTableBody = document.getElementById('packet-table-body');
 const packetCountEl = document.getElementById('packet-count');
 const deviceCountEl = document.getElementById('device-count');
 const bufferUsageEl = document.getElementById('buffer-usage');
+const loopLatencyEl = document.getElementById('loop-latency');
 const elapsedTimeEl = document.getElementById('elapsed-time');
 const tabButtons = document.querySelectorAll('.tab-btn');
 const tabPanes = document.querySelectorAll('.tab-pane');
@@ -23,7 +36,22 @@ const packetFields = document.getElementById('packet-fields');
 const hexOffset = document.getElementById('hex-offset');
 const hexValues = document.getElementById('hex-values');
 const hexAscii = document.getElementById('hex-ascii');
+const transactionPane = document.getElementById('transaction-view');
 const transactionContainer = document.getElementById('transaction-container');
+const searchInput = document.getElementById('search-pattern');
+const searchBtn = document.getElementById('search-btn');
+const searchStatusEl = document.getElementById('search-status');
+const trafficPane = document.getElementById('traffic-view');
+const trafficSeriesSelect = document.getElementById('traffic-series');
+const trafficRangeEl = document.getElementById('traffic-range');
+const trafficResetBtn = document.getElementById('traffic-reset-btn');
+const bandwidthCanvas = document.getElementById('bandwidth-chart');
+const errorCanvas = document.getElementById('error-chart');
+const storagePane = document.getElementById('storage-view');
+const storageOrderSelect = document.getElementById('storage-order');
+const storageTotalsEl = document.getElementById('storage-totals');
+const storageSummaryBody = document.getElementById('storage-summary-body');
+const storageCommandBody = document.getElementById('storage-command-body');
 
 // Modal elements
 const connectionModal = document.getElementById('connection-modal');
@@ -40,13 +68,43 @@ let selectedPacketIndex = -1;
 let captureStartTime = null;
 let elapsedTimeInterval = null;
 let transactions = [];
+let tableRows = [];
+const TRANSACTION_VIEW_MAX = 1000;
+const TRANSFER_PREVIEW_BYTES = 64;
+const transactionAnalyzer = new TransactionAnalyzer();
+const descriptorCache = new DescriptorCache();
+const classDecoders = new ClassDecoderRegistry(descriptorCache);
+const dataTransfers = new DataTransferAssembler(descriptorCache);
+let transferQueue = [];      // finished transfers not yet in the Transaction View
 let deviceStatus = {
     connected: false,
     capturing: false,
     deviceCount: 0,
-    bufferUsage: 0
+    bufferUsage: 0,
+    loopLatencyUs: null
 };
 
+// Payload search, the worker keeps its own copy of every payload
+const SEARCH_FLUSH_MS = 250;
+const SEARCH_FLUSH_BYTES = 1024 * 1024;
+const searchWorker = new Worker('workers/search-worker.js');
+let searchPending = { rows: [], payloads: [], bytes: 0 };
+let searchFlushTimer = null;
+let searchId = 0;
+let searchMatchRows = new Set();
+
+// Traffic charts, redrawn from the rollup while their tab is shown
+const TRAFFIC_REFRESH_MS = 500;
+const trafficRollup = new TrafficRollup();
+let trafficCharts = null;
+let trafficView = null;      // { from, to } in microseconds, null for the whole capture
+let trafficDirty = false;
+
+// SCSI commands of mass storage devices, listed while their tab is shown
+const STORAGE_MAX_ROWS = 500;
+const mscReassembler = new MscReassembler(descriptorCache);
+let storageDirty = false;
+
 // USB PID lookups
 const PID_NAMES = {
     0xE1: 'OUT',
@@ -71,6 +129,9 @@ const PID_NAMES = {
 function init() {
     bindEventListeners();
     updateUIState();
+    setInterval(renderTrafficCharts, TRAFFIC_REFRESH_MS);
+    setInterval(renderStorageView, TRAFFIC_REFRESH_MS);
+    setInterval(renderTransactionView, TRAFFIC_REFRESH_MS);
 }
 
 // Bind Event Listeners
@@ -82,6 +143,22 @@ function bindEventListeners() {
     stopCaptureBtn.addEventListener('click', stopCapture);
     clearDataBtn.addEventListener('click', clearData);
     applyFiltersBtn.addEventListener('click', applyFilters);
+    applySnaplenBtn.addEventListener('click', applySnapLength);
+    armTriggerBtn.addEventListener('click', armTrigger);
+    searchBtn.addEventListener('click', searchPayloads);
+    searchInput.addEventListener('keydown', (event) => {
+        if (event.key === 'Enter') {
+            searchPayloads();
+        }
+    });
+    searchWorker.onmessage = handleSearchMessage;
+    trafficSeriesSelect.addEventListener('change', redrawTrafficCharts);
+    trafficResetBtn.addEventListener('click', () => zoomTraffic(null));
+    [bandwidthCanvas, errorCanvas].forEach((canvas) => {
+        canvas.addEventListener('wheel', handleTrafficWheel, { passive: false });
+        canvas.addEventListener('dblclick', () => zoomTraffic(null));
+    });
+    storageOrderSelect.addEventListener('change', redrawStorageView);
     
     // Modal event listeners
     refreshPortsBtn.addEventListener('click', refreshPorts);
@@ -103,6 +180,7 @@ function bindEventListeners() {
     ipcRenderer.on('device:disconnected', handleDeviceDisconnected);
     ipcRenderer.on('device:connection-error', handleConnectionError);
     ipcRenderer.on('device:error', handleDeviceError);
+    ipcRenderer.on('device:link-speed', handleLinkSpeed);
     ipcRenderer.on('capture:started', handleCaptureStarted);
     ipcRenderer.on('capture:stopped', handleCaptureStopped);
     ipcRenderer.on('capture:error', handleCaptureError);
@@ -126,6 +204,7 @@ function updateUIState() {
     // Update statistics
     deviceCountEl.textContent = deviceStatus.deviceCount;
     bufferUsageEl.textContent = `${deviceStatus.bufferUsage}%`;
+    loopLatencyEl.textContent = deviceStatus.loopLatencyUs === null ? '-' : `${deviceStatus.loopLatencyUs} us`;
     packetCountEl.textContent = packetData.length;
 }
 
@@ -138,6 +217,14 @@ function switchTab(tabId) {
     tabPanes.forEach(pane => {
         pane.classList.toggle('active', pane.id === tabId);
     });
+    
+    if (tabId === 'traffic-view') {
+        redrawTrafficCharts();
+    } else if (tabId === 'storage-view') {
+        redrawStorageView();
+    } else if (tabId === 'transaction-view') {
+        renderTransactionView();
+    }
 }
 
 // Connection Modal Functions
@@ -228,18 +315,64 @@ function buildCaptureConfig() {
 }
 
 function applyFilters() {
+    // The device switches filters between two packets, capture keeps running
     if (deviceStatus.connected && deviceStatus.capturing) {
-        stopCapture();
-        setTimeout(() => {
-            startCapture();
-        }, 500);
+        ipcRenderer.send('capture:set-filter', { data: buildCaptureConfig() });
+    }
+}
+
+// Snap length is applied live, the device keeps capturing
+function applySnapLength() {
+    if (!deviceStatus.connected) {
+        return;
+    }
+    
+    const enabled = document.getElementById('snaplen-enabled').checked;
+    const bytes = parseInt(document.getElementById('snaplen-bytes').value, 10) || 0;
+    const endpoint = document.getElementById('filter-endpoint-enabled').checked
+        ? parseInt(document.getElementById('filter-endpoint').value, 10) || 0
+        : 0xFF;
+    
+    // Disabling restores every endpoint, not only the one in the filter
+    ipcRenderer.send('device:set-snaplen', {
+        endpoint: enabled ? endpoint : 0xFF,
+        bytes: enabled ? Math.min(bytes, 254) : 0xFF
+    });
+}
+
+// Trigger conditions map onto usb_trigger_condition_t
+function armTrigger() {
+    if (!deviceStatus.connected) {
+        return;
     }
+    
+    const selection = document.getElementById('trigger-condition').value;
+    const postCount = parseInt(document.getElementById('trigger-post-count').value, 10) || 0;
+    const trigger = { condition: 0, arg0: 0, arg1: 0, postCount: Math.min(postCount, 0xFFFF) };
+    
+    if (selection === 'stall') {
+        trigger.condition = 0x01;
+        trigger.arg0 = 0x1E; // STALL PID
+    } else if (selection === 'setup') {
+        const fields = document.getElementById('trigger-request').value.split(':');
+        const parseField = (field) => (!field || field.trim() === '*') ? 0xFF : parseInt(field, 16) & 0xFF;
+        
+        trigger.condition = 0x02;
+        trigger.arg0 = parseField(fields[0]);
+        trigger.arg1 = parseField(fields[1]);
+    } else if (selection === 'crc') {
+        trigger.condition = 0x03;
+    }
+    
+    triggerStatusEl.textContent = trigger.condition ? 'Armed' : 'Off';
+    ipcRenderer.send('device:set-trigger', trigger);
 }
 
 // Data Management Functions
 function clearData() {
     packetData = [];
     transactions = [];
+    tableRows = [];
     selectedPacketIndex = -1;
     packetTableBody.innerHTML = '';
     detailsContent.hidden = true;
@@ -249,6 +382,29 @@ function clearData() {
     hexAscii.innerHTML = '<div class="hex-header">ASCII</div>';
     transactionContainer.innerHTML = '';
     packetCountEl.textContent = '0';
+    
+    // Drop the worker's payloads and any search in progress
+    clearTimeout(searchFlushTimer);
+    searchFlushTimer = null;
+    searchPending = { rows: [], payloads: [], bytes: 0 };
+    searchMatchRows = new Set();
+    searchId++;
+    searchWorker.postMessage({ type: 'clear' });
+    searchStatusEl.textContent = '';
+    
+    transactionAnalyzer.reset();
+    descriptorCache.reset();
+    classDecoders.reset();
+    dataTransfers.reset();
+    transferQueue = [];
+    
+    trafficRollup.clear();
+    trafficView = null;
+    trafficSeriesSelect.length = 1;
+    redrawTrafficCharts();
+    
+    mscReassembler.reset();
+    redrawStorageView();
 }
 
 function exportData() {
@@ -261,6 +417,223 @@ function exportData() {
     alert('Export functionality not yet implemented');
 }
 
+// Traffic Chart Functions
+function createTrafficCharts() {
+    const options = (yTitle) => ({
+        animation: false,
+        parsing: false,
+        normalized: true,
+        maintainAspectRatio: false,
+        elements: { point: { radius: 0 }, line: { borderWidth: 1 } },
+        scales: {
+            x: { type: 'linear', title: { display: true, text: 'Time (s)' } },
+            y: { beginAtZero: true, title: { display: true, text: yTitle } }
+        }
+    });
+    
+    return {
+        bandwidth: new Chart(bandwidthCanvas, {
+            type: 'line',
+            data: { datasets: [
+                { label: 'Payload', data: [], borderColor: '#2e8b57' },
+                { label: 'Packets / 100', data: [], borderColor: '#3a506b' }
+            ] },
+            options: options('KB/s, packets/s')
+        }),
+        errors: new Chart(errorCanvas, {
+            type: 'line',
+            data: { datasets: [
+                { label: 'NAKs', data: [], borderColor: '#f39c12' },
+                { label: 'CRC errors and STALLs', data: [], borderColor: '#c0392b' }
+            ] },
+            options: options('Per second')
+        })
+    };
+}
+
+function redrawTrafficCharts() {
+    trafficDirty = true;
+    renderTrafficCharts();
+}
+
+function renderTrafficCharts() {
+    // Hidden canvases have no size, draw when the tab is shown
+    if (!trafficDirty || !trafficPane.classList.contains('active')) {
+        return;
+    }
+    trafficDirty = false;
+    
+    if (!trafficCharts) {
+        trafficCharts = createTrafficCharts();
+    }
+    
+    // New endpoints show up as series choices
+    trafficRollup.keys().slice(trafficSeriesSelect.length).forEach((key) => {
+        const [addr, ep] = key.split('.');
+        trafficSeriesSelect.add(new Option(`Device ${addr} EP ${ep}`, key));
+    });
+    
+    const from = trafficView ? trafficView.from : trafficRollup.first;
+    const to = trafficView ? trafficView.to : trafficRollup.last;
+    const result = from === null ? null : trafficRollup.query(trafficSeriesSelect.value, from, to);
+    const perSecond = result ? 1000000 / result.width : 0;
+    const series = (values, scale) => (result ? toChartPoints(result, values, scale) : []);
+    
+    trafficCharts.bandwidth.data.datasets[0].data = series('bytes', perSecond / 1024);
+    trafficCharts.bandwidth.data.datasets[1].data = series('packets', perSecond / 100);
+    trafficCharts.errors.data.datasets[0].data = series('naks', perSecond);
+    trafficCharts.errors.data.datasets[1].data = series('errors', perSecond);
+    
+    [trafficCharts.bandwidth, trafficCharts.errors].forEach((chart) => {
+        chart.options.scales.x.min = from === null ? undefined : from / 1000000;
+        chart.options.scales.x.max = to === null ? undefined : to / 1000000;
+        chart.update('none');
+    });
+    
+    trafficRangeEl.textContent = result ?
+        `${result.time.length} buckets of ${result.width / 1000} ms` : '';
+}
+
+function toChartPoints(result, values, scale) {
+    const points = [];
+    
+    // Buckets are sparse, an idle stretch has to drop to zero on the chart
+    result.time.forEach((time, i) => {
+        if (i > 0 && time - result.time[i - 1] > result.width) {
+            points.push({ x: (result.time[i - 1] + result.width) / 1000000, y: 0 });
+            points.push({ x: (time - result.width) / 1000000, y: 0 });
+        }
+        points.push({ x: time / 1000000, y: result[values][i] * scale });
+    });
+    
+    return points;
+}
+
+function zoomTraffic(view) {
+    trafficView = view;
+    redrawTrafficCharts();
+}
+
+function handleTrafficWheel(event) {
+    if (!trafficCharts || trafficRollup.first === null) {
+        return;
+    }
+    event.preventDefault();
+    
+    // Zoom around the time under the cursor, never past the capture
+    const chart = event.currentTarget === bandwidthCanvas ? trafficCharts.bandwidth : trafficCharts.errors;
+    const from = trafficView ? trafficView.from : trafficRollup.first;
+    const to = trafficView ? trafficView.to : trafficRollup.last;
+    const center = chart.scales.x.getValueForPixel(event.offsetX) * 1000000;
+    const factor = event.deltaY < 0 ? 0.8 : 1.25;
+    const newFrom = Math.max(trafficRollup.first, center - (center - from) * factor);
+    const newTo = Math.min(trafficRollup.last, center + (to - center) * factor);
+    
+    if (newFrom <= trafficRollup.first && newTo >= trafficRollup.last) {
+        zoomTraffic(null);
+    } else if (newTo - newFrom >= 1000) {
+        zoomTraffic({ from: newFrom, to: newTo });
+    }
+}
+
+// Payload Search Functions
+function queueSearchPayload(index, data) {
+    searchPending.rows.push(index);
+    searchPending.payloads.push(data);
+    searchPending.bytes += data.length;
+    
+    if (searchPending.bytes >= SEARCH_FLUSH_BYTES) {
+        flushSearchPayloads();
+    } else if (searchFlushTimer === null) {
+        searchFlushTimer = setTimeout(flushSearchPayloads, SEARCH_FLUSH_MS);
+    }
+}
+
+function flushSearchPayloads() {
+    clearTimeout(searchFlushTimer);
+    searchFlushTimer = null;
+    
+    if (searchPending.rows.length === 0) {
+        return;
+    }
+    
+    // One buffer per batch, handed over without a copy
+    const bytes = new Uint8Array(searchPending.bytes);
+    const lengths = new Uint32Array(searchPending.payloads.length);
+    let offset = 0;
+    
+    searchPending.payloads.forEach((data, i) => {
+        bytes.set(data, offset);
+        lengths[i] = data.length;
+        offset += data.length;
+    });
+    
+    searchWorker.postMessage({
+        type: 'append',
+        rows: Int32Array.from(searchPending.rows),
+        lengths,
+        bytes: bytes.buffer
+    }, [bytes.buffer]);
+    
+    searchPending = { rows: [], payloads: [], bytes: 0 };
+}
+
+function searchPayloads() {
+    const pattern = searchInput.value.trim();
+    
+    // Forget the previous search, a late batch of it is ignored by id
+    searchMatchRows.forEach((index) => tableRows[index].classList.remove('search-match'));
+    searchMatchRows = new Set();
+    searchWorker.postMessage({ type: 'cancel', id: searchId });
+    searchId++;
+    
+    if (!pattern) {
+        searchStatusEl.textContent = '';
+        return;
+    }
+    
+    flushSearchPayloads();
+    searchWorker.postMessage({ type: 'search', id: searchId, pattern });
+    searchStatusEl.textContent = 'Searching...';
+}
+
+function handleSearchMessage(event) {
+    const message = event.data;
+    
+    if (message.id !== searchId) {
+        return;
+    }
+    
+    switch (message.type) {
+        case 'matches':
+            message.matches.forEach((match) => {
+                if (searchMatchRows.has(match.row)) {
+                    return;
+                }
+                
+                // Jump to the first match as soon as it is found
+                if (searchMatchRows.size === 0) {
+                    tableRows[match.row].click();
+                    tableRows[match.row].scrollIntoView({ block: 'center' });
+                }
+                
+                searchMatchRows.add(match.row);
+                tableRows[match.row].classList.add('search-match');
+            });
+            searchStatusEl.textContent = `${searchMatchRows.size} packets so far...`;
+            break;
+            
+        case 'done':
+            searchStatusEl.textContent = `${message.count}${message.truncated ? '+' : ''} matches in ` +
+                `${searchMatchRows.size} packets (${(message.bytes / 1048576).toFixed(1)} MB, ${message.ms} ms)`;
+            break;
+            
+        case 'error':
+            searchStatusEl.textContent = message.message;
+            break;
+    }
+}
+
 // Event Handlers
 function handleDeviceConnected(event, port) {
     deviceStatus.connected = true;
@@ -289,6 +662,10 @@ function handleDeviceError(event, message) {
     // Could add more error handling here
 }
 
+function handleLinkSpeed(event, baudRate) {
+    console.log(`Link speed: ${baudRate} baud`);
+}
+
 function handleCaptureStarted() {
     deviceStatus.capturing = true;
     captureStartTime = Date.now();
@@ -346,6 +723,16 @@ function handlePacketReceived(event, packet) {
         case 'ERROR_REPORT':
             processErrorReport(packet);
             break;
+        case 'TRIGGER':
+            processTriggerStatus(packet);
+            break;
+        case 'FILTER_CHANGE':
+            processFilterChange(packet);
+            break;
+        case 'PROFILE':
+            // Firmware built with PROFILE=1, cycle counts are for developers
+            console.table(packet.data.sections);
+            break;
         default:
             // Ignore other packet types for now
             break;
@@ -365,16 +752,38 @@ function processUsbPacket(packet) {
         devAddr: packetInfo.devAddr,
         endpoint: packetInfo.endpoint,
         crcValid: packetInfo.crcValid,
+        truncated: packetInfo.truncated,
+        gap: packetInfo.gap,
+        lost: packetInfo.lost,
+        originalLength: packetInfo.originalLength,
         data: packetInfo.data,
         rawPacket: packet
     });
     
+    if (packetInfo.data.length > 0) {
+        queueSearchPayload(packetData.length - 1, packetInfo.data);
+    }
+    
+    trafficRollup.add(packetData[packetData.length - 1]);
+    trafficDirty = true;
+    
+    // Only references are kept here, class decoding waits until a packet is viewed
+    classDecoders.track(packetData[packetData.length - 1]);
+    
+    // Control transfers on endpoint 0 fill the descriptor cache, bulk and
+    // interrupt packets coalesce into transfers, and bulk transactions of
+    // storage devices become SCSI commands
+    for (const transaction of transactionAnalyzer.processPacket(packetData[packetData.length - 1])) {
+        updateTransactionView(descriptorCache.processTransaction(transaction));
+        updateTransactionView(dataTransfers.processTransaction(transaction));
+        if (mscReassembler.processTransaction(transaction)) {
+            storageDirty = true;
+        }
+    }
+    
     // Add to packet table
     addPacketToTable(packetData[packetData.length - 1]);
     
-    // Update transaction view
-    updateTransactionView(packetData[packetData.length - 1]);
-    
     // Update UI
     packetCountEl.textContent = packetData.length;
 }
@@ -401,6 +810,7 @@ function processStatusReport(packet) {
     // Update device status
     deviceStatus.deviceCount = statusInfo.deviceCount;
     deviceStatus.bufferUsage = statusInfo.bufferUsage;
+    deviceStatus.loopLatencyUs = statusInfo.loopLatencyUs;
     
     updateUIState();
 }
@@ -414,11 +824,63 @@ function processErrorReport(packet) {
     // Could add more error handling here
 }
 
+function processTriggerStatus(packet) {
+    const trigger = packet.data;
+    
+    if (trigger.error) {
+        return;
+    }
+    
+    if (trigger.state === 'FIRED') {
+        triggerStatusEl.textContent = `Fired at ${formatTimestamp(trigger.timestamp)}`;
+    } else if (trigger.state === 'DONE') {
+        triggerStatusEl.textContent = `Done: ${trigger.preCount} pre, ${trigger.postCount} post` +
+            (trigger.dropped ? `, ${trigger.dropped} dropped` : '');
+    } else {
+        triggerStatusEl.textContent = trigger.state;
+    }
+}
+
+function processFilterChange(packet) {
+    const filter = packet.data;
+    
+    if (filter.error) {
+        return;
+    }
+    
+    // Marker row: packets from here on passed the new filter
+    const types = [
+        filter.captureControl && 'control',
+        filter.captureBulk && 'bulk',
+        filter.captureInterrupt && 'interrupt',
+        filter.captureIsoc && 'isochronous'
+    ].filter(Boolean);
+    const row = document.createElement('tr');
+    
+    row.classList.add('filter-change');
+    row.innerHTML = `
+        <td colspan="8">Filter changed at ${formatTimestamp(filter.timestamp)}:
+            ${types.join(', ') || 'no transfer types'},
+            address ${filter.addrFilter || 'any'}, endpoint ${filter.epFilter || 'any'}</td>
+    `;
+    packetTableBody.appendChild(row);
+}
+
 // UI Update Functions
 function addPacketToTable(packet) {
     const row = document.createElement('tr');
     row.dataset.index = packet.index;
     
+    // Packets were lost on the device right before this one
+    if (packet.gap) {
+        row.classList.add('gap');
+    }
+    
+    // The payload could not be decompressed
+    if (packet.lost) {
+        row.classList.add('lost');
+    }
+    
     row.innerHTML = `
         <td>${packet.index}</td>
         <td>${formatTimestamp(packet.timestamp)}</td>
@@ -426,7 +888,7 @@ function addPacketToTable(packet) {
         <td>${packet.endpoint}</td>
         <td>${getPacketType(packet.pid)}</td>
         <td>${packet.pidName}</td>
-        <td>${packet.data.length}</td>
+        <td>${formatDataLength(packet)}</td>
         <td>${packet.crcValid ? 'Valid' : 'Error'}</td>
     `;
     
@@ -446,6 +908,7 @@ function addPacketToTable(packet) {
     });
     
     packetTableBody.appendChild(row);
+    tableRows[packet.index] = row;
     
     // Auto-scroll to bottom if near the bottom
     const scrollContainer = packetTableBody.parentElement;
@@ -468,7 +931,9 @@ function updatePacketDetails(packet) {
         <div><strong>Endpoint:</strong> ${packet.endpoint}</div>
         <div><strong>Transfer Type:</strong> ${getPacketType(packet.pid)}</div>
         <div><strong>CRC Status:</strong> ${packet.crcValid ? 'Valid' : 'Invalid'}</div>
-        <div><strong>Data Length:</strong> ${packet.data.length} bytes</div>
+        <div><strong>Data Length:</strong> ${formatDataLength(packet)} bytes</div>
+        ${describeDevice(packet)}
+        ${describeClassData(packet)}
     `;
     
     // Update packet fields section
@@ -540,9 +1005,210 @@ function updateHexViewer(data) {
     }
 }
 
-function updateTransactionView(packet) {
-    // Implement transaction grouping logic
-    // This would group related packets (e.g., SETUP -> DATA -> ACK)
+function describeDevice(packet) {
+    const device = descriptorCache.getDevice(packet.devAddr);
+    
+    if (!device || packet.pid === 0xA5) {
+        return '';
+    }
+    
+    // Data and handshake packets take their direction from the token before them
+    let token = packet;
+    for (let i = packet.index; i >= 0 && i > packet.index - 4; i--) {
+        if (getPacketType(packetData[i].pid) === 'Token') {
+            token = packetData[i];
+            break;
+        }
+    }
+    
+    const direction = token.pid === 0x69 ? ENDPOINT_DIR_IN : 0;
+    const endpoint = descriptorCache.getEndpoint(packet.devAddr, packet.endpoint | direction);
+    let html = '';
+    
+    if (device.descriptor && device.descriptor.complete) {
+        const { idVendor, idProduct, iManufacturer, iProduct } = device.descriptor;
+        const names = [descriptorCache.getString(device.address, iManufacturer),
+            descriptorCache.getString(device.address, iProduct)].filter(Boolean).join(' ');
+        
+        // String descriptors come from the device under test, never trust them as markup
+        html += `<div><strong>Device:</strong> ${idVendor.toString(16).padStart(4, '0')}:` +
+            `${idProduct.toString(16).padStart(4, '0')} ${escapeHtml(names)}</div>`;
+    }
+    
+    if (endpoint) {
+        const iface = endpoint.interface;
+        
+        html += `<div><strong>Endpoint Type:</strong> ${endpoint.type} ${direction ? 'IN' : 'OUT'}` +
+            `${endpoint.maxPacketSize ? `, ${endpoint.maxPacketSize} bytes max` : ''}` +
+            `${iface ? `, interface ${iface.number} (${getClassName(iface.interfaceClass)})` : ''}</div>`;
+    }
+    
+    return html;
+}
+
+function describeClassData(packet) {
+    const decoded = classDecoders.decode(packet);
+    
+    if (!decoded) {
+        return '';
+    }
+    
+    return `<div><strong>${decoded.protocol.toUpperCase()}:</strong> ${escapeHtml(decoded.summary)}</div>`;
+}
+
+function escapeHtml(text) {
+    return text.replace(/[&<>"']/g, c => ({ '&': '&amp;', '<': '&lt;', '>': '&gt;', '"': '&quot;', "'": '&#39;' }[c]));
+}
+
+function updateTransactionView(transfers) {
+    if (transfers.length === 0) {
+        return;
+    }
+    transferQueue.push(...transfers);
+    
+    // Only the latest transfers are ever shown
+    if (transferQueue.length > 2 * TRANSACTION_VIEW_MAX) {
+        transferQueue = transferQueue.slice(-TRANSACTION_VIEW_MAX);
+    }
+}
+
+function renderTransactionView() {
+    if (transferQueue.length === 0 || !transactionPane.classList.contains('active')) {
+        return;
+    }
+    
+    const fragment = document.createDocumentFragment();
+    transferQueue.slice(-TRANSACTION_VIEW_MAX).forEach(transfer => fragment.appendChild(createTransferElement(transfer)));
+    transferQueue = [];
+    transactionContainer.appendChild(fragment);
+    
+    // Interrupt endpoints alone finish a transfer per poll, keep the latest ones
+    while (transactionContainer.childElementCount > TRANSACTION_VIEW_MAX) {
+        transactionContainer.firstElementChild.remove();
+    }
+}
+
+function createTransferElement(transfer) {
+    const { setup } = transfer;
+    const payload = transferPayload(transfer);
+    const element = document.createElement('div');
+    const header = document.createElement('div');
+    const content = document.createElement('div');
+    
+    element.className = 'transaction';
+    header.className = 'transaction-header';
+    content.className = 'transaction-content';
+    
+    if (setup) {
+        header.append(
+            createTextElement('span', `Device ${transfer.deviceAddress}: ${setup.requestName} (${setup.type})`),
+            createTextElement('span', `${transfer.status}, ${formatLatency(transfer.latencyUs)}`)
+        );
+        
+        content.append(
+            createTextElement('div', `${formatTimestamp(transfer.start)}${setup.requestDetails ? ` - ${setup.requestDetails}` : ''}`),
+            createTextElement('div', `Data: ${transfer.length} of ${setup.wLength} bytes in ${transfer.dataPackets.length} packets`),
+            createTextElement('div', `NAKs: ${transfer.naks}, retries: ${transfer.retries}, toggle errors: ${transfer.toggleErrors}`)
+        );
+    } else {
+        const direction = transfer.direction === 'in' ? 'IN' : 'OUT';
+        
+        header.append(
+            createTextElement('span', `Device ${transfer.deviceAddress}: ${transfer.type || 'Data'} ${direction} EP ${transfer.endpoint & 0x0F}`),
+            createTextElement('span', `${transfer.status}, ${formatLatency(transfer.durationUs)}`)
+        );
+        
+        content.append(
+            createTextElement('div', formatTimestamp(transfer.start)),
+            createTextElement('div', `Data: ${transfer.length} bytes in ${transfer.dataPackets.length} packets`),
+            createTextElement('div', `NAKs: ${transfer.naks}, retries: ${transfer.retries}, toggle errors: ${transfer.toggleErrors}`)
+        );
+    }
+    
+    if (payload.length > 0) {
+        const preview = Array.from(payload.subarray(0, TRANSFER_PREVIEW_BYTES), b => b.toString(16).padStart(2, '0'));
+        const line = createTextElement('div', preview.join(' ') + (payload.length > TRANSFER_PREVIEW_BYTES ? ' ...' : ''));
+        
+        line.className = 'transaction-packet';
+        content.appendChild(line);
+    }
+    
+    element.append(header, content);
+    return element;
+}
+
+function createTextElement(tag, text) {
+    const element = document.createElement(tag);
+    element.textContent = text;
+    return element;
+}
+
+// Mass Storage Functions
+function redrawStorageView() {
+    storageDirty = true;
+    renderStorageView();
+}
+
+function renderStorageView() {
+    if (!storageDirty || !storagePane.classList.contains('active')) {
+        return;
+    }
+    storageDirty = false;
+    
+    const commands = mscReassembler.commands;
+    const summary = mscReassembler.summary();
+    const totalBytes = summary.reduce((sum, stats) => sum + stats.bytes, 0);
+    
+    storageTotalsEl.textContent = commands.length ?
+        `${commands.length} commands, ${(totalBytes / 1048576).toFixed(1)} MB` : 'No mass storage commands';
+    
+    storageSummaryBody.replaceChildren(...summary.map(stats => createTableRow([
+        stats.command,
+        stats.count,
+        stats.bytes,
+        formatLatency(stats.avgUs),
+        formatLatency(stats.maxUs),
+        stats.mbPerSec ? stats.mbPerSec.toFixed(2) : '-',
+        stats.failed
+    ])));
+    
+    // Long captures list only the latest or the slowest commands
+    const listed = storageOrderSelect.value === 'latency' ?
+        mscReassembler.slowest(STORAGE_MAX_ROWS) : commands.slice(-STORAGE_MAX_ROWS).reverse();
+    
+    storageCommandBody.replaceChildren(...listed.map(command => {
+        const row = createTableRow([
+            formatTimestamp(command.start),
+            command.address,
+            command.lun,
+            command.command,
+            command.lba !== undefined ? command.lba : '-',
+            command.blocks !== undefined ? command.blocks : '-',
+            `${command.dataBytes}/${command.expectedBytes}`,
+            command.latencyUs !== null ? formatLatency(command.latencyUs) : '-',
+            command.mbPerSec ? command.mbPerSec.toFixed(2) : '-',
+            command.naks,
+            command.status
+        ]);
+        row.classList.toggle('failed', command.status !== 'Passed');
+        return row;
+    }));
+}
+
+function createTableRow(cells) {
+    const row = document.createElement('tr');
+    
+    cells.forEach(value => {
+        const cell = document.createElement('td');
+        cell.textContent = value;
+        row.appendChild(cell);
+    });
+    
+    return row;
+}
+
+function formatLatency(microseconds) {
+    return microseconds >= 1000 ? `${(microseconds / 1000).toFixed(2)} ms` : `${Math.round(microseconds)} us`;
 }
 
 // Utility Functions
@@ -553,6 +1219,18 @@ function formatTimestamp(timestamp) {
     return `${seconds}.${milliseconds.toString().padStart(3, '0')}.${microseconds.toString().padStart(3, '0')}`;
 }
 
+function formatDataLength(packet) {
+    if (packet.lost) {
+        return 'lost';
+    }
+    
+    // Snapped data stages show captured/original
+    if (packet.truncated) {
+        return `${packet.data.length}/${packet.originalLength}`;
+    }
+    return `${packet.data.length}`;
+}
+
 function getPacketType(pid) {
     if (pid === 0xE1 || pid === 0x69 || pid === 0xA5 || pid === 0x2D) {
         return 'Token';
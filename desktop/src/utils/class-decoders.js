@@ -0,0 +1,668 @@
+/**
+ * USBShark - Military-grade USB protocol analyzer
+ * Class Decoders - Registry of USB class protocol decoders
+ *
+ * Decoders are keyed by interface class, as resolved through the descriptor
+ * cache. Ingestion only records which token and control request each packet
+ * belongs to. Nothing is decoded until a packet is viewed or a filter asks
+ * for a decoded field, and every result is memoized on the packet.
+ *
+ * A decoder is { protocol, classes, decodeRequest(setup, data, context),
+ * decodeData(data, context) }, both methods optional, each returning
+ * { protocol, summary, fields } or null.
+ */
+
+const usbDecoder = require('./usb-decoder');
+const { getReportDecoder } = require('./hid-report');
+const { ENDPOINT_DIR_IN } = require('./descriptor-cache');
+
+const { PID, CLASS_CODES, REQUEST_TYPE } = usbDecoder;
+
+/**
+ * Read a little-endian field
+ * @param {Uint8Array} data Bytes
+ * @param {number} offset Field offset
+ * @param {number} size Field size, 1 to 4 bytes
+ * @returns {number} Field value
+ */
+function readLE(data, offset, size) {
+    let value = 0;
+    for (let i = size - 1; i >= 0; i--) {
+        value = value * 256 + data[offset + i];
+    }
+    return value;
+}
+
+/**
+ * Read a big-endian field
+ * @param {Uint8Array} data Bytes
+ * @param {number} offset Field offset
+ * @param {number} size Field size, 1 to 8 bytes
+ * @returns {number} Field value
+ */
+function readBE(data, offset, size) {
+    let value = 0;
+    for (let i = 0; i < size; i++) {
+        value = value * 256 + data[offset + i];
+    }
+    return value;
+}
+
+/**
+ * Build a decode result
+ * @param {string} protocol Protocol prefix used by filters
+ * @param {string} summary One-line description
+ * @param {Object} fields Decoded fields
+ * @returns {Object} Decode result
+ */
+function result(protocol, summary, fields = {}) {
+    return { protocol, summary, fields };
+}
+
+/* HID class requests */
+const HID_REQUESTS = {
+    0x01: 'GET_REPORT',
+    0x02: 'GET_IDLE',
+    0x03: 'GET_PROTOCOL',
+    0x09: 'SET_REPORT',
+    0x0A: 'SET_IDLE',
+    0x0B: 'SET_PROTOCOL'
+};
+
+/* Report types of GET_REPORT and SET_REPORT */
+const HID_REPORT_TYPES = ['Reserved', 'Input', 'Output', 'Feature'];
+
+/* Boot keyboard modifier bits */
+const HID_MODIFIERS = ['LCtrl', 'LShift', 'LAlt', 'LGui', 'RCtrl', 'RShift', 'RAlt', 'RGui'];
+
+/**
+ * Sign-extend an 8-bit value
+ * @param {number} value Byte
+ * @returns {number} Signed value
+ */
+function signed8(value) {
+    return value > 127 ? value - 256 : value;
+}
+
+/**
+ * Summarize a report decoded from its report descriptor
+ * @param {Object} report { reportId, values }
+ * @returns {string} One-line description
+ */
+function describeReport(report) {
+    const parts = Object.entries(report.values).map(([name, value]) => {
+        if (name === 'keyList') {
+            return value.length ? `keys ${value.map(key => `0x${key.toString(16)}`).join('+')}` : null;
+        }
+        if (name === 'key' || name === 'keys') {
+            return null;
+        }
+        if (name === 'buttons' || name === 'modifiers') {
+            return `${name} 0x${value.toString(16)}`;
+        }
+        return `${name} ${value}`;
+    });
+
+    return `Report${report.reportId ? ` ${report.reportId}` : ''}: ${parts.filter(Boolean).join(', ') || 'empty'}`;
+}
+
+const hidDecoder = {
+    protocol: 'hid',
+    classes: [CLASS_CODES.HID],
+
+    decodeRequest(setup, data) {
+        const name = HID_REQUESTS[setup.bRequest];
+        if (!name) {
+            return null;
+        }
+
+        const fields = { request: setup.bRequest };
+        let summary = name;
+
+        if (setup.bRequest === 0x01 || setup.bRequest === 0x09) {
+            fields.reportType = setup.wValue >> 8;
+            fields.reportId = setup.wValue & 0xFF;
+            summary += ` ${HID_REPORT_TYPES[fields.reportType] || 'Unknown'} report ${fields.reportId}`;
+        } else if (setup.bRequest === 0x0A) {
+            fields.idle = setup.wValue >> 8;
+            summary += ` ${fields.idle * 4} ms, report ${setup.wValue & 0xFF}`;
+        } else if (setup.bRequest === 0x0B) {
+            fields.protocolMode = setup.wValue & 0xFF;
+            summary += fields.protocolMode ? ' Report' : ' Boot';
+        }
+
+        if (data && data.length > 0) {
+            fields.length = data.length;
+        }
+        return result('hid', summary, fields);
+    },
+
+    decodeData(data, context) {
+        const iface = context.interface;
+        const descriptor = context.device && context.device.reportDescriptors.get(iface.number);
+
+        // Reports follow the plan compiled from the interface's report descriptor
+        if (descriptor && context.direction === 'in') {
+            const report = getReportDecoder(descriptor).decode(data);
+            if (report) {
+                return result('hid', describeReport(report), report.values);
+            }
+        }
+
+        // Boot devices use the fixed boot report layouts
+        if (iface.interfaceSubClass === 1 && iface.interfaceProtocol === 1 && data.length >= 8) {
+            const modifiers = HID_MODIFIERS.filter((name, bit) => data[0] & (1 << bit));
+            const keys = Array.from(data.subarray(2, 8)).filter(key => key !== 0);
+
+            return result('hid', `Keyboard ${[...modifiers, ...keys.map(key => `0x${key.toString(16)}`)].join('+') || 'released'}`,
+                { modifiers: data[0], key: keys[0] || 0, keys: keys.length });
+        }
+
+        if (iface.interfaceSubClass === 1 && iface.interfaceProtocol === 2 && data.length >= 3) {
+            const fields = { buttons: data[0], x: signed8(data[1]), y: signed8(data[2]) };
+            if (data.length >= 4) {
+                fields.wheel = signed8(data[3]);
+            }
+
+            return result('hid', `Mouse buttons 0x${fields.buttons.toString(16)}, x ${fields.x}, y ${fields.y}` +
+                (fields.wheel !== undefined ? `, wheel ${fields.wheel}` : ''), fields);
+        }
+
+        return result('hid', `Report, ${data.length} bytes`, { length: data.length });
+    }
+};
+
+/* CDC class requests */
+const CDC_REQUESTS = {
+    0x00: 'SEND_ENCAPSULATED_COMMAND',
+    0x01: 'GET_ENCAPSULATED_RESPONSE',
+    0x20: 'SET_LINE_CODING',
+    0x21: 'GET_LINE_CODING',
+    0x22: 'SET_CONTROL_LINE_STATE',
+    0x23: 'SEND_BREAK'
+};
+
+/* Line coding bCharFormat and bParityType */
+const CDC_STOP_BITS = ['1', '1.5', '2'];
+
+const CDC_PARITY = ['None', 'Odd', 'Even', 'Mark', 'Space'];
+
+/* SERIAL_STATE notification */
+const CDC_NOTIFY_SERIAL_STATE = 0x20;
+
+/**
+ * Decode a 7-byte line coding structure
+ * @param {Uint8Array} data Line coding bytes
+ * @returns {Object} Summary text and fields
+ */
+function decodeLineCoding(data) {
+    const fields = {
+        baud: readLE(data, 0, 4),
+        stopBits: data[4],
+        parity: data[5],
+        dataBits: data[6]
+    };
+
+    return {
+        text: `${fields.baud} baud ${fields.dataBits}${(CDC_PARITY[fields.parity] || '?')[0]}${CDC_STOP_BITS[fields.stopBits] || '?'}`,
+        fields
+    };
+}
+
+/**
+ * Render a payload as printable text
+ * @param {Uint8Array} data Bytes
+ * @returns {string} Text with escapes for control characters
+ */
+function printable(data) {
+    let text = '';
+    for (const byte of data.subarray(0, 64)) {
+        if (byte === 0x0A) {
+            text += '\\n';
+        } else if (byte === 0x0D) {
+            text += '\\r';
+        } else if (byte >= 0x20 && byte < 0x7F) {
+            text += String.fromCharCode(byte);
+        } else {
+            text += '.';
+        }
+    }
+    return data.length > 64 ? `${text}...` : text;
+}
+
+const cdcDecoder = {
+    protocol: 'cdc',
+    classes: [CLASS_CODES.CDC, CLASS_CODES.CDC_DATA],
+
+    decodeRequest(setup, data) {
+        const name = CDC_REQUESTS[setup.bRequest];
+        if (!name) {
+            return null;
+        }
+
+        const fields = { request: setup.bRequest };
+        let summary = name;
+
+        if ((setup.bRequest === 0x20 || setup.bRequest === 0x21) && data && data.length >= 7) {
+            const lineCoding = decodeLineCoding(data);
+            Object.assign(fields, lineCoding.fields);
+            summary += ` ${lineCoding.text}`;
+        } else if (setup.bRequest === 0x22) {
+            fields.dtr = setup.wValue & 0x01;
+            fields.rts = (setup.wValue >> 1) & 0x01;
+            summary += ` DTR=${fields.dtr} RTS=${fields.rts}`;
+        } else if (setup.bRequest === 0x23) {
+            fields.duration = setup.wValue;
+            summary += setup.wValue === 0xFFFF ? ' until cleared' : ` ${setup.wValue} ms`;
+        }
+
+        return result('cdc', summary, fields);
+    },
+
+    decodeData(data, context) {
+        // Notifications arrive on the communication interface
+        if (context.interface.interfaceClass === CLASS_CODES.CDC) {
+            if (data.length >= 10 && data[1] === CDC_NOTIFY_SERIAL_STATE) {
+                const state = readLE(data, 8, 2);
+                return result('cdc', `SERIAL_STATE DCD=${state & 1} DSR=${(state >> 1) & 1} RI=${(state >> 3) & 1}`,
+                    { notification: data[1], serialState: state });
+            }
+            return data.length >= 2 ? result('cdc', `Notification 0x${data[1].toString(16)}`, { notification: data[1] }) : null;
+        }
+
+        return result('cdc', `${context.direction === 'in' ? 'RX' : 'TX'} "${printable(data)}"`, { length: data.length });
+    }
+};
+
+/* Bulk-only transport CBW and CSW signatures, "USBC" and "USBS" little endian */
+const MSC_CBW_SIGNATURE = 0x43425355;
+const MSC_CSW_SIGNATURE = 0x53425355;
+const MSC_CBW_SIZE = 31;
+const MSC_CSW_SIZE = 13;
+
+/* Mass storage class requests */
+const MSC_REQUESTS = {
+    0xFE: 'GET_MAX_LUN',
+    0xFF: 'BULK_ONLY_RESET'
+};
+
+/* CSW bCSWStatus */
+const MSC_CSW_STATUS = ['Passed', 'Failed', 'Phase Error'];
+
+/* SCSI commands seen on flash drives */
+const SCSI_OPCODES = {
+    0x00: 'TEST UNIT READY',
+    0x03: 'REQUEST SENSE',
+    0x12: 'INQUIRY',
+    0x1A: 'MODE SENSE(6)',
+    0x1B: 'START STOP UNIT',
+    0x1E: 'PREVENT ALLOW MEDIUM REMOVAL',
+    0x23: 'READ FORMAT CAPACITIES',
+    0x25: 'READ CAPACITY(10)',
+    0x28: 'READ(10)',
+    0x2A: 'WRITE(10)',
+    0x2F: 'VERIFY(10)',
+    0x35: 'SYNCHRONIZE CACHE(10)',
+    0x5A: 'MODE SENSE(10)',
+    0x88: 'READ(16)',
+    0x8A: 'WRITE(16)',
+    0x9E: 'SERVICE ACTION IN(16)',
+    0xA0: 'REPORT LUNS',
+    0xA8: 'READ(12)',
+    0xAA: 'WRITE(12)'
+};
+
+/**
+ * Parse a command block wrapper
+ * @param {Uint8Array} data Bulk OUT payload
+ * @returns {Object|null} CBW fields with the SCSI command, null if not a CBW
+ */
+function parseCbw(data) {
+    // bCBWCBLength is 1 to 16, anything else is not a valid wrapper
+    if (!data || data.length < MSC_CBW_SIZE || readLE(data, 0, 4) !== MSC_CBW_SIGNATURE ||
+        (data[14] & 0x1F) === 0 || (data[14] & 0x1F) > 16) {
+        return null;
+    }
+
+    const cb = data.subarray(15, 15 + (data[14] & 0x1F));
+    const cbw = {
+        tag: readLE(data, 4, 4),
+        dataLength: readLE(data, 8, 4),
+        dataIn: (data[12] & 0x80) !== 0,
+        lun: data[13] & 0x0F,
+        opcode: cb[0],
+        command: SCSI_OPCODES[cb[0]] || `Opcode 0x${cb[0].toString(16)}`
+    };
+
+    // Block addressing of the read and write commands
+    if ((cb[0] === 0x28 || cb[0] === 0x2A || cb[0] === 0x2F) && cb.length >= 10) {
+        cbw.lba = readBE(cb, 2, 4);
+        cbw.blocks = readBE(cb, 7, 2);
+    } else if ((cb[0] === 0xA8 || cb[0] === 0xAA) && cb.length >= 12) {
+        cbw.lba = readBE(cb, 2, 4);
+        cbw.blocks = readBE(cb, 6, 4);
+    } else if ((cb[0] === 0x88 || cb[0] === 0x8A) && cb.length >= 16) {
+        cbw.lba = readBE(cb, 2, 8);
+        cbw.blocks = readBE(cb, 10, 4);
+    }
+
+    return cbw;
+}
+
+/**
+ * Parse a command status wrapper
+ * @param {Uint8Array} data Bulk IN payload
+ * @returns {Object|null} CSW fields, null if not a CSW
+ */
+function parseCsw(data) {
+    if (!data || data.length !== MSC_CSW_SIZE || readLE(data, 0, 4) !== MSC_CSW_SIGNATURE) {
+        return null;
+    }
+
+    return {
+        tag: readLE(data, 4, 4),
+        residue: readLE(data, 8, 4),
+        status: data[12]
+    };
+}
+
+const mscDecoder = {
+    protocol: 'msc',
+    classes: [CLASS_CODES.MASS_STORAGE],
+
+    decodeRequest(setup, data) {
+        const name = MSC_REQUESTS[setup.bRequest];
+        if (!name) {
+            return null;
+        }
+
+        const fields = { request: setup.bRequest };
+        if (setup.bRequest === 0xFE && data && data.length >= 1) {
+            fields.maxLun = data[0];
+            return result('msc', `${name} ${data[0]}`, fields);
+        }
+        return result('msc', name, fields);
+    },
+
+    decodeData(data) {
+        const cbw = parseCbw(data);
+        if (cbw) {
+            const range = cbw.lba !== undefined ? ` LBA ${cbw.lba}, ${cbw.blocks} blocks` : '';
+            return result('msc', `CBW ${cbw.command}${range}, tag 0x${cbw.tag.toString(16)}`, cbw);
+        }
+
+        const csw = parseCsw(data);
+        if (csw) {
+            return result('msc', `CSW ${MSC_CSW_STATUS[csw.status] || 'Unknown'}, tag 0x${csw.tag.toString(16)}` +
+                (csw.residue ? `, residue ${csw.residue}` : ''), csw);
+        }
+
+        return result('msc', `Data, ${data.length} bytes`, { length: data.length });
+    }
+};
+
+/* Hub class requests */
+const HUB_REQUESTS = {
+    0x00: 'GET_STATUS',
+    0x01: 'CLEAR_FEATURE',
+    0x03: 'SET_FEATURE',
+    0x06: 'GET_DESCRIPTOR',
+    0x07: 'SET_DESCRIPTOR',
+    0x08: 'CLEAR_TT_BUFFER',
+    0x09: 'RESET_TT',
+    0x0A: 'GET_TT_STATE',
+    0x0B: 'STOP_TT'
+};
+
+/* Hub and port feature selectors */
+const HUB_FEATURES = {
+    0: 'PORT_CONNECTION',
+    1: 'PORT_ENABLE',
+    2: 'PORT_SUSPEND',
+    3: 'PORT_OVER_CURRENT',
+    4: 'PORT_RESET',
+    8: 'PORT_POWER',
+    9: 'PORT_LOW_SPEED',
+    16: 'C_PORT_CONNECTION',
+    17: 'C_PORT_ENABLE',
+    18: 'C_PORT_SUSPEND',
+    19: 'C_PORT_OVER_CURRENT',
+    20: 'C_PORT_RESET',
+    21: 'PORT_TEST',
+    22: 'PORT_INDICATOR'
+};
+
+/* wPortStatus bits, in HUB_FEATURES order */
+const HUB_PORT_STATUS = ['connected', 'enabled', 'suspended', 'over-current', 'reset'];
+
+const hubDecoder = {
+    protocol: 'hub',
+    classes: [CLASS_CODES.HUB],
+
+    decodeRequest(setup, data) {
+        const name = HUB_REQUESTS[setup.bRequest];
+        if (!name) {
+            return null;
+        }
+
+        const portRequest = (setup.bmRequestType & REQUEST_TYPE.RECIPIENT_MASK) === REQUEST_TYPE.OTHER;
+        const fields = { request: setup.bRequest, port: portRequest ? setup.wIndex & 0xFF : 0 };
+        let summary = portRequest ? `${name} port ${fields.port}` : `${name} hub`;
+
+        if (setup.bRequest === 0x01 || setup.bRequest === 0x03) {
+            fields.feature = setup.wValue;
+            summary += ` ${HUB_FEATURES[setup.wValue] || `feature ${setup.wValue}`}`;
+        }
+
+        if (setup.bRequest === 0x00 && portRequest && data && data.length >= 4) {
+            fields.status = readLE(data, 0, 2);
+            fields.change = readLE(data, 2, 2);
+
+            const flags = HUB_PORT_STATUS.filter((flag, bit) => fields.status & (1 << bit));
+            if (fields.status & 0x0100) {
+                flags.push('powered');
+            }
+            summary += `: ${flags.join(', ') || 'empty'}${fields.change ? `, change 0x${fields.change.toString(16)}` : ''}`;
+        }
+
+        return result('hub', summary, fields);
+    },
+
+    decodeData(data) {
+        // Status change bitmap, bit 0 is the hub and bit n port n
+        const ports = [];
+        for (let bit = 1; bit < data.length * 8; bit++) {
+            if (data[bit >> 3] & (1 << (bit & 7))) {
+                ports.push(bit);
+            }
+        }
+
+        const hub = data.length > 0 && (data[0] & 1);
+        return result('hub', `Status change: ${[hub ? 'hub' : null, ...ports.map(port => `port ${port}`)].filter(Boolean).join(', ') || 'none'}`,
+            { port: ports[0] || 0, ports: ports.length, hubChange: hub ? 1 : 0 });
+    }
+};
+
+/**
+ * Class decoder registry with lazy, memoized decoding
+ */
+class ClassDecoderRegistry {
+    /**
+     * @param {DescriptorCache} cache Descriptor cache resolving interface classes
+     */
+    constructor(cache) {
+        this.cache = cache;
+        this.byClass = new Map();
+        this.reset();
+
+        for (const decoder of [hidDecoder, cdcDecoder, mscDecoder, hubDecoder]) {
+            this.register(decoder);
+        }
+    }
+
+    /**
+     * Forget packet contexts and memoized results
+     */
+    reset() {
+        this.contexts = new WeakMap();
+        this.memo = new WeakMap();
+        this.token = null;
+        this.setups = new Map();
+    }
+
+    /**
+     * Add a decoder, replacing any earlier one for the same classes
+     * @param {Object} decoder Decoder with protocol, classes and decode methods
+     */
+    register(decoder) {
+        for (const code of decoder.classes) {
+            this.byClass.set(code, decoder);
+        }
+    }
+
+    /**
+     * Record the token and control request a packet belongs to
+     *
+     * Called for every captured packet. Only references are kept, nothing
+     * is decoded here.
+     *
+     * @param {Object} packet Captured packet
+     */
+    track(packet) {
+        const type = usbDecoder.getPacketType(packet.pid);
+
+        if (type === 'Token' && packet.pid !== PID.SOF) {
+            const address = packet.devAddr !== undefined ? packet.devAddr : packet.deviceAddress;
+
+            // Shared by the token's data and handshake packets
+            this.token = {
+                address,
+                endpoint: packet.endpoint,
+                direction: packet.pid === PID.IN ? 'in' : 'out',
+                isSetup: packet.pid === PID.SETUP,
+                setup: packet.endpoint === 0 && packet.pid !== PID.SETUP ? this.setups.get(address) : null
+            };
+        } else if (type === 'Data' && this.token) {
+            this.contexts.set(packet, this.token);
+
+            // The SETUP data packet starts a new control request on its device
+            if (this.token.isSetup) {
+                this.token.setup = packet;
+                this.setups.set(this.token.address, packet);
+            }
+        }
+    }
+
+    /**
+     * Find the interface class a class request is addressed to
+     * @param {Object} setup Decoded SETUP packet
+     * @param {number} address Device address
+     * @returns {number|undefined} Interface or device class
+     */
+    requestClass(setup, address) {
+        const recipient = setup.bmRequestType & REQUEST_TYPE.RECIPIENT_MASK;
+
+        if (recipient === REQUEST_TYPE.INTERFACE) {
+            const iface = this.cache.getInterface(address, setup.wIndex & 0xFF);
+            return iface ? iface.interfaceClass : undefined;
+        }
+        if (recipient === REQUEST_TYPE.ENDPOINT) {
+            const endpoint = this.cache.getEndpoint(address, setup.wIndex & 0xFF);
+            return endpoint && endpoint.interface ? endpoint.interface.interfaceClass : undefined;
+        }
+
+        // Device and port requests go to class devices such as hubs
+        const device = this.cache.getDevice(address);
+        return device && device.descriptor ? device.descriptor.bDeviceClass : undefined;
+    }
+
+    /**
+     * Decode a data packet with the decoder of its interface class
+     * @param {Object} packet Captured packet
+     * @returns {Object|null} { protocol, summary, fields }, null if no decoder applies
+     */
+    decode(packet) {
+        const memo = this.memo.get(packet);
+
+        // A miss is retried once the descriptor cache has learned something new
+        if (memo && (memo.result || memo.generation === this.cache.generation)) {
+            return memo.result;
+        }
+
+        const decoded = this.decodeNow(packet);
+        this.memo.set(packet, { result: decoded, generation: this.cache.generation });
+        return decoded;
+    }
+
+    /**
+     * Decode without the memo
+     * @param {Object} packet Captured packet
+     * @returns {Object|null} Decode result
+     */
+    decodeNow(packet) {
+        const context = this.contexts.get(packet);
+        const data = packet.data || new Uint8Array(0);
+
+        if (!context) {
+            return null;
+        }
+
+        if (context.endpoint === 0) {
+            if (!context.setup || !context.setup.data || context.setup.data.length < 8) {
+                return null;
+            }
+
+            const setup = usbDecoder.decodeSetupPacket(context.setup.data);
+            if ((setup.bmRequestType & REQUEST_TYPE.TYPE_MASK) !== REQUEST_TYPE.CLASS) {
+                return null;
+            }
+
+            const decoder = this.byClass.get(this.requestClass(setup, context.address));
+            if (!decoder || !decoder.decodeRequest) {
+                return null;
+            }
+            return decoder.decodeRequest(setup, packet === context.setup ? null : data, context);
+        }
+
+        const direction = context.direction === 'in' ? ENDPOINT_DIR_IN : 0;
+        const endpoint = this.cache.getEndpoint(context.address, context.endpoint | direction);
+        const decoder = endpoint && endpoint.interface && this.byClass.get(endpoint.interface.interfaceClass);
+
+        if (!decoder || !decoder.decodeData || data.length === 0) {
+            return null;
+        }
+
+        return decoder.decodeData(data, {
+            address: context.address,
+            direction: context.direction,
+            device: this.cache.getDevice(context.address),
+            interface: endpoint.interface,
+            endpoint
+        });
+    }
+
+    /**
+     * Read one decoded field, for display filters
+     * @param {Object} packet Captured packet
+     * @param {string} name Field as protocol.field, e.g. msc.opcode
+     * @returns {*} Field value, undefined if the packet has no such field
+     */
+    field(packet, name) {
+        const decoded = this.decode(packet);
+        const dot = name.indexOf('.');
+
+        if (!decoded || decoded.protocol !== name.slice(0, dot)) {
+            return undefined;
+        }
+        return decoded.fields[name.slice(dot + 1)];
+    }
+}
+
+module.exports = {
+    SCSI_OPCODES,
+    MSC_CSW_STATUS,
+    parseCbw,
+    parseCsw,
+    decodeLineCoding,
+    ClassDecoderRegistry
+};
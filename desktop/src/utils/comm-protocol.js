@@ -0,0 +1,591 @@
+/**
+ * USBShark - Military-grade USB protocol analyzer
+ * Communication Protocol Utility
+ * 
+ * Host side of the binary framing used between the Arduino and the desktop
+ * application (see firmware/include/comm_protocol.h)
+ */
+
+/**
+ * Framing constants
+ */
+const SYNC_BYTE = 0xAA;
+const ESCAPE_BYTE = 0x55;
+const ESCAPE_XOR = 0x20;
+const MAX_PAYLOAD = 255;
+
+/**
+ * Command channel limits (COMM_CMD_QUEUE_DEPTH, COMM_MAX_COMMAND_SIZE)
+ */
+const COMMAND_WINDOW = 4;
+const MAX_COMMAND_PAYLOAD = 32;
+const COMMAND_TIMEOUT_MS = 500;
+const COMMAND_RETRIES = 2;
+const ERROR_CRC_FAILURE = 0x03;
+
+/**
+ * Packet types
+ */
+const PACKET_TYPE = {
+    // Commands (host to device)
+    CMD_RESET: 0x01,
+    CMD_START_CAPTURE: 0x02,
+    CMD_STOP_CAPTURE: 0x03,
+    CMD_SET_FILTER: 0x04,
+    CMD_GET_STATUS: 0x05,
+    CMD_SET_TIMESTAMP: 0x06,
+    CMD_SET_CONFIG: 0x07,
+    
+    // Data (device to host)
+    USB_PACKET: 0x80,
+    STATE_CHANGE: 0x81,
+    STATUS_REPORT: 0x82,
+    ERROR_REPORT: 0x83,
+    BUFFER_OVERFLOW: 0x84,
+    DEV_DESCRIPTOR: 0x85,
+    CONFIG_DESCRIPTOR: 0x86,
+    STRING_DESCRIPTOR: 0x87,
+    TRIGGER: 0x88,
+    PROFILE: 0x89,
+    FILTER_CHANGE: 0x8A,
+    
+    // Acknowledgments
+    ACK: 0xF0,
+    NACK: 0xF1
+};
+
+/**
+ * Configuration keys for CMD_SET_CONFIG
+ */
+const CONFIG_KEY = {
+    LINK_BAUD: 0x01,
+    COMPRESSION: 0x02,
+    SNAPLEN: 0x03,
+    TRIGGER: 0x04
+};
+
+/**
+ * Trigger conditions for CONFIG_KEY.TRIGGER (usb_trigger_condition_t)
+ */
+const TRIGGER_CONDITION = {
+    NONE: 0x00,
+    PID: 0x01,
+    SETUP: 0x02,
+    CRC_ERROR: 0x03
+};
+
+/**
+ * Trigger states reported in TRIGGER frames (usb_trigger_state_t)
+ */
+const TRIGGER_STATES = ['OFF', 'ARMED', 'FIRED', 'DONE'];
+
+/**
+ * Sections reported in PROFILE frames (profile_section_t), firmware built with PROFILE=1
+ */
+const PROFILE_SECTIONS = [
+    'isr_int0', 'isr_uart_udre', 'process_raw_packet', 'usb_process_packet', 'comm_send_packet',
+    'crc_table_64_bytes', 'crc_nibble_64_bytes'
+];
+
+/**
+ * SNAPLEN wildcards: every endpoint, and no limit
+ */
+const ENDPOINT_ALL = 0xFF;
+const SNAPLEN_NONE = 0xFF;
+
+/**
+ * USB packet frame header: timestamp (4), PID, address, endpoint, flags,
+ * followed by the original data length (2) when TRUNCATED is set
+ */
+const USB_HEADER_SIZE = 8;
+
+/**
+ * USB packet frame flag bits (COMM_USB_FLAG_* in comm_protocol.h)
+ */
+const USB_FLAG = {
+    CRC_VALID: 0x80,
+    COMPRESSED: 0x40,
+    REPEAT: 0x20,
+    TRUNCATED: 0x10,
+    GAP: 0x08
+};
+
+/**
+ * Link rate the firmware boots at (BAUD in firmware/Makefile)
+ */
+const BOOT_BAUD_RATE = 1000000;
+
+/**
+ * Link rates within the firmware's error budget at 16 MHz with U2X0
+ */
+const LINK_BAUD_RATES = [250000, 500000, 1000000, 2000000];
+
+/**
+ * Link supervision: how long to wait for the device to answer at the boot
+ * rate after opening the port (covers a bootloader after a DTR reset), and
+ * how long a negotiated link may stay silent (status reports come once per
+ * second) before the host assumes the device fell back to the boot rate
+ */
+const LINK_READY_TIMEOUT_MS = 5000;
+const LINK_SILENCE_MS = 3000;
+
+/**
+ * CRC-16/CCITT lookup table (polynomial 0x1021)
+ */
+const CRC16_TABLE = (() => {
+    const table = new Uint16Array(256);
+    
+    for (let i = 0; i < 256; i++) {
+        let crc = i << 8;
+        for (let bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+        }
+        table[i] = crc & 0xFFFF;
+    }
+    
+    return table;
+})();
+
+/**
+ * Calculate CRC-16 the same way as comm_calculate_crc
+ * @param {Uint8Array|Array} data Data buffer
+ * @param {number} crc Initial CRC value
+ * @returns {number} CRC-16 value
+ */
+function crc16(data, crc = 0xFFFF) {
+    for (let i = 0; i < data.length; i++) {
+        crc = ((crc << 8) ^ CRC16_TABLE[((crc >> 8) ^ data[i]) & 0xFF]) & 0xFFFF;
+    }
+    return crc;
+}
+
+/**
+ * Build an escaped frame ready to be written to the serial port
+ * @param {number} type Packet type
+ * @param {Array|Uint8Array} data Payload
+ * @param {number} sequence Sequence number
+ * @returns {Buffer} Encoded frame
+ */
+function encodeFrame(type, data, sequence) {
+    const payload = data ? Array.from(data) : [];
+    
+    if (payload.length > MAX_PAYLOAD) {
+        throw new Error(`Payload too long (${payload.length} bytes)`);
+    }
+    
+    const body = [type, payload.length, sequence & 0xFF, ...payload];
+    const crc = crc16(body);
+    body.push((crc >> 8) & 0xFF, crc & 0xFF);
+    
+    const out = [SYNC_BYTE];
+    for (const byte of body) {
+        if (byte === SYNC_BYTE || byte === ESCAPE_BYTE) {
+            out.push(ESCAPE_BYTE, byte ^ ESCAPE_XOR);
+        } else {
+            out.push(byte);
+        }
+    }
+    
+    return Buffer.from(out);
+}
+
+/**
+ * Streaming frame decoder
+ * Unescapes incoming bytes and emits frames whose CRC checks out. An
+ * unescaped SYNC_BYTE always starts a frame and an invalid escape drops the
+ * current one, so resynchronizing is a single pass, as in process_rx_byte
+ * on the device (see the framing comment in comm_protocol.h)
+ */
+class FrameDecoder {
+    /**
+     * @param {Function} onFrame Called with { type, length, sequence, data }
+     */
+    constructor(onFrame) {
+        this.onFrame = onFrame;
+        this.stats = { frames: 0, crcErrors: 0, truncated: 0 };
+        this.reset();
+    }
+    
+    /**
+     * Drop any partially received frame
+     */
+    reset() {
+        this.inFrame = false;
+        this.escapeNext = false;
+        this.frame = [];
+        this.expected = 0;
+    }
+    
+    /**
+     * Feed raw bytes from the serial port
+     * @param {Buffer} chunk Received bytes
+     */
+    push(chunk) {
+        for (let i = 0; i < chunk.length; i++) {
+            let byte = chunk[i];
+            
+            // SYNC_BYTE never occurs escaped
+            if (byte === SYNC_BYTE) {
+                if (this.inFrame) {
+                    this.stats.truncated++;
+                }
+                this.inFrame = true;
+                this.escapeNext = false;
+                this.frame = [];
+                this.expected = 0;
+                continue;
+            }
+            
+            if (!this.inFrame) {
+                continue;
+            }
+            
+            if (this.escapeNext) {
+                byte ^= ESCAPE_XOR;
+                this.escapeNext = false;
+                
+                if (byte !== SYNC_BYTE && byte !== ESCAPE_BYTE) {
+                    this.stats.truncated++;
+                    this.reset();
+                    continue;
+                }
+            } else if (byte === ESCAPE_BYTE) {
+                this.escapeNext = true;
+                continue;
+            }
+            
+            this.frame.push(byte);
+            
+            // type, length, sequence, payload, crc high, crc low
+            if (this.frame.length === 2) {
+                this.expected = 3 + byte + 2;
+            }
+            
+            if (this.expected && this.frame.length === this.expected) {
+                this.completeFrame();
+            }
+        }
+    }
+    
+    /**
+     * Validate and emit the current frame
+     */
+    completeFrame() {
+        const frame = this.frame;
+        const length = frame[1];
+        const body = frame.slice(0, 3 + length);
+        const crc = (frame[3 + length] << 8) | frame[4 + length];
+        
+        this.inFrame = false;
+        this.frame = [];
+        this.expected = 0;
+        
+        if (crc16(body) !== crc) {
+            this.stats.crcErrors++;
+            return;
+        }
+        
+        this.stats.frames++;
+        this.onFrame({
+            type: frame[0],
+            length,
+            sequence: frame[2],
+            data: Buffer.from(body.slice(3))
+        });
+    }
+}
+
+/**
+ * Sliding-window command sender
+ * Keeps up to COMMAND_WINDOW commands unacknowledged on the link, the depth
+ * of the device command queue, and holds the rest back in order. A command
+ * that times out or is NACKed for a CRC failure is retransmitted with the
+ * same sequence number. The device recognizes a command it already ran by
+ * its sequence number and CRC and only repeats the reply. A session starts
+ * with CMD_RESET, which clears what the device remembers. The device runs
+ * commands in arrival order, so a retransmitted command can overtake later
+ * ones: await a command whose effect the next one depends on.
+ */
+class CommandChannel {
+    /**
+     * @param {Function} write Called with each encoded frame
+     * @param {Function} describeError Maps a NACK error code to a name
+     */
+    constructor(write, describeError = (code) => String(code)) {
+        this.write = write;
+        this.describeError = describeError;
+        this.sequence = 0;
+        this.inFlight = new Map();
+        this.waiting = [];
+    }
+    
+    /**
+     * Queue a command
+     * @param {number} type Packet type
+     * @param {Array} data Payload
+     * @param {number} retries Retransmissions after a timeout or CRC NACK
+     * @returns {Promise} Resolves on ACK, rejects on NACK or after the last retry
+     */
+    send(type, data = [], retries = COMMAND_RETRIES) {
+        return new Promise((resolve, reject) => {
+            if (data.length > MAX_COMMAND_PAYLOAD) {
+                reject(new Error(`Command payload too long (${data.length} bytes)`));
+                return;
+            }
+            
+            this.waiting.push({ type, data, resolve, reject, retries });
+            this.fill();
+        });
+    }
+    
+    /**
+     * Transmit waiting commands while the window has room
+     */
+    fill() {
+        while (this.waiting.length > 0 && this.inFlight.size < COMMAND_WINDOW) {
+            const command = this.waiting.shift();
+            
+            command.sequence = this.sequence;
+            this.sequence = (this.sequence + 1) & 0xFF;
+            this.inFlight.set(command.sequence, command);
+            this.transmit(command);
+        }
+    }
+    
+    /**
+     * Write a command frame and start its timeout
+     * @param {Object} command In-flight command
+     */
+    transmit(command) {
+        command.timer = setTimeout(() => this.retry(command, 'Command timed out'), COMMAND_TIMEOUT_MS);
+        
+        try {
+            this.write(encodeFrame(command.type, command.data, command.sequence));
+        } catch (err) {
+            this.finish(command);
+            command.reject(err);
+        }
+    }
+    
+    /**
+     * Retransmit a command, or fail it once out of retries
+     * @param {Object} command In-flight command
+     * @param {string} reason Error message if no retries are left
+     */
+    retry(command, reason) {
+        clearTimeout(command.timer);
+        
+        if (command.retries-- > 0) {
+            this.transmit(command);
+            return;
+        }
+        
+        this.finish(command);
+        command.reject(new Error(reason));
+    }
+    
+    /**
+     * Take a command out of the window and let the next one in
+     * @param {Object} command In-flight command
+     */
+    finish(command) {
+        clearTimeout(command.timer);
+        this.inFlight.delete(command.sequence);
+        this.fill();
+    }
+    
+    /**
+     * Complete the command an ACK/NACK refers to
+     * @param {number} type PACKET_TYPE.ACK or PACKET_TYPE.NACK
+     * @param {Buffer} data ACK/NACK payload: sequence, [error code]
+     */
+    complete(type, data) {
+        const command = data.length > 0 ? this.inFlight.get(data[0]) : undefined;
+        
+        // Late replies to a retransmitted command are ignored
+        if (!command) {
+            return;
+        }
+        
+        if (type === PACKET_TYPE.ACK) {
+            this.finish(command);
+            command.resolve();
+            return;
+        }
+        
+        const error = data.length > 1 ? data[1] : null;
+        
+        // The frame was damaged on the way, not refused
+        if (error === ERROR_CRC_FAILURE) {
+            this.retry(command, 'Command failed CRC check');
+            return;
+        }
+        
+        this.finish(command);
+        command.reject(new Error(`Device rejected command (${error === null ? 'UNKNOWN' : this.describeError(error)})`));
+    }
+    
+    /**
+     * Fail every queued and in-flight command
+     * @param {string} reason Error message
+     */
+    rejectAll(reason) {
+        const commands = [...this.inFlight.values(), ...this.waiting];
+        
+        for (const command of this.inFlight.values()) {
+            clearTimeout(command.timer);
+        }
+        this.inFlight.clear();
+        this.waiting = [];
+        
+        for (const command of commands) {
+            command.reject(new Error(reason));
+        }
+    }
+}
+
+/**
+ * Expand run-length encoded data (comm_compress_data on the device)
+ * Control byte 0x00-0x7F: 1-128 literal bytes follow
+ * Control byte 0x80-0xFE: next byte repeated 3-129 times
+ * @param {Buffer|Array} data Encoded data
+ * @returns {Array|null} Expanded bytes, null if malformed
+ */
+function decompressPayload(data) {
+    const out = [];
+    let i = 0;
+    
+    while (i < data.length) {
+        const control = data[i++];
+        
+        if (control < 0x80) {
+            if (i + control + 1 > data.length) {
+                return null;
+            }
+            for (let n = 0; n <= control; n++) {
+                out.push(data[i++]);
+            }
+        } else if (control < 0xFF && i < data.length) {
+            const value = data[i++];
+            for (let n = control - 0x80 + 3; n > 0; n--) {
+                out.push(value);
+            }
+        } else {
+            return null;
+        }
+    }
+    
+    return out;
+}
+
+/**
+ * Undoes payload compression of USB packet frames
+ * Mirrors the device's single repeat slot, which only ever refers to the
+ * last frame it sent with data, so any sequence gap invalidates it
+ */
+class UsbPayloadDecoder {
+    constructor() {
+        this.stats = { compressed: 0, repeats: 0, errors: 0 };
+        this.reset();
+    }
+    
+    /**
+     * Forget the repeat reference
+     */
+    reset() {
+        this.last = null;
+        this.sequence = null;
+    }
+    
+    /**
+     * Follow the device's frame sequence, called for every valid frame
+     * @param {number} sequence Frame sequence number
+     */
+    track(sequence) {
+        if (this.sequence !== null && sequence !== ((this.sequence + 1) & 0xFF)) {
+            this.last = null;
+        }
+        this.sequence = sequence;
+    }
+    
+    /**
+     * Decode the data part of a USB packet frame, after track()
+     * @param {Object} frame Frame from FrameDecoder
+     * @returns {Object|null} { flags, data, originalLength }, null if the data cannot be recovered
+     */
+    decode(frame) {
+        const header = frame.data;
+        const flags = header[7];
+        const addr = header[5];
+        const endpoint = header[6];
+        let offset = USB_HEADER_SIZE;
+        let originalLength = null;
+        
+        if (flags & USB_FLAG.TRUNCATED) {
+            if (header.length < offset + 2) {
+                this.stats.errors++;
+                return null;
+            }
+            originalLength = (header[offset] << 8) | header[offset + 1];
+            offset += 2;
+        }
+        
+        let data = Array.from(frame.data.slice(offset));
+        
+        if (flags & USB_FLAG.REPEAT) {
+            this.stats.repeats++;
+            
+            if (!this.last || this.last.addr !== addr || this.last.endpoint !== endpoint) {
+                this.stats.errors++;
+                return null;
+            }
+            const data = this.last.data.slice();
+            return { flags, data, originalLength: originalLength ?? data.length };
+        }
+        
+        if (flags & USB_FLAG.COMPRESSED) {
+            this.stats.compressed++;
+            data = decompressPayload(data);
+            
+            if (data === null) {
+                this.stats.errors++;
+                this.last = null;
+                return null;
+            }
+        }
+        
+        if (data.length > 0) {
+            this.last = { addr, endpoint, data };
+        }
+        
+        return { flags, data, originalLength: originalLength ?? data.length };
+    }
+}
+
+module.exports = {
+    SYNC_BYTE,
+    ESCAPE_BYTE,
+    ESCAPE_XOR,
+    MAX_PAYLOAD,
+    COMMAND_WINDOW,
+    MAX_COMMAND_PAYLOAD,
+    PACKET_TYPE,
+    CONFIG_KEY,
+    ENDPOINT_ALL,
+    SNAPLEN_NONE,
+    TRIGGER_CONDITION,
+    TRIGGER_STATES,
+    PROFILE_SECTIONS,
+    USB_HEADER_SIZE,
+    USB_FLAG,
+    BOOT_BAUD_RATE,
+    LINK_BAUD_RATES,
+    LINK_READY_TIMEOUT_MS,
+    LINK_SILENCE_MS,
+    crc16,
+    encodeFrame,
+    decompressPayload,
+    FrameDecoder,
+    CommandChannel,
+    UsbPayloadDecoder
+};
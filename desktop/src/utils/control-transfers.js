@@ -0,0 +1,167 @@
+/**
+ * USBShark - Military-grade USB protocol analyzer
+ * Control Transfers - SETUP, data and status stages as one request
+ *
+ * A control transfer opens on its SETUP transaction, collects the data stage
+ * packets, however many IN or OUT transactions it spans, and closes on the
+ * status stage. The result has the total latency, the NAKs, unacknowledged
+ * retries and data toggle errors seen on the way, counted as for bulk
+ * transfers, and references to the captured data packets. The payload is
+ * only concatenated when asked for.
+ */
+
+const usbDecoder = require('./usb-decoder');
+const { elapsedUs } = require('./timestamps');
+
+const { PID, REQUEST_TYPE } = usbDecoder;
+
+/**
+ * Concatenate the captured data of a transfer
+ * @param {Object} transfer Control or data transfer
+ * @returns {Uint8Array} Captured bytes, memoized on the transfer, fewer than
+ *     transfer.length where the snap length cut a packet
+ */
+function transferPayload(transfer) {
+    if (!transfer.payload) {
+        const captured = transfer.dataPackets.reduce((sum, packet) => sum + (packet.data ? packet.data.length : 0), 0);
+        const payload = new Uint8Array(captured);
+        let offset = 0;
+
+        for (const packet of transfer.dataPackets) {
+            payload.set(packet.data || [], offset);
+            offset += packet.data ? packet.data.length : 0;
+        }
+        transfer.payload = payload;
+    }
+    return transfer.payload;
+}
+
+/**
+ * Control transfer reassembler, one open transfer per device address
+ */
+class ControlTransferAssembler {
+    constructor() {
+        this.reset();
+    }
+
+    /**
+     * Drop open transfers
+     */
+    reset() {
+        this.pending = new Map();
+    }
+
+    /**
+     * Process one transaction from TransactionAnalyzer
+     * @param {Object} transaction Completed or incomplete transaction
+     * @returns {Array<Object>} Transfers finished by this transaction
+     */
+    processTransaction(transaction) {
+        const address = transaction.deviceAddress;
+
+        if (address === null || address === undefined || transaction.endpoint !== 0) {
+            return [];
+        }
+
+        const packets = transaction.packets || [];
+        const data = packets.find(p => usbDecoder.getPacketType(p.pid) === 'Data');
+        const handshake = packets.find(p => usbDecoder.getPacketType(p.pid) === 'Handshake');
+        const transfer = this.pending.get(address);
+        const finished = [];
+
+        if (transaction.type === 'Control Setup') {
+            // A new request ends the previous one, whatever stage it reached
+            if (transfer) {
+                finished.push(this.finish(transfer, 'Incomplete', transaction.timestamp));
+            }
+
+            if (data && data.data && data.data.length >= 8) {
+                this.pending.set(address, {
+                    deviceAddress: address,
+                    setup: usbDecoder.decodeSetupPacket(data.data),
+                    setupPacket: data,
+                    dataPackets: [],
+                    length: 0,
+                    naks: 0,
+                    retries: 0,
+                    toggleErrors: 0,
+                    start: transaction.timestamp,
+                    end: null,
+                    latencyUs: null,
+                    status: null,
+                    payload: null
+                });
+            }
+            return finished;
+        }
+
+        if (!transfer) {
+            return finished;
+        }
+
+        if (handshake && handshake.pid === PID.STALL) {
+            finished.push(this.finish(transfer, 'Error: Stalled', handshake.timestamp));
+            return finished;
+        }
+
+        if (handshake && handshake.pid === PID.NAK) {
+            transfer.naks++;
+            return finished;
+        }
+
+        if (!data) {
+            return finished;
+        }
+
+        const deviceToHost = (transfer.setup.bmRequestType & REQUEST_TYPE.DIRECTION_MASK) !== 0;
+        const dataStage = (transaction.type === 'IN Transaction') === deviceToHost;
+
+        if (!dataStage) {
+            // Status stage, in the opposite direction of the data
+            if (data.crcValid !== false) {
+                finished.push(this.finish(transfer, 'Success', handshake ? handshake.timestamp : data.timestamp));
+            }
+            return finished;
+        }
+
+        // Data the receiver did not acknowledge is sent again with the same toggle
+        if (transaction.status !== 'Success' || data.crcValid === false) {
+            transfer.retries++;
+            return finished;
+        }
+
+        const previous = transfer.dataPackets[transfer.dataPackets.length - 1];
+
+        // An acknowledged packet repeating the last toggle is discarded by the receiver
+        if (previous && previous.pid === data.pid) {
+            transfer.toggleErrors++;
+            return finished;
+        }
+
+        // Packets cut by the snap length still count whole
+        transfer.dataPackets.push(data);
+        transfer.length += usbDecoder.getDataLength(data);
+
+        return finished;
+    }
+
+    /**
+     * Close a transfer
+     * @param {Object} transfer Open transfer
+     * @param {string} status Success, Error: Stalled or Incomplete
+     * @param {number} time Timestamp of the last packet
+     * @returns {Object} The transfer
+     */
+    finish(transfer, status, time) {
+        this.pending.delete(transfer.deviceAddress);
+        transfer.status = status;
+        transfer.end = time;
+        transfer.latencyUs = elapsedUs(transfer.start, time);
+        return transfer;
+    }
+}
+
+module.exports = {
+    transferPayload,
+    ControlTransferAssembler
+};
@@ -0,0 +1,192 @@
+/**
+ * USBShark - Military-grade USB protocol analyzer
+ * Data Transfers - Bulk and interrupt transactions coalesced into transfers
+ *
+ * Acknowledged data packets on a bulk or interrupt endpoint are added to its
+ * open transfer until one is shorter than wMaxPacketSize, a zero-length
+ * packet included, which ends it. Each transfer counts the NAKs,
+ * unacknowledged retries and data toggle errors it ran into, and keeps
+ * references to its data packets.
+ */
+
+const usbDecoder = require('./usb-decoder');
+const { ENDPOINT_DIR_IN } = require('./descriptor-cache');
+const { elapsedUs } = require('./timestamps');
+
+const { PID } = usbDecoder;
+
+/**
+ * Bulk and interrupt transfer reassembler, one open transfer per endpoint
+ */
+class DataTransferAssembler {
+    /**
+     * @param {DescriptorCache} cache Descriptor cache with endpoint types and sizes
+     */
+    constructor(cache) {
+        this.cache = cache;
+        this.reset();
+    }
+
+    /**
+     * Drop open transfers and toggle state
+     */
+    reset() {
+        this.endpoints = new Map();
+    }
+
+    /**
+     * Get the state of an endpoint, creating it on first use
+     * @param {number} address Device address
+     * @param {number} endpointAddress Endpoint number with 0x80 set for IN
+     * @returns {Object} Endpoint state
+     */
+    state(address, endpointAddress) {
+        const key = address * 256 + endpointAddress;
+        const device = this.cache.getDevice(address);
+        const settingChanges = device ? device.settingChanges : 0;
+        let state = this.endpoints.get(key);
+
+        if (!state) {
+            state = { transfer: null, lastPid: null, largest: 0, settingChanges };
+            this.endpoints.set(key, state);
+        }
+
+        // A new configuration or interface setting resets every toggle to DATA0
+        if (state.settingChanges !== settingChanges) {
+            state.settingChanges = settingChanges;
+            state.lastPid = null;
+        }
+        return state;
+    }
+
+    /**
+     * Process one transaction from TransactionAnalyzer
+     * @param {Object} transaction Completed or incomplete transaction
+     * @returns {Array<Object>} Transfers finished by this transaction
+     */
+    processTransaction(transaction) {
+        const address = transaction.deviceAddress;
+        const isIn = transaction.type === 'IN Transaction';
+
+        if ((!isIn && transaction.type !== 'OUT Transaction') || !transaction.endpoint ||
+            address === null || address === undefined) {
+            return [];
+        }
+
+        const endpointAddress = transaction.endpoint | (isIn ? ENDPOINT_DIR_IN : 0);
+        const endpoint = this.cache.getEndpoint(address, endpointAddress);
+
+        // Isochronous endpoints have neither handshakes nor toggles
+        if (endpoint && endpoint.type !== 'Bulk' && endpoint.type !== 'Interrupt') {
+            return [];
+        }
+
+        const state = this.state(address, endpointAddress);
+        const packets = transaction.packets || [];
+        const data = packets.find(p => usbDecoder.getPacketType(p.pid) === 'Data');
+        const handshake = packets.find(p => usbDecoder.getPacketType(p.pid) === 'Handshake');
+        const last = packets[packets.length - 1];
+        const finished = [];
+
+        if (handshake && handshake.pid === PID.STALL) {
+            // Clearing the halt resets the toggle
+            state.lastPid = null;
+            if (state.transfer) {
+                finished.push(this.finish(state, 'Error: Stalled', handshake.timestamp));
+            }
+            return finished;
+        }
+
+        if (handshake && handshake.pid === PID.NAK) {
+            // Idle polling NAKs only count once a transfer is under way
+            if (state.transfer) {
+                state.transfer.naks++;
+            }
+            return finished;
+        }
+
+        if (!data || (data.pid !== PID.DATA0 && data.pid !== PID.DATA1)) {
+            return finished;
+        }
+
+        if (!state.transfer) {
+            state.transfer = {
+                deviceAddress: address,
+                endpoint: endpointAddress,
+                direction: isIn ? 'in' : 'out',
+                type: endpoint ? endpoint.type : null,
+                dataPackets: [],
+                length: 0,
+                naks: 0,
+                retries: 0,
+                toggleErrors: 0,
+                start: transaction.timestamp,
+                end: null,
+                durationUs: null,
+                status: null,
+                payload: null
+            };
+        }
+
+        const transfer = state.transfer;
+
+        // Data the receiver did not acknowledge is sent again with the same toggle
+        if (transaction.status !== 'Success' || data.crcValid === false) {
+            transfer.retries++;
+            return finished;
+        }
+
+        // An acknowledged packet repeating the last toggle is discarded by the receiver
+        if (data.pid === state.lastPid) {
+            transfer.toggleErrors++;
+            return finished;
+        }
+        state.lastPid = data.pid;
+
+        // Packets cut by the snap length still count whole, and only a short one ends the transfer
+        const length = usbDecoder.getDataLength(data);
+        transfer.dataPackets.push(data);
+        transfer.length += length;
+        state.largest = Math.max(state.largest, length);
+
+        if (!this.isFullPacket(endpoint, state, length)) {
+            finished.push(this.finish(state, 'Complete', last.timestamp));
+        }
+        return finished;
+    }
+
+    /**
+     * Check whether a data packet leaves its transfer open
+     * @param {Object|undefined} endpoint Endpoint from the descriptor cache
+     * @param {Object} state Endpoint state
+     * @param {number} length Payload bytes
+     * @returns {boolean} True for a packet of wMaxPacketSize bytes
+     */
+    isFullPacket(endpoint, state, length) {
+        if (endpoint && endpoint.maxPacketSize) {
+            return length >= endpoint.maxPacketSize;
+        }
+
+        // Without descriptors, bulk sizes are powers of two from 8 to 512
+        return length >= 8 && (length & (length - 1)) === 0 && length >= state.largest;
+    }
+
+    /**
+     * Close the open transfer of an endpoint
+     * @param {Object} state Endpoint state
+     * @param {string} status Complete or Error: Stalled
+     * @param {number} time Timestamp of the last packet
+     * @returns {Object} The transfer
+     */
+    finish(state, status, time) {
+        const transfer = state.transfer;
+
+        state.transfer = null;
+        transfer.status = status;
+        transfer.end = time;
+        transfer.durationUs = elapsedUs(transfer.start, time);
+        return transfer;
+    }
+}
+
+module.exports = DataTransferAssembler;
@@ -0,0 +1,415 @@
+/**
+ * USBShark - Military-grade USB protocol analyzer
+ * Descriptor Cache - Device topology rebuilt from snooped enumeration
+ *
+ * Fed with the transactions of TransactionAnalyzer. Control transfers on
+ * endpoint 0 are reassembled by ControlTransferAssembler, and the
+ * descriptors they return are parsed into one entry per device address.
+ * SET_ADDRESS moves an entry, SET_CONFIGURATION and SET_INTERFACE select the
+ * active interfaces, and each entry keeps a map of its active endpoints so
+ * lookups by endpoint address are O(1).
+ */
+
+const usbDecoder = require('./usb-decoder');
+const { transferPayload, ControlTransferAssembler } = require('./control-transfers');
+
+const { DESCRIPTOR_TYPES, REQUEST_CODES, REQUEST_TYPE } = usbDecoder;
+
+/* Endpoint transfer types, bmAttributes bits 1..0 */
+const ENDPOINT_TYPES = ['Control', 'Isochronous', 'Bulk', 'Interrupt'];
+
+/* Endpoint address direction bit */
+const ENDPOINT_DIR_IN = 0x80;
+
+/* Interface association descriptor type */
+const DESCRIPTOR_INTERFACE_ASSOCIATION = 0x0B;
+
+/**
+ * Read a little-endian 16-bit field
+ * @param {Uint8Array} data Descriptor bytes
+ * @param {number} offset Field offset
+ * @returns {number} Field value
+ */
+function readWord(data, offset) {
+    return data[offset] | (data[offset + 1] << 8);
+}
+
+/**
+ * Parse a device descriptor, short reads give the leading fields only
+ * @param {Uint8Array} data Descriptor bytes, at least 8
+ * @returns {Object} Device descriptor fields
+ */
+function parseDeviceDescriptor(data) {
+    const descriptor = {
+        bcdUSB: readWord(data, 2),
+        bDeviceClass: data[4],
+        bDeviceSubClass: data[5],
+        bDeviceProtocol: data[6],
+        bMaxPacketSize0: data[7],
+        complete: data.length >= 18
+    };
+
+    if (descriptor.complete) {
+        Object.assign(descriptor, {
+            idVendor: readWord(data, 8),
+            idProduct: readWord(data, 10),
+            bcdDevice: readWord(data, 12),
+            iManufacturer: data[14],
+            iProduct: data[15],
+            iSerialNumber: data[16],
+            bNumConfigurations: data[17]
+        });
+    }
+
+    return descriptor;
+}
+
+/**
+ * Parse a configuration descriptor with its interfaces and endpoints
+ *
+ * Descriptors the cache does not interpret (HID, class-specific) are kept
+ * raw in the extra list of the interface they follow.
+ *
+ * @param {Uint8Array} data Full configuration, wTotalLength bytes
+ * @returns {Object} Configuration with interfaces, endpoints and associations
+ */
+function parseConfigurationDescriptor(data) {
+    const configuration = {
+        value: data[5],
+        numInterfaces: data[4],
+        iConfiguration: data[6],
+        attributes: data[7],
+        maxPowerMa: data[8] * 2,
+        interfaces: [],
+        associations: [],
+        extra: []
+    };
+    let current = null;
+
+    for (let offset = 0; offset + 2 <= data.length;) {
+        const length = data[offset];
+        const type = data[offset + 1];
+
+        // A zero length would never advance
+        if (length < 2 || offset + length > data.length) {
+            break;
+        }
+
+        const descriptor = data.subarray(offset, offset + length);
+        offset += length;
+
+        if (type === DESCRIPTOR_TYPES.INTERFACE && length >= 9) {
+            current = {
+                number: descriptor[2],
+                alternate: descriptor[3],
+                interfaceClass: descriptor[5],
+                interfaceSubClass: descriptor[6],
+                interfaceProtocol: descriptor[7],
+                iInterface: descriptor[8],
+                endpoints: [],
+                extra: []
+            };
+            configuration.interfaces.push(current);
+        } else if (type === DESCRIPTOR_TYPES.ENDPOINT && length >= 7 && current) {
+            const wMaxPacketSize = readWord(descriptor, 4);
+
+            current.endpoints.push({
+                address: descriptor[2],
+                attributes: descriptor[3],
+                type: ENDPOINT_TYPES[descriptor[3] & 0x03],
+                maxPacketSize: wMaxPacketSize & 0x07FF,
+                transactionsPerFrame: ((wMaxPacketSize >> 11) & 0x03) + 1,
+                interval: descriptor[6]
+            });
+        } else if (type === DESCRIPTOR_INTERFACE_ASSOCIATION && length >= 8) {
+            configuration.associations.push({
+                firstInterface: descriptor[2],
+                interfaceCount: descriptor[3],
+                functionClass: descriptor[4],
+                functionSubClass: descriptor[5],
+                functionProtocol: descriptor[6]
+            });
+        } else if (type !== DESCRIPTOR_TYPES.CONFIGURATION) {
+            (current ? current.extra : configuration.extra).push({ type, data: Uint8Array.from(descriptor) });
+        }
+    }
+
+    return configuration;
+}
+
+/**
+ * Parse a string descriptor
+ * @param {Uint8Array} data Descriptor bytes
+ * @param {number} index String index, 0 is the language ID list
+ * @returns {string|Array<number>} Decoded UTF-16LE string, or language IDs for index 0
+ */
+function parseStringDescriptor(data, index) {
+    const end = Math.min(data[0], data.length) & ~1;
+    const units = [];
+
+    for (let offset = 2; offset + 1 < end; offset += 2) {
+        units.push(readWord(data, offset));
+    }
+
+    return index === 0 ? units : String.fromCharCode(...units);
+}
+
+/**
+ * Per-device descriptor cache
+ */
+class DescriptorCache {
+    constructor() {
+        this.transfers = new ControlTransferAssembler();
+        this.reset();
+    }
+
+    /**
+     * Forget every device
+     */
+    reset() {
+        this.devicesByAddress = new Map();
+        this.transfers.reset();
+        this.generation = 0;
+    }
+
+    /**
+     * Get the entry of a device address, creating it on first use
+     * @param {number} address Device address
+     * @returns {Object} Device entry
+     */
+    entry(address) {
+        let device = this.devicesByAddress.get(address);
+
+        if (!device) {
+            device = {
+                address,
+                descriptor: null,
+                configurations: new Map(),
+                strings: new Map(),
+                reportDescriptors: new Map(),
+                activeConfiguration: null,
+                alternates: new Map(),
+                // SET_CONFIGURATION and SET_INTERFACE seen, each resets data toggles
+                settingChanges: 0,
+                interfaces: new Map(),
+                endpoints: new Map()
+            };
+            this.devicesByAddress.set(address, device);
+        }
+        return device;
+    }
+
+    /**
+     * Process one transaction from TransactionAnalyzer
+     * @param {Object} transaction Completed or incomplete transaction
+     * @returns {Array<Object>} Control transfers finished by this transaction
+     */
+    processTransaction(transaction) {
+        const finished = this.transfers.processTransaction(transaction);
+
+        for (const transfer of finished) {
+            // A request cut short by the next SETUP still returned its data
+            if (transfer.status !== 'Error: Stalled') {
+                this.completeRequest(transfer);
+            }
+        }
+        return finished;
+    }
+
+    /**
+     * Apply a finished control request to the cache
+     * @param {Object} transfer Control transfer from ControlTransferAssembler
+     */
+    completeRequest(transfer) {
+        const { setup } = transfer;
+        const address = transfer.deviceAddress;
+
+        if ((setup.bmRequestType & REQUEST_TYPE.TYPE_MASK) !== REQUEST_TYPE.STANDARD) {
+            return;
+        }
+
+        const recipient = setup.bmRequestType & REQUEST_TYPE.RECIPIENT_MASK;
+
+        switch (setup.bRequest) {
+            case REQUEST_CODES.GET_DESCRIPTOR:
+                this.storeDescriptor(address, setup, recipient, transferPayload(transfer));
+                break;
+
+            case REQUEST_CODES.SET_ADDRESS: {
+                const device = this.devicesByAddress.get(address);
+                const newAddress = setup.wValue & 0x7F;
+
+                if (device && newAddress !== address) {
+                    this.devicesByAddress.delete(address);
+                    device.address = newAddress;
+                    this.devicesByAddress.set(newAddress, device);
+                    this.generation++;
+                }
+                break;
+            }
+
+            case REQUEST_CODES.SET_CONFIGURATION: {
+                const device = this.entry(address);
+                device.activeConfiguration = setup.wValue & 0xFF;
+                device.alternates.clear();
+                device.settingChanges++;
+                this.selectInterfaces(device);
+                break;
+            }
+
+            case REQUEST_CODES.SET_INTERFACE: {
+                const device = this.entry(address);
+                device.alternates.set(setup.wIndex & 0xFF, setup.wValue & 0xFF);
+                device.settingChanges++;
+                this.selectInterfaces(device);
+                break;
+            }
+        }
+    }
+
+    /**
+     * Store a descriptor returned by GET_DESCRIPTOR
+     * @param {number} address Device address
+     * @param {Object} setup Decoded SETUP packet
+     * @param {number} recipient Request recipient
+     * @param {Uint8Array} data Response bytes
+     */
+    storeDescriptor(address, setup, recipient, data) {
+        const type = setup.wValue >> 8;
+        const index = setup.wValue & 0xFF;
+
+        if (data.length < 2) {
+            return;
+        }
+
+        const device = this.entry(address);
+
+        if (recipient === REQUEST_TYPE.INTERFACE && type === DESCRIPTOR_TYPES.REPORT) {
+            device.reportDescriptors.set(setup.wIndex & 0xFF, data);
+        } else if (type === DESCRIPTOR_TYPES.DEVICE && data.length >= 8) {
+            // The first read is often 8 bytes, never let it replace a full one
+            if (!device.descriptor || !device.descriptor.complete || data.length >= 18) {
+                device.descriptor = parseDeviceDescriptor(data);
+            }
+        } else if (type === DESCRIPTOR_TYPES.CONFIGURATION && data.length >= 9) {
+            // The 9-byte header read only tells the host how much to ask for
+            if (data.length < readWord(data, 2)) {
+                return;
+            }
+            const configuration = parseConfigurationDescriptor(data);
+            device.configurations.set(configuration.value, configuration);
+            this.selectInterfaces(device);
+        } else if (type === DESCRIPTOR_TYPES.STRING) {
+            device.strings.set(index, parseStringDescriptor(data, index));
+        } else {
+            return;
+        }
+
+        this.generation++;
+    }
+
+    /**
+     * Rebuild the active interface and endpoint maps of a device
+     *
+     * Without a captured SET_CONFIGURATION the first configuration read is
+     * assumed, so a capture started after enumeration still resolves.
+     *
+     * @param {Object} device Device entry
+     */
+    selectInterfaces(device) {
+        const configuration = device.configurations.get(device.activeConfiguration) ||
+            device.configurations.values().next().value;
+
+        device.interfaces = new Map();
+        device.endpoints = new Map();
+        this.generation++;
+
+        if (!configuration) {
+            return;
+        }
+
+        for (const iface of configuration.interfaces) {
+            if (iface.alternate !== (device.alternates.get(iface.number) || 0)) {
+                continue;
+            }
+
+            device.interfaces.set(iface.number, iface);
+            for (const endpoint of iface.endpoints) {
+                device.endpoints.set(endpoint.address, { ...endpoint, interface: iface });
+            }
+        }
+    }
+
+    /**
+     * Get a cached device
+     * @param {number} address Device address
+     * @returns {Object|undefined} Device entry
+     */
+    getDevice(address) {
+        return this.devicesByAddress.get(address);
+    }
+
+    /**
+     * List cached devices
+     * @returns {Array<Object>} Device entries
+     */
+    devices() {
+        return Array.from(this.devicesByAddress.values());
+    }
+
+    /**
+     * Look up an endpoint of the active configuration
+     * @param {number} address Device address
+     * @param {number} endpointAddress Endpoint number, with 0x80 set for IN
+     * @returns {Object|undefined} Endpoint with type, maxPacketSize, interval and interface
+     */
+    getEndpoint(address, endpointAddress) {
+        const device = this.devicesByAddress.get(address);
+
+        if (!device) {
+            return undefined;
+        }
+
+        if ((endpointAddress & 0x0F) === 0) {
+            return {
+                address: endpointAddress,
+                type: 'Control',
+                maxPacketSize: device.descriptor ? device.descriptor.bMaxPacketSize0 : undefined,
+                interface: null
+            };
+        }
+        return device.endpoints.get(endpointAddress);
+    }
+
+    /**
+     * Look up an interface in its active alternate setting
+     * @param {number} address Device address
+     * @param {number} number Interface number
+     * @returns {Object|undefined} Interface with class, subclass, protocol and endpoints
+     */
+    getInterface(address, number) {
+        const device = this.devicesByAddress.get(address);
+        return device ? device.interfaces.get(number) : undefined;
+    }
+
+    /**
+     * Look up a string descriptor
+     * @param {number} address Device address
+     * @param {number} index String index
+     * @returns {string|undefined} String, if it was read during the capture
+     */
+    getString(address, index) {
+        const device = this.devicesByAddress.get(address);
+        const value = device && index ? device.strings.get(index) : undefined;
+        return typeof value === 'string' ? value : undefined;
+    }
+}
+
+module.exports = {
+    ENDPOINT_TYPES,
+    ENDPOINT_DIR_IN,
+    parseDeviceDescriptor,
+    parseConfigurationDescriptor,
+    parseStringDescriptor,
+    DescriptorCache
+};
@@ -0,0 +1,437 @@
+/**
+ * USBShark - Military-grade USB protocol analyzer
+ * HID Report Plans - Report descriptors compiled to field extraction plans
+ *
+ * A report descriptor is walked once, with its global state stack and local
+ * usages, into one plan per input report: the bit offset, size, signedness
+ * and usage of every field, packed into typed arrays. Decoding a report is
+ * then a single loop over those arrays, cheap enough for 1000 Hz mice.
+ */
+
+/* Item types of the short item prefix */
+const ITEM_MAIN = 0;
+const ITEM_GLOBAL = 1;
+const ITEM_LOCAL = 2;
+
+/* Main item tags */
+const MAIN_INPUT = 0x8;
+const MAIN_COLLECTION = 0xA;
+const MAIN_END_COLLECTION = 0xC;
+
+/* Global item tags */
+const GLOBAL_USAGE_PAGE = 0x0;
+const GLOBAL_LOGICAL_MIN = 0x1;
+const GLOBAL_LOGICAL_MAX = 0x2;
+const GLOBAL_REPORT_SIZE = 0x7;
+const GLOBAL_REPORT_ID = 0x8;
+const GLOBAL_REPORT_COUNT = 0x9;
+const GLOBAL_PUSH = 0xA;
+const GLOBAL_POP = 0xB;
+
+/* Local item tags */
+const LOCAL_USAGE = 0x0;
+const LOCAL_USAGE_MIN = 0x1;
+const LOCAL_USAGE_MAX = 0x2;
+
+/* Input item flags */
+const FLAG_CONSTANT = 0x01;
+const FLAG_VARIABLE = 0x02;
+
+/* Usage pages with named fields */
+const PAGE_GENERIC_DESKTOP = 0x01;
+const PAGE_KEYBOARD = 0x07;
+const PAGE_BUTTON = 0x09;
+const PAGE_CONSUMER = 0x0C;
+
+/* Generic desktop axes */
+const DESKTOP_USAGES = {
+    0x30: 'x',
+    0x31: 'y',
+    0x32: 'z',
+    0x33: 'rx',
+    0x34: 'ry',
+    0x35: 'rz',
+    0x36: 'slider',
+    0x37: 'dial',
+    0x38: 'wheel',
+    0x39: 'hat'
+};
+
+/* Consumer controls found on mice */
+const CONSUMER_USAGES = {
+    0x238: 'pan'
+};
+
+/* Keyboard modifier usages, E0 to E7 */
+const KEYBOARD_LEFT_CONTROL = 0xE0;
+const KEYBOARD_RIGHT_GUI = 0xE7;
+
+/* How a field's value is stored */
+const KIND_VALUE = 0;
+const KIND_BUTTON = 1;
+const KIND_MODIFIER = 2;
+const KIND_KEY = 3;
+
+/* Widest field read in one go */
+const MAX_FIELD_BITS = 32;
+
+/**
+ * Sign-extend a value of a given bit size
+ * @param {number} value Unsigned value
+ * @param {number} bits Bit size
+ * @returns {number} Signed value
+ */
+function signExtend(value, bits) {
+    return value >= 2 ** (bits - 1) ? value - 2 ** bits : value;
+}
+
+/**
+ * Name the field of a variable usage
+ * @param {number} page Usage page
+ * @param {number} usage Usage ID
+ * @returns {string} Field name
+ */
+function usageName(page, usage) {
+    const name = page === PAGE_GENERIC_DESKTOP ? DESKTOP_USAGES[usage]
+        : page === PAGE_CONSUMER ? CONSUMER_USAGES[usage]
+            : undefined;
+
+    return name || `usage_${page.toString(16).padStart(4, '0')}_${usage.toString(16).padStart(4, '0')}`;
+}
+
+/**
+ * Field layout of one input report, built while walking the descriptor
+ */
+class ReportLayout {
+    /**
+     * @param {number} id Report ID, 0 when the descriptor has none
+     */
+    constructor(id) {
+        this.id = id;
+        this.bits = 0;
+        this.fields = [];
+        this.names = new Map();
+    }
+
+    /**
+     * Add a field at the current end of the report
+     * @param {Object} field { size, kind, slot, signed, name, usages, logicalMin }
+     */
+    add(field) {
+        // The same usage twice in one report gets a numbered name
+        if (field.kind === KIND_VALUE) {
+            const seen = this.names.get(field.name) || 0;
+            this.names.set(field.name, seen + 1);
+            if (seen) {
+                field.name += `_${seen + 1}`;
+            }
+        }
+
+        this.fields.push({ ...field, offset: this.bits });
+        this.bits += field.size;
+    }
+}
+
+/**
+ * Compiled extraction plan of one input report
+ */
+class ReportPlan {
+    /**
+     * @param {ReportLayout} layout Report layout
+     * @param {number} headerBits Bits taken by the report ID byte
+     */
+    constructor(layout, headerBits) {
+        const fields = layout.fields.filter(field => field.size <= MAX_FIELD_BITS);
+        const count = fields.length;
+
+        this.id = layout.id;
+        this.count = count;
+        this.byteOffset = new Uint32Array(count);
+        this.byteCount = new Uint8Array(count);
+        this.divisor = new Float64Array(count);
+        this.modulus = new Float64Array(count);
+        this.size = new Uint8Array(count);
+        this.signed = new Uint8Array(count);
+        this.kind = new Uint8Array(count);
+        this.slot = new Uint8Array(count);
+        this.names = fields.map(field => field.name);
+        this.usages = fields.map(field => field.usages || null);
+        this.logicalMin = new Float64Array(count);
+
+        fields.forEach((field, i) => {
+            const offset = field.offset + headerBits;
+            const shift = offset & 7;
+
+            this.byteOffset[i] = offset >> 3;
+            this.byteCount[i] = (shift + field.size + 7) >> 3;
+            this.divisor[i] = 2 ** shift;
+            this.modulus[i] = 2 ** field.size;
+            this.size[i] = field.size;
+            this.signed[i] = field.signed ? 1 : 0;
+            this.kind[i] = field.kind;
+            this.slot[i] = field.slot || 0;
+            this.logicalMin[i] = field.logicalMin || 0;
+        });
+
+        this.hasButtons = fields.some(field => field.kind === KIND_BUTTON);
+        this.hasModifiers = fields.some(field => field.kind === KIND_MODIFIER);
+        this.hasKeys = fields.some(field => field.kind === KIND_KEY);
+    }
+
+    /**
+     * Extract every field of a report
+     * @param {Uint8Array} data Report bytes, including the report ID
+     * @returns {Object} Field values by name, plus keys for keyboard arrays
+     */
+    decode(data) {
+        const values = {};
+        let buttons = 0;
+        let modifiers = 0;
+        const keys = [];
+
+        for (let i = 0; i < this.count; i++) {
+            const start = this.byteOffset[i];
+            const bytes = this.byteCount[i];
+
+            // Short reports leave their trailing fields out
+            if (start + bytes > data.length) {
+                break;
+            }
+
+            let raw = 0;
+            for (let b = bytes - 1; b >= 0; b--) {
+                raw = raw * 256 + data[start + b];
+            }
+
+            let value = Math.floor(raw / this.divisor[i]) % this.modulus[i];
+            if (this.signed[i]) {
+                value = signExtend(value, this.size[i]);
+            }
+
+            switch (this.kind[i]) {
+                case KIND_BUTTON:
+                    buttons += value ? 2 ** this.slot[i] : 0;
+                    break;
+                case KIND_MODIFIER:
+                    modifiers |= value ? 1 << this.slot[i] : 0;
+                    break;
+                case KIND_KEY: {
+                    const usage = this.usages[i][value - this.logicalMin[i]];
+                    if (usage) {
+                        keys.push(usage);
+                    }
+                    break;
+                }
+                default:
+                    values[this.names[i]] = value;
+            }
+        }
+
+        if (this.hasButtons) {
+            values.buttons = buttons;
+        }
+        if (this.hasModifiers) {
+            values.modifiers = modifiers;
+        }
+        if (this.hasKeys) {
+            values.key = keys[0] || 0;
+            values.keys = keys.length;
+            values.keyList = keys;
+        }
+        return values;
+    }
+}
+
+/**
+ * Walk a report descriptor into input report layouts
+ * @param {Uint8Array} descriptor Report descriptor bytes
+ * @returns {Object} { reportIds, layouts: Map<id, ReportLayout>, collections }
+ */
+function parseReportDescriptor(descriptor) {
+    let global = { usagePage: 0, logicalMin: 0, logicalMax: 0, reportSize: 0, reportId: 0, reportCount: 0 };
+    let local = { usages: [], usageMin: null };
+    const stack = [];
+    const layouts = new Map();
+    const collections = [];
+    let reportIds = false;
+    let depth = 0;
+
+    for (let offset = 0; offset < descriptor.length;) {
+        const prefix = descriptor[offset];
+
+        // Long items are reserved and carry nothing we use
+        if (prefix === 0xFE) {
+            offset += 3 + (descriptor[offset + 1] || 0);
+            continue;
+        }
+
+        const size = [0, 1, 2, 4][prefix & 0x03];
+        const type = (prefix >> 2) & 0x03;
+        const tag = prefix >> 4;
+
+        if (offset + 1 + size > descriptor.length) {
+            break;
+        }
+
+        let value = 0;
+        for (let i = size - 1; i >= 0; i--) {
+            value = value * 256 + descriptor[offset + 1 + i];
+        }
+        const signedValue = size ? signExtend(value, size * 8) : 0;
+        offset += 1 + size;
+
+        if (type === ITEM_GLOBAL) {
+            switch (tag) {
+                case GLOBAL_USAGE_PAGE: global.usagePage = value; break;
+                case GLOBAL_LOGICAL_MIN: global.logicalMin = signedValue; break;
+                case GLOBAL_LOGICAL_MAX: global.logicalMax = signedValue; break;
+                case GLOBAL_REPORT_SIZE: global.reportSize = value; break;
+                case GLOBAL_REPORT_COUNT: global.reportCount = value; break;
+                case GLOBAL_REPORT_ID:
+                    global.reportId = value;
+                    reportIds = true;
+                    break;
+                case GLOBAL_PUSH: stack.push({ ...global }); break;
+                case GLOBAL_POP: global = stack.pop() || global; break;
+                default: break;
+            }
+        } else if (type === ITEM_LOCAL) {
+            // Four-byte usages carry their own page in the upper half
+            const usage = size === 4 ? value : (global.usagePage * 0x10000) + value;
+
+            if (tag === LOCAL_USAGE) {
+                local.usages.push(usage);
+            } else if (tag === LOCAL_USAGE_MIN) {
+                local.usageMin = usage;
+            } else if (tag === LOCAL_USAGE_MAX && local.usageMin !== null) {
+                for (let u = local.usageMin; u <= usage && local.usages.length < 0x10000; u++) {
+                    local.usages.push(u);
+                }
+                local.usageMin = null;
+            }
+        } else if (type === ITEM_MAIN) {
+            if (tag === MAIN_COLLECTION) {
+                if (depth === 0 && local.usages.length) {
+                    collections.push(local.usages[0]);
+                }
+                depth++;
+            } else if (tag === MAIN_END_COLLECTION) {
+                depth = Math.max(0, depth - 1);
+            } else if (tag === MAIN_INPUT) {
+                let layout = layouts.get(global.reportId);
+                if (!layout) {
+                    layout = new ReportLayout(global.reportId);
+                    layouts.set(global.reportId, layout);
+                }
+                addInputFields(layout, global, local.usages, value);
+            }
+
+            local = { usages: [], usageMin: null };
+        }
+    }
+
+    return { reportIds, layouts, collections };
+}
+
+/**
+ * Add the fields of one Input item to a report layout
+ * @param {ReportLayout} layout Report layout
+ * @param {Object} global Global item state
+ * @param {Array<number>} usages Local usages, page in the upper 16 bits
+ * @param {number} flags Input item flags
+ */
+function addInputFields(layout, global, usages, flags) {
+    const size = global.reportSize;
+    const count = global.reportCount;
+
+    // Values are only signed when the logical range goes below zero
+    const signed = global.logicalMin < 0;
+    const logicalMin = global.logicalMin;
+
+    // Padding takes up bits but has no field
+    if ((flags & FLAG_CONSTANT) || usages.length === 0) {
+        layout.bits += size * count;
+        return;
+    }
+
+    for (let i = 0; i < count; i++) {
+        if (!(flags & FLAG_VARIABLE)) {
+            // Array elements hold an index into the usage list
+            layout.add({ size, kind: KIND_KEY, usages: usages.map(u => u & 0xFFFF), logicalMin });
+            continue;
+        }
+
+        const full = usages[Math.min(i, usages.length - 1)];
+        const page = full >>> 16;
+        const usage = full & 0xFFFF;
+
+        if (page === PAGE_BUTTON && size === 1 && usage >= 1 && usage <= 32) {
+            layout.add({ size, kind: KIND_BUTTON, slot: usage - 1 });
+        } else if (page === PAGE_KEYBOARD && size === 1 &&
+            usage >= KEYBOARD_LEFT_CONTROL && usage <= KEYBOARD_RIGHT_GUI) {
+            layout.add({ size, kind: KIND_MODIFIER, slot: usage - KEYBOARD_LEFT_CONTROL });
+        } else {
+            layout.add({ size, kind: KIND_VALUE, signed, name: usageName(page, usage) });
+        }
+    }
+}
+
+/**
+ * Compiled plans of every input report of one descriptor
+ */
+class HidReportDecoder {
+    /**
+     * @param {Uint8Array} descriptor Report descriptor bytes
+     */
+    constructor(descriptor) {
+        const parsed = parseReportDescriptor(descriptor);
+        const headerBits = parsed.reportIds ? 8 : 0;
+
+        this.reportIds = parsed.reportIds;
+        this.collections = parsed.collections;
+        this.plans = new Map();
+
+        for (const [id, layout] of parsed.layouts) {
+            this.plans.set(id, new ReportPlan(layout, headerBits));
+        }
+    }
+
+    /**
+     * Decode one input report
+     * @param {Uint8Array} data Report bytes as sent on the interrupt endpoint
+     * @returns {Object|null} { reportId, values }, null if no report matches
+     */
+    decode(data) {
+        const reportId = this.reportIds ? data[0] : 0;
+        const plan = this.plans.get(reportId);
+
+        if (!plan || data.length === 0) {
+            return null;
+        }
+        return { reportId, values: plan.decode(data) };
+    }
+}
+
+/* Decoders by descriptor, compiled on first use */
+const compiled = new WeakMap();
+
+/**
+ * Get the compiled decoder of a report descriptor
+ * @param {Uint8Array} descriptor Report descriptor bytes, as kept by the descriptor cache
+ * @returns {HidReportDecoder} Decoder shared by every report of the descriptor
+ */
+function getReportDecoder(descriptor) {
+    let decoder = compiled.get(descriptor);
+
+    if (!decoder) {
+        decoder = new HidReportDecoder(descriptor);
+        compiled.set(descriptor, decoder);
+    }
+    return decoder;
+}
+
+module.exports = {
+    parseReportDescriptor,
+    HidReportDecoder,
+    getReportDecoder
+};
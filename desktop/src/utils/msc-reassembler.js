@@ -0,0 +1,232 @@
+/**
+ * USBShark - Military-grade USB protocol analyzer
+ * Mass Storage Reassembler - SCSI commands from bulk-only transport
+ *
+ * Stitches CBW, data phase and CSW into one record per SCSI command with
+ * its LBA range, bytes moved, latency and throughput, at O(1) per bulk
+ * transaction. Endpoints are recognised through the descriptor cache, or by
+ * the CBW signature when the capture started after enumeration.
+ */
+
+const usbDecoder = require('./usb-decoder');
+const { parseCbw, parseCsw, MSC_CSW_STATUS } = require('./class-decoders');
+const { ENDPOINT_DIR_IN } = require('./descriptor-cache');
+const { elapsedUs } = require('./timestamps');
+
+const { CLASS_CODES } = usbDecoder;
+
+/**
+ * Mass storage command reassembler
+ */
+class MscReassembler {
+    /**
+     * @param {DescriptorCache} cache Descriptor cache, may be null
+     */
+    constructor(cache) {
+        this.cache = cache;
+        this.reset();
+    }
+
+    /**
+     * Drop all commands
+     */
+    reset() {
+        this.commands = [];
+        this.open = new Map();
+        this.storageDevices = new Set();
+        this.stats = new Map();
+    }
+
+    /**
+     * Check whether an endpoint belongs to a mass storage interface
+     * @param {number} address Device address
+     * @param {number} endpointAddress Endpoint number with 0x80 set for IN
+     * @returns {boolean} True for mass storage endpoints
+     */
+    isStorageEndpoint(address, endpointAddress) {
+        const endpoint = this.cache ? this.cache.getEndpoint(address, endpointAddress) : undefined;
+
+        if (endpoint && endpoint.interface) {
+            return endpoint.interface.interfaceClass === CLASS_CODES.MASS_STORAGE;
+        }
+
+        // Without descriptors, a device that sent a CBW is taken as storage
+        return this.storageDevices.has(address) || !endpoint;
+    }
+
+    /**
+     * Process one transaction from TransactionAnalyzer
+     * @param {Object} transaction Completed or incomplete transaction
+     * @returns {Object|null} Command completed by this transaction
+     */
+    processTransaction(transaction) {
+        const address = transaction.deviceAddress;
+        const isIn = transaction.type === 'IN Transaction';
+
+        if ((!isIn && transaction.type !== 'OUT Transaction') || !transaction.endpoint ||
+            address === null || address === undefined) {
+            return null;
+        }
+
+        const command = this.open.get(address);
+        const packets = transaction.packets || [];
+        const data = packets.find(p => usbDecoder.getPacketType(p.pid) === 'Data');
+
+        // Flow control while the device is busy counts against the command
+        if (transaction.status === 'Not Ready') {
+            if (command) {
+                command.naks++;
+            }
+            return null;
+        }
+
+        // Only data the receiver acknowledged moved
+        if (transaction.status !== 'Success' || !data || !data.data) {
+            return null;
+        }
+
+        const payload = data.data;
+        const time = data.timestamp;
+
+        if (!isIn) {
+            const cbw = parseCbw(payload);
+
+            if (cbw && this.isStorageEndpoint(address, transaction.endpoint)) {
+                this.storageDevices.add(address);
+                return this.startCommand(address, cbw, time);
+            }
+        } else if (command) {
+            const csw = parseCsw(payload);
+
+            if (csw && csw.tag === command.tag) {
+                return this.finishCommand(address, command, csw, time);
+            }
+        }
+
+        if (command && this.isStorageEndpoint(address, transaction.endpoint | (isIn ? ENDPOINT_DIR_IN : 0))) {
+            if (command.dataBytes === 0) {
+                command.dataStart = transaction.timestamp;
+            }
+            // Bytes cut by the snap length still moved
+            command.dataBytes += usbDecoder.getDataLength(data);
+            command.dataEnd = time;
+        }
+
+        return null;
+    }
+
+    /**
+     * Open a command on its CBW
+     * @param {number} address Device address
+     * @param {Object} cbw Parsed CBW
+     * @param {number} time CBW timestamp
+     * @returns {Object|null} Previous command, if it never got its CSW
+     */
+    startCommand(address, cbw, time) {
+        const previous = this.open.get(address);
+        let abandoned = null;
+
+        if (previous) {
+            previous.status = 'No CSW';
+            abandoned = this.record(previous);
+        }
+
+        this.open.set(address, {
+            address,
+            tag: cbw.tag,
+            lun: cbw.lun,
+            opcode: cbw.opcode,
+            command: cbw.command,
+            lba: cbw.lba,
+            blocks: cbw.blocks,
+            dataIn: cbw.dataIn,
+            expectedBytes: cbw.dataLength,
+            dataBytes: 0,
+            naks: 0,
+            start: time,
+            dataStart: null,
+            dataEnd: null,
+            end: null,
+            status: null,
+            residue: null
+        });
+
+        return abandoned;
+    }
+
+    /**
+     * Close a command on its CSW
+     * @param {number} address Device address
+     * @param {Object} command Open command
+     * @param {Object} csw Parsed CSW
+     * @param {number} time CSW timestamp
+     * @returns {Object} Finished command
+     */
+    finishCommand(address, command, csw, time) {
+        this.open.delete(address);
+        command.end = time;
+        command.status = MSC_CSW_STATUS[csw.status] || 'Unknown';
+        command.residue = csw.residue;
+        return this.record(command);
+    }
+
+    /**
+     * Derive timing figures and add a command to the results
+     * @param {Object} command Finished or abandoned command
+     * @returns {Object} The command
+     */
+    record(command) {
+        const end = command.end !== null ? command.end : command.dataEnd;
+
+        command.latencyUs = end !== null ? elapsedUs(command.start, end) : null;
+
+        // Throughput over the whole command, as the host application sees it
+        command.mbPerSec = command.latencyUs > 0 && command.dataBytes > 0
+            ? command.dataBytes / command.latencyUs
+            : null;
+
+        this.commands.push(command);
+
+        let stats = this.stats.get(command.command);
+        if (!stats) {
+            stats = { command: command.command, count: 0, bytes: 0, totalUs: 0, maxUs: 0, failed: 0 };
+            this.stats.set(command.command, stats);
+        }
+
+        stats.count++;
+        stats.bytes += command.dataBytes;
+        stats.totalUs += command.latencyUs || 0;
+        stats.maxUs = Math.max(stats.maxUs, command.latencyUs || 0);
+        if (command.status !== 'Passed') {
+            stats.failed++;
+        }
+
+        return command;
+    }
+
+    /**
+     * Get the slowest finished commands
+     * @param {number} count Number of commands
+     * @returns {Array<Object>} Commands by descending latency
+     */
+    slowest(count) {
+        return this.commands
+            .filter(command => command.latencyUs !== null)
+            .sort((a, b) => b.latencyUs - a.latencyUs)
+            .slice(0, count);
+    }
+
+    /**
+     * Get per-command totals
+     * @returns {Array<Object>} { command, count, bytes, totalUs, maxUs, failed, avgUs, mbPerSec }
+     */
+    summary() {
+        return Array.from(this.stats.values()).map(stats => ({
+            ...stats,
+            avgUs: stats.count ? stats.totalUs / stats.count : 0,
+            mbPerSec: stats.totalUs > 0 ? stats.bytes / stats.totalUs : 0
+        }));
+    }
+}
+
+module.exports = MscReassembler;
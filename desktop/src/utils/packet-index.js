@@ -0,0 +1,883 @@
+/**
+ * USBShark - Military-grade USB protocol analyzer
+ * Packet Index Module
+ *
+ * Columnar packet store with per-value bitmap indexes, and the display
+ * filter language compiled against it. Most filters resolve by combining
+ * bitmaps a word at a time instead of visiting every packet, and a live
+ * filter only examines packets added or changed since its last update.
+ *
+ * Filter syntax: comparisons joined with && (and), || (or), ! (not) and
+ * parentheses, e.g. "addr == 3 && (ep == 1 || ep == 2) && !(status == nak)".
+ *   pid     PID value or name (IN, DATA0, NAK, ...)
+ *   type    token, data, handshake, special
+ *   addr    device address, 0-127
+ *   ep      endpoint number, 0-15
+ *   crc     valid, error; "crc" alone means valid
+ *   status  none, ok, nak, stall (outcome of the packet's transaction)
+ * Operators: ==, !=, <, <=, >, >=. Data and handshake packets carry the
+ * address and endpoint of the token before them.
+ *
+ * protocol.field compares a class decoder field, e.g. "msc.opcode == 0x28"
+ * or "hid.buttons != 0". These decode packets on demand, so they are only
+ * tested on rows the rest of an && chain already selected.
+ */
+
+const usbDecoder = require('./usb-decoder');
+
+/**
+ * Column value of packets without an address or endpoint (SOF)
+ */
+const NO_VALUE = 0xFF;
+
+/**
+ * Transaction status codes in the status column
+ */
+const STATUS = {
+    NONE: 0,
+    OK: 1,
+    NAK: 2,
+    STALL: 3
+};
+
+/**
+ * Transaction status names used by TransactionAnalyzer
+ */
+const TRANSACTION_STATUS = {
+    'Success': STATUS.OK,
+    'Not Ready': STATUS.NAK,
+    'Error: Stalled': STATUS.STALL
+};
+
+/**
+ * Growable bit set, one bit per packet row
+ */
+class Bitmap {
+    /**
+     * @param {number} words Initial capacity in 32-bit words
+     */
+    constructor(words = 32) {
+        this.words = new Uint32Array(words);
+    }
+
+    /**
+     * Make room for a row
+     * @param {number} row Row number
+     */
+    ensure(row) {
+        const word = row >>> 5;
+
+        if (word >= this.words.length) {
+            let length = this.words.length * 2;
+            while (length <= word) {
+                length *= 2;
+            }
+
+            const words = new Uint32Array(length);
+            words.set(this.words);
+            this.words = words;
+        }
+    }
+
+    /**
+     * @param {number} row Row number
+     */
+    set(row) {
+        this.ensure(row);
+        this.words[row >>> 5] |= 1 << (row & 31);
+    }
+
+    /**
+     * @param {number} row Row number
+     */
+    clear(row) {
+        if ((row >>> 5) < this.words.length) {
+            this.words[row >>> 5] &= ~(1 << (row & 31));
+        }
+    }
+
+    /**
+     * @param {number} row Row number
+     * @returns {boolean} True if the row is in the set
+     */
+    has(row) {
+        return (row >>> 5) < this.words.length && (this.words[row >>> 5] & (1 << (row & 31))) !== 0;
+    }
+
+    /**
+     * Intersect in place
+     * @param {Bitmap} other Other set
+     * @returns {Bitmap} This set
+     */
+    and(other) {
+        const count = Math.min(this.words.length, other.words.length);
+
+        for (let i = 0; i < count; i++) {
+            this.words[i] &= other.words[i];
+        }
+        this.words.fill(0, count);
+
+        return this;
+    }
+
+    /**
+     * Unite in place
+     * @param {Bitmap} other Other set
+     * @returns {Bitmap} This set
+     */
+    or(other) {
+        if (other.words.length > this.words.length) {
+            this.ensure(other.words.length * 32 - 1);
+        }
+
+        for (let i = 0; i < other.words.length; i++) {
+            this.words[i] |= other.words[i];
+        }
+
+        return this;
+    }
+
+    /**
+     * Complement in place over the first size rows
+     * @param {number} size Number of rows
+     * @returns {Bitmap} This set
+     */
+    not(size) {
+        if (size > 0) {
+            this.ensure(size - 1);
+        }
+
+        const full = size >>> 5;
+        for (let i = 0; i < full; i++) {
+            this.words[i] = ~this.words[i];
+        }
+
+        if (size & 31) {
+            this.words[full] = ~this.words[full] & ((1 << (size & 31)) - 1);
+        }
+        this.words.fill(0, Math.ceil(size / 32));
+
+        return this;
+    }
+
+    /**
+     * @returns {Bitmap} Independent copy
+     */
+    clone() {
+        const copy = new Bitmap(0);
+        copy.words = this.words.slice();
+        return copy;
+    }
+
+    /**
+     * Check whether any row in a range is set
+     * @param {number} start First row
+     * @param {number} end Row after the last
+     * @returns {boolean} True if at least one row is set
+     */
+    any(start, end) {
+        for (let row = start; row < end; row++) {
+            // Skip empty words whole
+            if ((row & 31) === 0 && row + 32 <= end && this.words[row >>> 5] === 0) {
+                row += 31;
+                continue;
+            }
+
+            if (this.has(row)) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /**
+     * Call fn for every set row in ascending order
+     * @param {Function} fn Called with the row number
+     */
+    forEach(fn) {
+        for (let i = 0; i < this.words.length; i++) {
+            let word = this.words[i];
+
+            while (word !== 0) {
+                const lowest = word & -word;
+                fn((i << 5) + 31 - Math.clz32(lowest));
+                word ^= lowest;
+            }
+        }
+    }
+
+    /**
+     * @returns {number} Number of set rows
+     */
+    count() {
+        let total = 0;
+
+        for (let i = 0; i < this.words.length; i++) {
+            let word = this.words[i];
+            word -= (word >>> 1) & 0x55555555;
+            word = (word & 0x33333333) + ((word >>> 2) & 0x33333333);
+            total += (((word + (word >>> 4)) & 0x0F0F0F0F) * 0x01010101) >>> 24;
+        }
+
+        return total;
+    }
+}
+
+/**
+ * Columnar packet store
+ * Keeps the filterable fields of every packet in typed arrays, plus one
+ * bitmap per distinct value of each column
+ */
+class PacketIndex {
+    constructor() {
+        this.reset();
+    }
+
+    /**
+     * Drop all packets
+     */
+    reset() {
+        this.size = 0;
+        this.packets = [];
+        this.rowOf = new WeakMap();
+        this.columns = {
+            pid: new Uint8Array(1024),
+            addr: new Uint8Array(1024),
+            ep: new Uint8Array(1024),
+            crc: new Uint8Array(1024),
+            status: new Uint8Array(1024)
+        };
+
+        // Transaction number of each row, -1 until its transaction completes
+        this.transactionOf = new Int32Array(1024).fill(-1);
+        this.transactions = [];
+        this.bitmaps = {
+            pid: new Map(),
+            addr: new Map(),
+            ep: new Map(),
+            crc: new Map(),
+            status: new Map()
+        };
+
+        // Rows whose status changed, in order, for live filters to re-check
+        this.statusLog = [];
+        this.generation = (this.generation || 0) + 1;
+        this.lastAddr = NO_VALUE;
+        this.lastEp = NO_VALUE;
+    }
+
+    /**
+     * Read a class decoder field of a row
+     * @param {number} row Row number
+     * @param {string} name Field as protocol.field
+     * @returns {*} Field value, undefined without a decoder or field
+     */
+    decodedField(row, name) {
+        return this.decoder ? this.decoder.field(this.packets[row], name) : undefined;
+    }
+
+    /**
+     * Store a column value and index it
+     * @param {string} column Column name
+     * @param {number} row Row number
+     * @param {number} value Column value, 0-255
+     */
+    put(column, row, value) {
+        let bitmap = this.bitmaps[column].get(value);
+
+        if (!bitmap) {
+            bitmap = new Bitmap();
+            this.bitmaps[column].set(value, bitmap);
+        }
+
+        bitmap.set(row);
+        this.columns[column][row] = value;
+    }
+
+    /**
+     * Add a packet
+     * @param {Object} packet Packet with pid, devAddr (or deviceAddress), endpoint, crcValid
+     * @returns {number} Row of the packet
+     */
+    append(packet) {
+        const row = this.size;
+
+        if (row === this.columns.pid.length) {
+            for (const name of Object.keys(this.columns)) {
+                const column = new Uint8Array(row * 2);
+                column.set(this.columns[name]);
+                this.columns[name] = column;
+            }
+
+            const transactionOf = new Int32Array(row * 2).fill(-1);
+            transactionOf.set(this.transactionOf);
+            this.transactionOf = transactionOf;
+        }
+
+        const pid = packet.pid & 0xFF;
+        const packetType = usbDecoder.getPacketType(pid);
+
+        // Data and handshake packets belong to the token before them
+        if (pid === usbDecoder.PID.SOF) {
+            this.put('addr', row, NO_VALUE);
+            this.put('ep', row, NO_VALUE);
+        } else {
+            // Device frames carry devAddr, older sources deviceAddress
+            const address = packet.devAddr !== undefined ? packet.devAddr : packet.deviceAddress;
+
+            if (packetType === 'Token' && address !== undefined) {
+                this.lastAddr = address & 0x7F;
+                this.lastEp = packet.endpoint & 0x0F;
+            }
+            this.put('addr', row, address !== undefined ? address & 0x7F : this.lastAddr);
+            this.put('ep', row, packet.endpoint !== undefined ? packet.endpoint & 0x0F : this.lastEp);
+        }
+
+        this.put('pid', row, pid);
+        this.put('crc', row, packet.crcValid === false ? 0 : 1);
+        this.put('status', row, STATUS.NONE);
+
+        this.packets.push(packet);
+        this.rowOf.set(packet, row);
+        this.size++;
+
+        return row;
+    }
+
+    /**
+     * Record the outcome of a completed transaction on its packets
+     * @param {Object} transaction Transaction from TransactionAnalyzer
+     */
+    addTransaction(transaction) {
+        const status = TRANSACTION_STATUS[transaction.status] || STATUS.NONE;
+        const number = this.transactions.length;
+
+        this.transactions.push(transaction);
+
+        for (const packet of transaction.packets) {
+            const row = this.rowOf.get(packet);
+
+            if (row === undefined) {
+                continue;
+            }
+
+            this.transactionOf[row] = number;
+            if (this.columns.status[row] === status) {
+                continue;
+            }
+
+            this.bitmaps.status.get(this.columns.status[row]).clear(row);
+            this.put('status', row, status);
+            this.statusLog.push(row);
+        }
+    }
+
+    /**
+     * Get the rows holding any of a set of values
+     * @param {string} column Column name
+     * @param {Set} values Matching values
+     * @returns {Bitmap} New bitmap
+     */
+    select(column, values) {
+        const result = new Bitmap(Math.ceil(this.size / 32) || 1);
+
+        for (const [value, bitmap] of this.bitmaps[column]) {
+            if (values.has(value)) {
+                result.or(bitmap);
+            }
+        }
+
+        return result;
+    }
+
+    /**
+     * Get the packets of a set of rows
+     * @param {Bitmap} bitmap Rows
+     * @returns {Array} Packets in row order
+     */
+    packetsOf(bitmap) {
+        const packets = [];
+        bitmap.forEach(row => packets.push(this.packets[row]));
+        return packets;
+    }
+
+    /**
+     * Get the completed transactions with at least one packet in a set of rows
+     * @param {Bitmap} bitmap Rows
+     * @returns {Array} Transactions in completion order
+     */
+    transactionsOf(bitmap) {
+        const numbers = new Bitmap(Math.ceil(this.transactions.length / 32) || 1);
+        const transactions = [];
+
+        bitmap.forEach(row => {
+            if (this.transactionOf[row] >= 0) {
+                numbers.set(this.transactionOf[row]);
+            }
+        });
+        numbers.forEach(number => transactions.push(this.transactions[number]));
+
+        return transactions;
+    }
+}
+
+/**
+ * Named values accepted per field
+ */
+const FIELD_NAMES = {
+    pid: Object.fromEntries(Object.entries(usbDecoder.PID).map(([name, value]) => [name.toLowerCase(), value])),
+    crc: { valid: 1, ok: 1, true: 1, error: 0, bad: 0, false: 0 },
+    status: { none: STATUS.NONE, ok: STATUS.OK, success: STATUS.OK, nak: STATUS.NAK, stall: STATUS.STALL },
+    type: { token: 'Token', data: 'Data', handshake: 'Handshake', special: 'Special' }
+};
+
+/**
+ * Fields and the column each one reads
+ */
+const FIELD_COLUMNS = {
+    pid: 'pid',
+    type: 'pid',
+    addr: 'addr',
+    ep: 'ep',
+    crc: 'crc',
+    status: 'status'
+};
+
+/**
+ * Split a filter into tokens
+ * @param {string} text Filter text
+ * @returns {Array} Tokens
+ */
+function tokenize(text) {
+    const tokens = [];
+    const pattern = /\s*(?:(==|!=|<=|>=|&&|\|\||[<>!()])|(0x[0-9a-fA-F]+|\d+)|([A-Za-z_][A-Za-z0-9_.]*))/y;
+
+    pattern.lastIndex = 0;
+    while (pattern.lastIndex < text.length) {
+        const start = pattern.lastIndex;
+        const match = pattern.exec(text);
+
+        if (!match) {
+            if (/^\s*$/.test(text.slice(start))) {
+                break;
+            }
+            throw new Error(`Unexpected character at ${start + 1}`);
+        }
+
+        if (match[1]) {
+            tokens.push({ kind: 'op', value: match[1] });
+        } else if (match[2]) {
+            tokens.push({ kind: 'number', value: Number(match[2]) });
+        } else {
+            const word = match[3].toLowerCase();
+            const keywords = { and: '&&', or: '||', not: '!' };
+            tokens.push(keywords[word] ? { kind: 'op', value: keywords[word] } : { kind: 'word', value: word });
+        }
+    }
+
+    return tokens;
+}
+
+/**
+ * Column values a comparison selects
+ * @param {string} field Field name
+ * @param {string} op Comparison operator
+ * @param {Object} token Value token
+ * @returns {Set} Matching column values
+ */
+function comparisonValues(field, op, token) {
+    let targets;
+
+    if (token.kind === 'number') {
+        targets = [token.value];
+    } else if (FIELD_NAMES[field] && FIELD_NAMES[field][token.value] !== undefined) {
+        targets = [FIELD_NAMES[field][token.value]];
+    } else {
+        throw new Error(`Unknown ${field} value "${token.value}"`);
+    }
+
+    // A packet type stands for all of its PIDs
+    if (field === 'type') {
+        if (op !== '==' && op !== '!=') {
+            throw new Error('type only supports == and !=');
+        }
+        targets = usbDecoder.PID_TYPES[targets[0]];
+    }
+
+    const compare = {
+        '==': (value, target) => value === target,
+        '!=': (value, target) => value !== target,
+        '<': (value, target) => value < target,
+        '<=': (value, target) => value <= target,
+        '>': (value, target) => value > target,
+        '>=': (value, target) => value >= target
+    }[op];
+
+    const values = new Set();
+    for (let value = 0; value < 256; value++) {
+        const matches = op === '!='
+            ? targets.every(target => compare(value, target))
+            : targets.some(target => compare(value, target));
+
+        if (matches) {
+            values.add(value);
+        }
+    }
+
+    return values;
+}
+
+/**
+ * Packet IDs class decoders can produce fields for
+ */
+const DATA_PIDS = new Set(usbDecoder.PID_TYPES.Data);
+
+/**
+ * Recursive descent parser producing predicate nodes
+ * Each node has bitmap(index) for whole-store evaluation and
+ * test(index, row) for a single row
+ */
+class FilterParser {
+    /**
+     * @param {Array} tokens Tokens from tokenize()
+     */
+    constructor(tokens) {
+        this.tokens = tokens;
+        this.position = 0;
+    }
+
+    peek(value) {
+        const token = this.tokens[this.position];
+        return token && token.kind === 'op' && token.value === value;
+    }
+
+    next() {
+        if (this.position >= this.tokens.length) {
+            throw new Error('Unexpected end of filter');
+        }
+        return this.tokens[this.position++];
+    }
+
+    parse() {
+        const node = this.parseOr();
+
+        if (this.position < this.tokens.length) {
+            throw new Error(`Unexpected "${this.tokens[this.position].value}"`);
+        }
+
+        return node;
+    }
+
+    parseOr() {
+        let node = this.parseAnd();
+
+        while (this.peek('||')) {
+            this.position++;
+            const left = node;
+            const right = this.parseAnd();
+            node = {
+                lazy: left.lazy || right.lazy,
+                bitmap: index => left.bitmap(index).or(right.bitmap(index)),
+                test: (index, row) => left.test(index, row) || right.test(index, row)
+            };
+        }
+
+        return node;
+    }
+
+    parseAnd() {
+        let node = this.parseUnary();
+
+        while (this.peek('&&')) {
+            this.position++;
+            let left = node;
+            let right = this.parseUnary();
+
+            // Decoded operands are only tested on rows the other side selected
+            if (left.lazy && !right.lazy) {
+                [left, right] = [right, left];
+            }
+
+            const lazyRight = right;
+            node = {
+                lazy: left.lazy,
+                bitmap: lazyRight.lazy
+                    ? index => {
+                        const rows = left.bitmap(index);
+                        rows.forEach(row => {
+                            if (!lazyRight.test(index, row)) {
+                                rows.clear(row);
+                            }
+                        });
+                        return rows;
+                    }
+                    : index => left.bitmap(index).and(lazyRight.bitmap(index)),
+                test: (index, row) => left.test(index, row) && lazyRight.test(index, row)
+            };
+        }
+
+        return node;
+    }
+
+    parseUnary() {
+        if (this.peek('!')) {
+            this.position++;
+            const operand = this.parseUnary();
+            return {
+                lazy: operand.lazy,
+                bitmap: index => operand.bitmap(index).not(index.size),
+                test: (index, row) => !operand.test(index, row)
+            };
+        }
+
+        if (this.peek('(')) {
+            this.position++;
+            const node = this.parseOr();
+
+            if (!this.peek(')')) {
+                throw new Error('Missing ")"');
+            }
+            this.position++;
+
+            return node;
+        }
+
+        return this.parseComparison();
+    }
+
+    parseComparison() {
+        const token = this.next();
+
+        if (token.kind === 'word' && token.value.includes('.')) {
+            return this.parseDecodedComparison(token.value);
+        }
+
+        if (token.kind !== 'word' || !FIELD_COLUMNS[token.value]) {
+            throw new Error(`Unknown field "${token.value}"`);
+        }
+
+        const field = token.value;
+        const column = FIELD_COLUMNS[field];
+        let values;
+
+        const operator = this.tokens[this.position];
+        if (operator && operator.kind === 'op' && ['==', '!=', '<', '<=', '>', '>='].includes(operator.value)) {
+            this.position++;
+            values = comparisonValues(field, operator.value, this.next());
+        } else if (field === 'crc') {
+            values = new Set([1]);
+        } else {
+            throw new Error(`Expected a comparison after "${field}"`);
+        }
+
+        return {
+            bitmap: index => index.select(column, values),
+            test: (index, row) => values.has(index.columns[column][row])
+        };
+    }
+
+    /**
+     * Comparison of a class decoder field, evaluated row by row
+     * @param {string} field Field as protocol.field
+     * @returns {Object} Lazy predicate node
+     */
+    parseDecodedComparison(field) {
+        const operator = this.next();
+        const compare = {
+            '==': (value, target) => value === target,
+            '!=': (value, target) => value !== target,
+            '<': (value, target) => value < target,
+            '<=': (value, target) => value <= target,
+            '>': (value, target) => value > target,
+            '>=': (value, target) => value >= target
+        }[operator.value];
+
+        if (operator.kind !== 'op' || !compare) {
+            throw new Error(`Expected a comparison after "${field}"`);
+        }
+
+        const token = this.next();
+        if (token.kind === 'word' && operator.value !== '==' && operator.value !== '!=') {
+            throw new Error(`${field} only compares names with == and !=`);
+        }
+
+        const target = token.value;
+        const test = (index, row) => {
+            let value = index.decodedField(row, field);
+
+            if (value === undefined) {
+                return false;
+            }
+            if (token.kind === 'word') {
+                value = String(value).toLowerCase();
+            }
+            return compare(value, target);
+        };
+
+        return {
+            lazy: true,
+            bitmap: index => {
+                const rows = index.select('pid', DATA_PIDS);
+                rows.forEach(row => {
+                    if (!test(index, row)) {
+                        rows.clear(row);
+                    }
+                });
+                return rows;
+            },
+            test
+        };
+    }
+}
+
+/**
+ * Compile a display filter
+ * @param {string} text Filter text, empty matches everything
+ * @returns {Object} Predicate with bitmap(index) and test(index, row)
+ * @throws {Error} On syntax errors
+ */
+function compileFilter(text) {
+    const tokens = tokenize(text || '');
+
+    if (tokens.length === 0) {
+        return {
+            bitmap: index => new Bitmap(1).not(index.size),
+            test: () => true
+        };
+    }
+
+    return new FilterParser(tokens).parse();
+}
+
+/**
+ * Result of a filter kept up to date as the index grows
+ * revision changes whenever rows already in the result may have left it or
+ * earlier rows joined it, so a result that only grew at the end keeps it.
+ */
+class LiveFilter {
+    /**
+     * @param {PacketIndex} index Packet index
+     * @param {Object} predicate Compiled filter
+     */
+    constructor(index, predicate) {
+        this.index = index;
+        this.predicate = predicate;
+        this.generation = -1;
+        this.revision = 0;
+    }
+
+    /**
+     * Bring the result up to date
+     * @returns {Bitmap} Matching rows
+     */
+    update() {
+        const index = this.index;
+
+        // Start over after a reset, otherwise only visit what changed
+        if (this.generation !== index.generation) {
+            this.result = this.predicate.bitmap(index);
+            this.rows = index.size;
+            this.logPosition = index.statusLog.length;
+            this.generation = index.generation;
+            this.revision++;
+            return this.result;
+        }
+
+        for (; this.logPosition < index.statusLog.length; this.logPosition++) {
+            const row = index.statusLog[this.logPosition];
+
+            if (row >= this.rows) {
+                continue;
+            }
+
+            const matches = this.predicate.test(index, row);
+
+            if (matches !== this.result.has(row)) {
+                this.revision++;
+            }
+            if (matches) {
+                this.result.set(row);
+            } else {
+                this.result.clear(row);
+            }
+        }
+
+        for (; this.rows < index.size; this.rows++) {
+            if (this.predicate.test(index, this.rows)) {
+                this.result.set(this.rows);
+            }
+        }
+
+        return this.result;
+    }
+}
+
+/**
+ * Packets and transactions passing a live filter, as lists
+ * Packets and transactions added to the index since the last update are
+ * appended when they match. The lists are only rebuilt from the whole
+ * result after a revision of the filter.
+ */
+class LiveSelection {
+    /**
+     * @param {LiveFilter} filter Live filter
+     */
+    constructor(filter) {
+        this.filter = filter;
+        this.revision = -1;
+        this.rows = 0;
+        this.transactionCount = 0;
+        this.packets = [];
+        this.transactions = [];
+    }
+
+    /**
+     * Bring the lists up to date
+     * @returns {LiveSelection} This selection
+     */
+    update() {
+        const index = this.filter.index;
+        const result = this.filter.update();
+
+        if (this.revision !== this.filter.revision) {
+            this.packets = index.packetsOf(result);
+            this.transactions = index.transactionsOf(result);
+        } else {
+            for (let row = this.rows; row < index.size; row++) {
+                if (result.has(row)) {
+                    this.packets.push(index.packets[row]);
+                }
+            }
+
+            // A transaction is listed if any of its packets passes the filter
+            for (let number = this.transactionCount; number < index.transactions.length; number++) {
+                const transaction = index.transactions[number];
+
+                const matches = transaction.packets.some(packet => {
+                    const row = index.rowOf.get(packet);
+                    return row !== undefined && result.has(row);
+                });
+
+                if (matches) {
+                    this.transactions.push(transaction);
+                }
+            }
+        }
+
+        this.revision = this.filter.revision;
+        this.rows = index.size;
+        this.transactionCount = index.transactions.length;
+        return this;
+    }
+}
+
+module.exports = {
+    NO_VALUE,
+    STATUS,
+    Bitmap,
+    PacketIndex,
+    LiveFilter,
+    LiveSelection,
+    compileFilter
+};
@@ -0,0 +1,361 @@
+/**
+ * USBShark - Military-grade USB protocol analyzer
+ * Payload Search - Byte-pattern and text search over captured payloads
+ *
+ * Payloads are packed back to back into large chunks, so one search is a
+ * single scan per chunk instead of one call per packet. The search anchors on
+ * the longest run of the pattern with at most a few unknown bits and runs
+ * Buffer.indexOf, which uses memchr and Boyer-Moore-Horspool natively, once
+ * per spelling of that run. Patterns with no such run fall back to a masked
+ * Horspool scan. Matches never span two packets.
+ */
+
+/* Bytes per arena chunk, a packet never spans two chunks */
+const CHUNK_SIZE = 64 * 1024 * 1024;
+
+/* Longest pattern accepted, in bytes */
+const MAX_PATTERN_LENGTH = 256;
+
+/* Unknown bits allowed in the indexOf anchor, each doubles the variants searched */
+const MAX_ANCHOR_FREE_BITS = 3;
+
+/**
+ * Parse a search pattern
+ *
+ * Terms are separated by spaces and concatenated:
+ *   DE AD BE EF or DEADBEEF  exact bytes
+ *   ?? / 4? / ?F             any byte / one nibble known
+ *   "text"                   ASCII text
+ *   i"text"                  ASCII text, letters in either case
+ *   u"text"                  UTF-16LE text, as in string descriptors
+ *
+ * @param {string} text Pattern source
+ * @returns {Object} { bytes, mask } with bytes[i] already masked
+ */
+function parsePattern(text) {
+    const bytes = [];
+    const mask = [];
+    let i = 0;
+
+    const push = (value, bits) => {
+        bytes.push(value & bits);
+        mask.push(bits);
+    };
+
+    while (i < text.length) {
+        const c = text[i];
+
+        if (/\s/.test(c)) {
+            i++;
+            continue;
+        }
+
+        // Quoted text, with an optional i or u prefix
+        const prefix = /[iu]/i.test(c) && text[i + 1] === '"' ? c.toLowerCase() : '';
+        if (c === '"' || prefix) {
+            const start = i + (prefix ? 2 : 1);
+            const end = text.indexOf('"', start);
+            if (end < 0) {
+                throw new Error(`Unterminated string at position ${i}`);
+            }
+
+            for (const ch of text.slice(start, end)) {
+                const code = ch.charCodeAt(0);
+
+                if (prefix === 'u') {
+                    push(code & 0xFF, 0xFF);
+                    push(code >> 8, 0xFF);
+                } else if (code > 0x7F) {
+                    throw new Error(`Non-ASCII character '${ch}', use u"..." for UTF-16`);
+                } else if (prefix === 'i' && /[a-z]/i.test(ch)) {
+                    // Clearing bit 5 folds the case of ASCII letters
+                    push(code, 0xDF);
+                } else {
+                    push(code, 0xFF);
+                }
+            }
+
+            i = end + 1;
+            continue;
+        }
+
+        // Hex bytes, two digits or wildcards each
+        const pair = text.slice(i, i + 2);
+        if (!/^[0-9a-f?]{2}$/i.test(pair)) {
+            throw new Error(`Invalid byte '${pair}' at position ${i}`);
+        }
+
+        const high = pair[0] === '?' ? null : parseInt(pair[0], 16);
+        const low = pair[1] === '?' ? null : parseInt(pair[1], 16);
+        push(((high || 0) << 4) | (low || 0), (high === null ? 0 : 0xF0) | (low === null ? 0 : 0x0F));
+        i += 2;
+    }
+
+    // Leading and trailing wildcards only widen the match, drop them
+    while (mask.length > 0 && mask[mask.length - 1] === 0) {
+        bytes.pop();
+        mask.pop();
+    }
+    while (mask.length > 0 && mask[0] === 0) {
+        bytes.shift();
+        mask.shift();
+    }
+
+    if (bytes.length === 0) {
+        throw new Error('Empty pattern');
+    }
+    if (bytes.length > MAX_PATTERN_LENGTH) {
+        throw new Error(`Pattern longer than ${MAX_PATTERN_LENGTH} bytes`);
+    }
+
+    return { bytes: Uint8Array.from(bytes), mask: Uint8Array.from(mask) };
+}
+
+/**
+ * Count the set bits of a byte
+ * @param {number} value Byte
+ * @returns {number} Set bits
+ */
+function popcount(value) {
+    let count = 0;
+    for (; value; value &= value - 1) {
+        count++;
+    }
+    return count;
+}
+
+/**
+ * Spell out every exact byte string a masked run can match
+ * @param {Uint8Array} bytes Masked bytes of the run
+ * @param {Uint8Array} mask Masks of the run
+ * @returns {Array<Buffer>} One buffer per variant
+ */
+function expandAnchor(bytes, mask) {
+    let variants = [Buffer.from(bytes)];
+
+    for (let i = 0; i < bytes.length; i++) {
+        for (let bit = 0x80; bit; bit >>= 1) {
+            if (mask[i] & bit) {
+                continue;
+            }
+            variants = variants.concat(variants.map((variant) => {
+                const copy = Buffer.from(variant);
+                copy[i] |= bit;
+                return copy;
+            }));
+        }
+    }
+
+    return variants;
+}
+
+/**
+ * Compile a parsed pattern into a matcher
+ * @param {Object} pattern Result of parsePattern()
+ * @returns {Object} Matcher with find(buffer, from, end) returning an offset or -1
+ */
+function compilePattern(pattern) {
+    const { bytes, mask } = pattern;
+    const length = bytes.length;
+
+    const verify = (buffer, at) => {
+        for (let i = 0; i < length; i++) {
+            if ((buffer[at + i] & mask[i]) !== bytes[i]) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    // Longest run with few enough unknown bits to spell out every variant
+    let anchorStart = 0;
+    let anchorLength = 0;
+    for (let start = 0; start < length; start++) {
+        let freeBits = 0;
+        let end = start;
+
+        while (end < length) {
+            freeBits += 8 - popcount(mask[end]);
+            if (freeBits > MAX_ANCHOR_FREE_BITS) {
+                break;
+            }
+            end++;
+        }
+
+        if (end - start > anchorLength) {
+            anchorLength = end - start;
+            anchorStart = start;
+        }
+    }
+
+    if (anchorLength > 0) {
+        const anchors = expandAnchor(bytes.subarray(anchorStart, anchorStart + anchorLength),
+            mask.subarray(anchorStart, anchorStart + anchorLength));
+        const exact = anchors.length === 1 && anchorLength === length;
+
+        // Next hit of each variant, valid while the scan stays in one buffer
+        const next = new Float64Array(anchors.length);
+        let cached = null;
+
+        const nextAnchor = (buffer, from) => {
+            if (cached !== buffer) {
+                cached = buffer;
+                next.fill(-2);
+            }
+
+            let best = -1;
+            for (let k = 0; k < anchors.length; k++) {
+                if (next[k] !== -1 && next[k] < from) {
+                    next[k] = buffer.indexOf(anchors[k], from);
+                }
+                if (next[k] >= 0 && (best < 0 || next[k] < best)) {
+                    best = next[k];
+                }
+            }
+            return best;
+        };
+
+        return {
+            length,
+            find(buffer, from, end) {
+                let at = from + anchorStart;
+
+                while (true) {
+                    at = nextAnchor(buffer, at);
+                    if (at < 0 || at - anchorStart + length > end) {
+                        return -1;
+                    }
+                    if (exact || verify(buffer, at - anchorStart)) {
+                        return at - anchorStart;
+                    }
+                    at++;
+                }
+            }
+        };
+    }
+
+    // Masked Horspool: a byte shifts by the distance to the last position it can match
+    const shift = new Uint16Array(256).fill(length);
+    for (let i = 0; i < length - 1; i++) {
+        for (let c = 0; c < 256; c++) {
+            if ((c & mask[i]) === bytes[i]) {
+                shift[c] = length - 1 - i;
+            }
+        }
+    }
+
+    return {
+        length,
+        find(buffer, from, end) {
+            for (let at = from; at + length <= end; at += shift[buffer[at + length - 1]]) {
+                if (verify(buffer, at)) {
+                    return at;
+                }
+            }
+            return -1;
+        }
+    };
+}
+
+/**
+ * Payload arena, all captured payloads packed into large chunks
+ */
+class PayloadArena {
+    /**
+     * @param {number} chunkSize Bytes per chunk
+     */
+    constructor(chunkSize = CHUNK_SIZE) {
+        this.chunkSize = chunkSize;
+        this.clear();
+    }
+
+    /**
+     * Drop all payloads
+     */
+    clear() {
+        this.chunks = [];
+        this.bytes = 0;
+        this.packets = 0;
+    }
+
+    /**
+     * Add one payload
+     * @param {number} row Packet number in the capture
+     * @param {Uint8Array} data Payload bytes
+     */
+    append(row, data) {
+        let chunk = this.chunks[this.chunks.length - 1];
+
+        if (!chunk || chunk.used + data.length > chunk.buffer.length) {
+            chunk = {
+                buffer: Buffer.allocUnsafe(Math.max(this.chunkSize, data.length)),
+                used: 0,
+                count: 0,
+                starts: new Uint32Array(1024),
+                rows: new Int32Array(1024)
+            };
+            this.chunks.push(chunk);
+        }
+
+        if (chunk.count === chunk.starts.length) {
+            const starts = new Uint32Array(chunk.count * 2);
+            const rows = new Int32Array(chunk.count * 2);
+            starts.set(chunk.starts);
+            rows.set(chunk.rows);
+            chunk.starts = starts;
+            chunk.rows = rows;
+        }
+
+        chunk.buffer.set(data, chunk.used);
+        chunk.starts[chunk.count] = chunk.used;
+        chunk.rows[chunk.count] = row;
+        chunk.count++;
+        chunk.used += data.length;
+        this.bytes += data.length;
+        this.packets++;
+    }
+
+    /**
+     * Search every payload, one chunk per step
+     * @param {Object} pattern Result of parsePattern()
+     * @yields {Array} Matches in the chunk as { row, offset }, offset within the payload
+     */
+    *search(pattern) {
+        const matcher = compilePattern(pattern);
+
+        for (const chunk of this.chunks) {
+            const { starts, rows, count, used } = chunk;
+            // indexOf() must not scan the unfilled end of the chunk
+            const buffer = chunk.buffer.subarray(0, used);
+            const matches = [];
+            let packet = 0;
+            let at = 0;
+
+            while ((at = matcher.find(buffer, at, used)) >= 0) {
+                // Matches come in order, so the owning packet only moves forward
+                while (packet + 1 < count && starts[packet + 1] <= at) {
+                    packet++;
+                }
+
+                const end = packet + 1 < count ? starts[packet + 1] : used;
+                if (at + matcher.length <= end) {
+                    matches.push({ row: rows[packet], offset: at - starts[packet] });
+                    at++;
+                } else {
+                    // Straddles a packet boundary, resume in the next packet
+                    at = end;
+                }
+            }
+
+            yield matches;
+        }
+    }
+}
+
+module.exports = {
+    CHUNK_SIZE,
+    MAX_PATTERN_LENGTH,
+    parsePattern,
+    compilePattern,
+    PayloadArena
+};
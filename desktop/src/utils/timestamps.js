@@ -0,0 +1,42 @@
+/**
+ * USBShark - Military-grade USB protocol analyzer
+ * Timestamps - Device clock conversion and elapsed time
+ *
+ * The device stamps frames with Timer1 at F_CPU/64, one tick every 4 us, in
+ * a 32-bit counter that wraps (COMM_TIMESTAMP_TICK_US in comm_protocol.h).
+ * main.js converts ticks to microseconds as frames arrive, so every
+ * timestamp past that point is in microseconds and wraps at
+ * TIMESTAMP_WRAP_US.
+ */
+
+/* Microseconds per device timestamp tick */
+const TICK_US = 4;
+
+/* Period of the device clock in microseconds, about 4.8 hours */
+const TIMESTAMP_WRAP_US = 0x100000000 * TICK_US;
+
+/**
+ * Convert a device timestamp to microseconds
+ * @param {number} ticks 32-bit device timestamp
+ * @returns {number} Microseconds
+ */
+function ticksToUs(ticks) {
+    return (ticks >>> 0) * TICK_US;
+}
+
+/**
+ * Time between two timestamps, across one wrap of the device clock
+ * @param {number} start Earlier timestamp in microseconds
+ * @param {number} end Later timestamp in microseconds
+ * @returns {number} Elapsed microseconds
+ */
+function elapsedUs(start, end) {
+    return (end - start + TIMESTAMP_WRAP_US) % TIMESTAMP_WRAP_US;
+}
+
+module.exports = {
+    TICK_US,
+    TIMESTAMP_WRAP_US,
+    ticksToUs,
+    elapsedUs
+};
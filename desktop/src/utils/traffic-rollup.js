@@ -0,0 +1,241 @@
+/**
+ * USBShark - Military-grade USB protocol analyzer
+ * Traffic Rollup - Multi-resolution time buckets for traffic charts
+ *
+ * Every packet is added once to a 1 ms, a 10 ms and a 1 s bucket, both for
+ * the whole bus and for its address/endpoint. Buckets are stored sparsely as
+ * columns in time order, so quiet periods cost nothing and a chart reads the
+ * finest level that fits its point budget with two binary searches.
+ */
+
+const { PID, getDataLength } = require('./usb-decoder');
+const { TIMESTAMP_WRAP_US } = require('./timestamps');
+
+/* Bucket widths in microseconds, finest first */
+const BUCKET_WIDTHS_US = [1000, 10000, 1000000];
+
+/* Default point budget of one query */
+const MAX_POINTS = 2000;
+
+/* Series key of the whole bus */
+const TOTAL = 'all';
+
+/**
+ * Sparse buckets of one series at one width, in time order
+ */
+class BucketColumn {
+    constructor() {
+        this.length = 0;
+        this.resize(256);
+    }
+
+    /**
+     * Grow every column to a new capacity
+     * @param {number} capacity Buckets
+     */
+    resize(capacity) {
+        const grow = (Type, old) => {
+            const column = new Type(capacity);
+            if (old) {
+                column.set(old.subarray(0, this.length));
+            }
+            return column;
+        };
+
+        this.bucket = grow(Float64Array, this.bucket);
+        this.bytes = grow(Float64Array, this.bytes);
+        this.packets = grow(Uint32Array, this.packets);
+        this.naks = grow(Uint32Array, this.naks);
+        this.errors = grow(Uint32Array, this.errors);
+    }
+
+    /**
+     * First position whose bucket is not below a bucket number
+     * @param {number} bucket Bucket number
+     * @returns {number} Position in the columns
+     */
+    lowerBound(bucket) {
+        let low = 0;
+        let high = this.length;
+
+        while (low < high) {
+            const middle = (low + high) >>> 1;
+            if (this.bucket[middle] < bucket) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        return low;
+    }
+
+    /**
+     * Count one packet into its bucket
+     * @param {number} bucket Bucket number
+     * @param {number} bytes Payload bytes
+     * @param {number} nak 1 for a NAK handshake
+     * @param {number} error 1 for a CRC error or STALL
+     */
+    add(bucket, bytes, nak, error) {
+        let at = this.length - 1;
+
+        // Packets arrive in time order, only a wrapped or reset clock goes back
+        if (at < 0 || this.bucket[at] !== bucket) {
+            at = (at < 0 || this.bucket[at] < bucket) ? this.length : this.lowerBound(bucket);
+
+            if (at === this.length || this.bucket[at] !== bucket) {
+                if (this.length === this.bucket.length) {
+                    this.resize(this.length * 2);
+                }
+                for (const column of [this.bucket, this.bytes, this.packets, this.naks, this.errors]) {
+                    column.copyWithin(at + 1, at, this.length);
+                    column[at] = 0;
+                }
+                this.bucket[at] = bucket;
+                this.length++;
+            }
+        }
+
+        this.bytes[at] += bytes;
+        this.packets[at]++;
+        this.naks[at] += nak;
+        this.errors[at] += error;
+    }
+}
+
+/**
+ * Incremental traffic rollup over a capture
+ */
+class TrafficRollup {
+    constructor() {
+        this.clear();
+    }
+
+    /**
+     * Drop all buckets
+     */
+    clear() {
+        this.series = new Map();
+        this.epoch = 0;
+        this.lastTimestamp = null;
+        this.first = null;
+        this.last = null;
+    }
+
+    /**
+     * Get the buckets of a series, creating them on first use
+     * @param {string} key Series key
+     * @returns {Array<BucketColumn>} One column per bucket width
+     */
+    levels(key) {
+        let levels = this.series.get(key);
+
+        if (!levels) {
+            levels = BUCKET_WIDTHS_US.map(() => new BucketColumn());
+            this.series.set(key, levels);
+        }
+        return levels;
+    }
+
+    /**
+     * Count one captured packet
+     * @param {Object} packet Packet with timestamp in microseconds, pid, devAddr, endpoint, crcValid and data
+     */
+    add(packet) {
+        // Unwrap the 32-bit device clock so buckets keep increasing
+        if (this.lastTimestamp !== null && packet.timestamp < this.lastTimestamp - TIMESTAMP_WRAP_US / 2) {
+            this.epoch += TIMESTAMP_WRAP_US;
+        }
+        this.lastTimestamp = packet.timestamp;
+
+        const time = this.epoch + packet.timestamp;
+        // Bus throughput, bytes cut by the snap length included
+        const bytes = getDataLength(packet);
+        const nak = packet.pid === PID.NAK ? 1 : 0;
+        const error = (!packet.crcValid || packet.pid === PID.STALL) ? 1 : 0;
+        const keys = [TOTAL, `${packet.devAddr}.${packet.endpoint}`];
+
+        if (this.first === null || time < this.first) {
+            this.first = time;
+        }
+        if (this.last === null || time > this.last) {
+            this.last = time;
+        }
+
+        for (const key of keys) {
+            this.levels(key).forEach((column, level) => {
+                column.add(Math.floor(time / BUCKET_WIDTHS_US[level]), bytes, nak, error);
+            });
+        }
+    }
+
+    /**
+     * List the series seen so far
+     * @returns {Array<string>} TOTAL followed by 'addr.ep' keys
+     */
+    keys() {
+        return Array.from(this.series.keys());
+    }
+
+    /**
+     * Read the buckets of a series over a time range
+     *
+     * Uses the finest width that fits the point budget. Ranges wider than the
+     * coarsest width allows are merged on the fly, so the result never has
+     * more than maxPoints points.
+     *
+     * @param {string} key Series key
+     * @param {number} from Start time in microseconds
+     * @param {number} to End time in microseconds
+     * @param {number} maxPoints Point budget
+     * @returns {Object} { width, time, bytes, packets, naks, errors }, time is the bucket start
+     */
+    query(key, from, to, maxPoints = MAX_POINTS) {
+        const span = Math.max(to - from, 1);
+        let level = BUCKET_WIDTHS_US.findIndex((width) => span / width < maxPoints);
+        if (level < 0) {
+            level = BUCKET_WIDTHS_US.length - 1;
+        }
+
+        const levelWidth = BUCKET_WIDTHS_US[level];
+        const merge = Math.max(1, Math.ceil((span / levelWidth + 1) / maxPoints));
+        const width = levelWidth * merge;
+        const result = { width, time: [], bytes: [], packets: [], naks: [], errors: [] };
+        const levels = this.series.get(key);
+
+        if (!levels) {
+            return result;
+        }
+
+        const column = levels[level];
+        const end = column.lowerBound(Math.floor(to / levelWidth) + 1);
+
+        for (let i = column.lowerBound(Math.floor(from / levelWidth)); i < end; i++) {
+            const time = Math.floor(column.bucket[i] / merge) * width;
+            const last = result.time.length - 1;
+
+            if (last < 0 || result.time[last] !== time) {
+                result.time.push(time);
+                result.bytes.push(0);
+                result.packets.push(0);
+                result.naks.push(0);
+                result.errors.push(0);
+            }
+
+            const at = result.time.length - 1;
+            result.bytes[at] += column.bytes[i];
+            result.packets[at] += column.packets[i];
+            result.naks[at] += column.naks[i];
+            result.errors[at] += column.errors[i];
+        }
+
+        return result;
+    }
+}
+
+module.exports = {
+    BUCKET_WIDTHS_US,
+    MAX_POINTS,
+    TOTAL,
+    TrafficRollup
+};
@@ -140,6 +140,10 @@ class TransactionAnalyzer {
             if (packet.data && packet.data.length >= 2) {
                 deviceAddress = packet.data[0] & 0x7F;
                 endpoint = ((packet.data[1] & 0x7) << 1) | ((packet.data[0] & 0x80) >> 7);
+            } else if (packet.devAddr !== undefined || packet.deviceAddress !== undefined) {
+                // Device frames carry the decoded token fields instead of its bytes
+                deviceAddress = packet.devAddr !== undefined ? packet.devAddr : packet.deviceAddress;
+                endpoint = packet.endpoint;
             }
             
             // Create transaction based on token type
@@ -80,6 +80,31 @@ const DESCRIPTOR_TYPES = {
     HUB: 0x29
 };
 
+/**
+ * USB Class Codes (bDeviceClass, bInterfaceClass)
+ */
+const CLASS_CODES = {
+    AUDIO: 0x01,
+    CDC: 0x02,
+    HID: 0x03,
+    PHYSICAL: 0x05,
+    IMAGE: 0x06,
+    PRINTER: 0x07,
+    MASS_STORAGE: 0x08,
+    HUB: 0x09,
+    CDC_DATA: 0x0A,
+    SMART_CARD: 0x0B,
+    CONTENT_SECURITY: 0x0D,
+    VIDEO: 0x0E,
+    PERSONAL_HEALTHCARE: 0x0F,
+    AUDIO_VIDEO: 0x10,
+    DIAGNOSTIC: 0xDC,
+    WIRELESS: 0xE0,
+    MISCELLANEOUS: 0xEF,
+    APPLICATION_SPECIFIC: 0xFE,
+    VENDOR_SPECIFIC: 0xFF
+};
+
 /**
  * Request Type bit masks
  */
@@ -132,6 +157,20 @@ function getPacketType(pid) {
     return 'Unknown';
 }
 
+/**
+ * Get the name of a class code
+ * @param {number} code bDeviceClass or bInterfaceClass value
+ * @returns {string} The class name or 'Unknown'
+ */
+function getClassName(code) {
+    for (const [name, value] of Object.entries(CLASS_CODES)) {
+        if (value === code) {
+            return name;
+        }
+    }
+    return 'Unknown';
+}
+
 /**
  * Decode a USB setup packet
  * @param {Uint8Array} data The setup packet data (8 bytes)
@@ -266,8 +305,7 @@ function decodeSetupPacket(data) {
         
         // Handle common class requests (e.g., HID, CDC, etc.)
         if ((bmRequestType & REQUEST_TYPE.RECIPIENT_MASK) === REQUEST_TYPE.INTERFACE) {
-            // Try to determine interface class based on bInterfaceClass
-            // This would require maintaining interface class information
+            // Class names need the interface class, see ClassDecoderRegistry
             requestDetails = `Interface ${wIndex}, Value: 0x${wValue.toString(16).padStart(4, '0')}`;
         }
     } else if ((bmRequestType & REQUEST_TYPE.TYPE_MASK) === REQUEST_TYPE.VENDOR) {
@@ -410,17 +448,32 @@ function parseSOFFrameNumber(data) {
     };
 }
 
+/**
+ * Get the number of data bytes a captured packet had on the bus
+ * @param {Object} packet Captured packet
+ * @returns {number} Data bytes, those cut by the snap length included
+ */
+function getDataLength(packet) {
+    if (packet.truncated) {
+        return packet.originalLength;
+    }
+    return packet.data ? packet.data.length : 0;
+}
+
 module.exports = {
     PID,
     PID_TYPES,
     REQUEST_CODES,
     DESCRIPTOR_TYPES,
+    CLASS_CODES,
     REQUEST_TYPE,
     getPidName,
     getPacketType,
+    getClassName,
     decodeSetupPacket,
     formatHexDump,
     parseDeviceAddressAndEndpoint,
     getRequestTypeName,
-    parseSOFFrameNumber
+    parseSOFFrameNumber,
+    getDataLength
 }; 
\ No newline at end of file
@@ -0,0 +1,113 @@
+/**
+ * USBShark - Military-grade USB protocol analyzer
+ * Search Worker - Owns the payload arena and runs searches off the UI thread
+ *
+ * Messages in:
+ *   { type: 'append', rows, lengths, bytes }  payloads packed into one buffer
+ *   { type: 'clear' }
+ *   { type: 'search', id, pattern, limit }
+ *   { type: 'cancel', id }
+ *
+ * Messages out, every search ends with 'done' or 'error':
+ *   { type: 'matches', id, matches }          one batch per arena chunk
+ *   { type: 'done', id, count, bytes, ms, truncated }
+ *   { type: 'error', id, message }
+ */
+
+const { parsePattern, PayloadArena } = require('../utils/payload-search');
+
+/* Matches reported before a search stops */
+const DEFAULT_MATCH_LIMIT = 100000;
+
+const arena = new PayloadArena();
+
+// Id of the search in progress, cancelling clears it
+let activeSearch = null;
+
+/**
+ * Run one search, yielding between chunks so cancel and append get through
+ * @param {number} id Search id chosen by the renderer
+ * @param {string} source Pattern text
+ * @param {number} limit Maximum matches to report
+ */
+async function runSearch(id, source, limit) {
+    let pattern;
+
+    try {
+        pattern = parsePattern(source);
+    } catch (error) {
+        postMessage({ type: 'error', id, message: error.message });
+        return;
+    }
+
+    activeSearch = id;
+    const started = performance.now();
+    let count = 0;
+    let truncated = false;
+
+    for (let matches of arena.search(pattern)) {
+        if (activeSearch !== id) {
+            return;
+        }
+
+        if (count + matches.length > limit) {
+            matches = matches.slice(0, limit - count);
+            truncated = true;
+        }
+
+        if (matches.length > 0) {
+            count += matches.length;
+            postMessage({ type: 'matches', id, matches });
+        }
+
+        if (truncated) {
+            break;
+        }
+
+        await new Promise((resolve) => setTimeout(resolve, 0));
+    }
+
+    if (activeSearch === id) {
+        activeSearch = null;
+        postMessage({
+            type: 'done',
+            id,
+            count,
+            bytes: arena.bytes,
+            ms: Math.round(performance.now() - started),
+            truncated
+        });
+    }
+}
+
+onmessage = (event) => {
+    const message = event.data;
+
+    switch (message.type) {
+        case 'append': {
+            const bytes = new Uint8Array(message.bytes);
+            let offset = 0;
+
+            for (let i = 0; i < message.rows.length; i++) {
+                arena.append(message.rows[i], bytes.subarray(offset, offset + message.lengths[i]));
+                offset += message.lengths[i];
+            }
+            break;
+        }
+
+        case 'clear':
+            activeSearch = null;
+            arena.clear();
+            break;
+
+        case 'search':
+            runSearch(message.id, message.pattern, message.limit || DEFAULT_MATCH_LIMIT);
+            break;
+
+        case 'cancel':
+            if (activeSearch === message.id) {
+                activeSearch = null;
+            }
+            break;
+    }
+};
@@ -9,13 +9,72 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+/* Frame format, the same in both directions (desktop/src/utils/comm-protocol.js
+ * implements the host end):
+ *
+ *   SYNC | type | length | sequence | data[length] | CRC high | CRC low
+ *
+ * The CRC is CRC-16/CCITT (init 0xFFFF) over type, length, sequence and data.
+ * Every byte after SYNC that equals SYNC or ESCAPE is sent as ESCAPE followed
+ * by the byte XOR COMM_ESCAPE_XOR (0xAA -> 55 8A, 0x55 -> 55 75). Neither
+ * escaped form is a framing byte, so an unescaped SYNC only ever starts a
+ * frame: a receiver that sees SYNC mid-frame abandons the partial frame and
+ * starts over, and ESCAPE followed by anything but 0x8A or 0x75 drops the
+ * frame. Resynchronizing never needs to look back. */
+
 /* Protocol constants */
 #define COMM_SYNC_BYTE       0xAA
 #define COMM_ESCAPE_BYTE     0x55
+#define COMM_ESCAPE_XOR      0x20
 #define COMM_MAX_PACKET_SIZE 255
 #define COMM_HEADER_SIZE     4
 #define COMM_FOOTER_SIZE     2
 
+/* Host commands - the device queues up to COMM_CMD_QUEUE_DEPTH received
+ * commands, so the host may have that many unacknowledged commands in
+ * flight. A command arriving with the queue full is dropped unanswered and
+ * the host retransmits it after its timeout. A command with the sequence
+ * number and CRC of one of the last COMM_CMD_HISTORY_DEPTH handled is such
+ * a retransmission: its reply is sent again but it is not run twice.
+ * PACKET_TYPE_CMD_RESET starts a host session and clears that history;
+ * it and PACKET_TYPE_CMD_GET_STATUS are safe to repeat and always run.
+ * Command payloads are limited to COMM_MAX_COMMAND_SIZE bytes, longer ones
+ * are NACKed. */
+#define COMM_CMD_QUEUE_DEPTH    4   // Power of 2
+#define COMM_CMD_HISTORY_DEPTH  8   // Twice the queue, for late copies of a retransmission
+#define COMM_MAX_COMMAND_SIZE   32
+#define COMM_COMMAND_TX_RESERVE 40  // Escaped status report plus ACK/NACK frames
+
+/* Host link speed - the host always connects at the boot rate (BAUD in the
+ * Makefile) and may then negotiate another rate via PACKET_TYPE_CMD_SET_CONFIG */
+#ifndef BAUD
+#define BAUD 1000000UL
+#endif
+#define COMM_BAUD_MAX_ERROR_PERMILLE 15  // Reject rates with more than 1.5% divisor error
+#define COMM_LINK_FALLBACK_ERRORS    16  // Consecutive framing errors before reverting to the boot rate
+
+/* USB packet frame layout (PACKET_TYPE_USB_PACKET payload):
+ * timestamp (4, big endian), PID, device address, endpoint, flags,
+ * [original data length (2, big endian) if truncated], data
+ * Timestamps in every frame count Timer1 ticks at F_CPU/64 and wrap. */
+#define COMM_TIMESTAMP_TICK_US    4     // Microseconds per timestamp tick at 16 MHz
+#define COMM_USB_HEADER_SIZE      8
+#define COMM_USB_FLAG_CRC_VALID   0x80  // USB CRC of the captured packet was valid
+#define COMM_USB_FLAG_COMPRESSED  0x40  // Data is run-length encoded (see comm_compress_data)
+#define COMM_USB_FLAG_REPEAT      0x20  // Data identical to the previous data on this address/endpoint, omitted
+#define COMM_USB_FLAG_TRUNCATED   0x10  // Data cut to the endpoint snap length, original length follows header
+#define COMM_USB_FLAG_GAP         0x08  // Packets were lost on the device before this one
+#define COMM_REPEAT_SLOT_SIZE     64    // Largest payload remembered for repeat detection
+
+/* Monitor configuration (PACKET_TYPE_CMD_START_CAPTURE/CMD_SET_FILTER payload),
+ * one byte per field of usb_monitor_config_t: speed, capture control, bulk,
+ * interrupt, isochronous, address filter, endpoint filter, IN only, OUT only */
+#define COMM_MONITOR_CONFIG_SIZE  9
+
+/* PACKET_TYPE_FILTER_CHANGE payload: timestamp of the first packet checked
+ * against the new filter, then the filter in the layout above */
+#define COMM_FILTER_CHANGE_SIZE   (4 + COMM_MONITOR_CONFIG_SIZE)
+
 /* Packet types */
 typedef enum {
     /* Control messages (host to device) */
@@ -36,6 +95,9 @@ typedef enum {
     PACKET_TYPE_DEV_DESCRIPTOR    = 0x85,
     PACKET_TYPE_CONFIG_DESCRIPTOR = 0x86,
     PACKET_TYPE_STRING_DESCRIPTOR = 0x87,
+    PACKET_TYPE_TRIGGER           = 0x88,
+    PACKET_TYPE_PROFILE           = 0x89,  // Section cycle counts, PROFILE=1 builds only
+    PACKET_TYPE_FILTER_CHANGE     = 0x8A,  // Timestamp (4, big endian), monitor configuration
     
     /* Acknowledgments */
     PACKET_TYPE_ACK               = 0xF0,
@@ -51,36 +113,60 @@ typedef enum {
     ERR_INVALID_STATE   = 0x04,
     ERR_USB_ERROR       = 0x05,
     ERR_TIMEOUT         = 0x06,
+    ERR_UNSUPPORTED     = 0x07,
     ERR_INTERNAL        = 0xFF
 } error_code_t;
 
-/* Packet structure */
+/* Configuration keys (first byte of a PACKET_TYPE_CMD_SET_CONFIG payload) */
+typedef enum {
+    CONFIG_KEY_LINK_BAUD   = 0x01,  // uint32_t big endian, applied after the ACK has been sent
+    CONFIG_KEY_COMPRESSION = 0x02,  // uint8_t, 0 = off, 1 = RLE and repeat suppression
+    CONFIG_KEY_SNAPLEN     = 0x03,  // uint8_t endpoint (0xFF = all), uint8_t bytes (0xFF = no limit)
+    CONFIG_KEY_TRIGGER     = 0x04   // uint8_t condition, arg0, arg1, uint16_t post count big endian
+} config_key_t;
+
+/* Received command packet */
 typedef struct {
     uint8_t sync;         // Always COMM_SYNC_BYTE
     uint8_t type;         // packet_type_t value
     uint8_t length;       // Length of data field
     uint8_t sequence;     // Packet sequence number
-    uint8_t data[COMM_MAX_PACKET_SIZE];  // Packet payload
+    uint8_t data[COMM_MAX_COMMAND_SIZE];  // Packet payload
     uint16_t crc;         // CRC-16 of type, length, sequence and data
 } comm_packet_t;
 
 /* Protocol functions */
 void comm_init(void);
 bool comm_send_packet(packet_type_t type, const uint8_t *data, uint8_t length);
-bool comm_receive_packet(comm_packet_t *packet);
+uint8_t comm_tx_free(void);
+const comm_packet_t *comm_receive_packet(void);
+void comm_release_packet(void);
 bool comm_process_command(const comm_packet_t *packet);
+bool comm_handle_config(const comm_packet_t *packet);
 void comm_send_ack(uint8_t sequence);
 void comm_send_nack(uint8_t sequence, error_code_t error);
 uint16_t comm_calculate_crc(const uint8_t *data, uint16_t length);
 uint16_t comm_calculate_crc_continue(const uint8_t *data, uint16_t length, uint16_t crc);
 
+/* Link speed functions */
+bool comm_link_baud_supported(uint32_t baud);
+bool comm_set_link_baud(uint8_t sequence, uint32_t baud);
+uint32_t comm_get_link_baud(void);
+
+/* Payload compression functions */
+void comm_set_compression(bool enabled);
+bool comm_compression_enabled(void);
+uint8_t comm_compress_data(uint8_t *dest, uint8_t limit, const uint8_t *src, uint8_t length);
+
 /* Utility functions */
 void comm_escape_data(uint8_t *dest, const uint8_t *src, uint8_t length, uint8_t *escaped_length);
 bool comm_unescape_data(uint8_t *dest, const uint8_t *src, uint8_t length, uint8_t *unescaped_length);
 
 /* High-level communication functions */
-bool comm_send_usb_packet(const uint8_t *data, uint8_t length, uint32_t timestamp, uint8_t pid);
-void comm_send_status_report(uint8_t device_count, uint8_t capture_state, uint16_t buffer_usage);
+bool comm_send_usb_packet(const uint8_t *data, uint8_t length, uint16_t orig_length, uint32_t timestamp,
+                          uint8_t pid, uint8_t dev_addr, uint8_t endpoint, uint8_t flags);
+void comm_send_status_report(uint8_t device_count, uint8_t capture_state, uint16_t buffer_usage,
+                             uint16_t loop_latency_us);
 void comm_send_error(error_code_t error_code, uint8_t context);
 
 #endif /* COMM_PROTOCOL_H */ 
\ No newline at end of file
@@ -0,0 +1,41 @@
+/**
+ * USBShark - Military-grade USB protocol analyzer
+ * CRC Header - Flash-resident CRC engines for host frames and USB packets
+ */
+
+#ifndef CRC_H
+#define CRC_H
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+/* CRC-16/CCITT (poly 0x1021, no reflection) used by host link frames */
+#define CRC_CCITT_INIT 0xFFFF
+
+/* Flash tables, see crc.c */
+extern const uint16_t crc_ccitt_table[256] PROGMEM;
+extern const uint16_t crc_ccitt_nibble[16] PROGMEM;
+
+/**
+ * Add one byte to a CRC-16/CCITT with the engine selected at build time,
+ * for framing code that handles each byte once
+ * @param crc CRC so far, CRC_CCITT_INIT to start
+ * @param data Next byte
+ * @return Updated CRC
+ */
+static inline uint16_t crc_ccitt_byte(uint16_t crc, uint8_t data) {
+#ifdef CRC_NIBBLE_TABLE
+    crc = (crc << 4) ^ pgm_read_word(&crc_ccitt_nibble[(crc >> 12) ^ (data >> 4)]);
+    return (crc << 4) ^ pgm_read_word(&crc_ccitt_nibble[(crc >> 12) ^ (data & 0x0F)]);
+#else
+    return (crc << 8) ^ pgm_read_word(&crc_ccitt_table[(crc >> 8) ^ data]);
+#endif
+}
+
+/* CRC Functions */
+uint16_t crc_ccitt_update(uint16_t crc, const uint8_t *data, uint16_t length);
+uint16_t crc_ccitt_update_table(uint16_t crc, const uint8_t *data, uint16_t length);
+uint16_t crc_ccitt_update_nibble(uint16_t crc, const uint8_t *data, uint16_t length);
+uint16_t crc_usb16(const uint8_t *data, uint16_t length);
+
+#endif /* CRC_H */
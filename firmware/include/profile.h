@@ -0,0 +1,52 @@
+/**
+ * USBShark - Military-grade USB protocol analyzer
+ * Profiling Header - Cycle counters for hot paths, compiled in with PROFILE=1
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Profiled sections, in PACKET_TYPE_PROFILE report order */
+typedef enum {
+    PROFILE_ISR_INT0 = 0,     // USB edge interrupt
+    PROFILE_ISR_UART_UDRE,    // UART transmit interrupt
+    PROFILE_PROCESS_RAW,      // process_raw_packet()
+    PROFILE_PROCESS_PACKET,   // usb_process_packet()
+    PROFILE_SEND_PACKET,      // comm_send_packet()
+    PROFILE_CRC_TABLE,        // PROFILE_CRC_BENCH_SIZE bytes through crc_ccitt_update_table()
+    PROFILE_CRC_NIBBLE,       // PROFILE_CRC_BENCH_SIZE bytes through crc_ccitt_update_nibble()
+    PROFILE_SECTION_COUNT
+} profile_section_t;
+
+/* PACKET_TYPE_PROFILE payload per section: id, count, min, avg, max
+ * (2 bytes each, big endian, cycles saturated at 65535) */
+#define PROFILE_ENTRY_SIZE 9
+
+/* Bytes per CRC benchmark run, one run of each engine per report */
+#define PROFILE_CRC_BENCH_SIZE 64
+
+#ifdef USBSHARK_PROFILE
+
+/* Profiling Functions */
+void profile_init(void);
+uint32_t profile_cycles(void);
+void profile_record(profile_section_t section, uint32_t start);
+bool profile_send_report(void);
+
+/* Bracket a section with a single exit, nesting is allowed */
+#define PROFILE_BEGIN(section) uint32_t profile_start_##section = profile_cycles()
+#define PROFILE_END(section)   profile_record(section, profile_start_##section)
+
+#else
+
+#define profile_init()          ((void)0)
+#define profile_send_report()   (true)
+#define PROFILE_BEGIN(section)  ((void)0)
+#define PROFILE_END(section)    ((void)0)
+
+#endif /* USBSHARK_PROFILE */
+
+#endif /* PROFILE_H */
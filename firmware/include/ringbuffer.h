@@ -124,6 +124,54 @@ static inline bool ringbuffer_peek(const ringbuffer_t *rb, uint8_t offset, uint8
     return true;
 }
 
+/**
+ * Discard bytes from buffer without reading them (from main/consumer)
+ * @param rb Pointer to ringbuffer struct
+ * @param len Number of bytes to discard
+ * @return Number of bytes actually discarded
+ */
+static inline uint8_t ringbuffer_skip(ringbuffer_t *rb, uint8_t len) {
+    uint8_t count = ringbuffer_count(rb);
+    
+    if (len > count) {
+        len = count;
+    }
+    
+    rb->read_index = (rb->read_index + len) & RINGBUF_MASK;
+    return len;
+}
+
+/**
+ * Stage a byte past the published data (from producer)
+ * Staged bytes stay invisible to the consumer until ringbuffer_commit(),
+ * so a record that does not fit can be abandoned without a trace
+ * @param rb Pointer to ringbuffer struct
+ * @param cursor Staging position, start from rb->write_index, updated
+ * @param data Byte to add
+ * @return true if successful, false if buffer full
+ */
+static inline bool ringbuffer_stage(ringbuffer_t *rb, uint8_t *cursor, uint8_t data) {
+    uint8_t next_write = (*cursor + 1) & RINGBUF_MASK;
+    
+    if (next_write == rb->read_index) {
+        return false;
+    }
+    
+    rb->buffer[*cursor] = data;
+    *cursor = next_write;
+    
+    return true;
+}
+
+/**
+ * Publish all staged bytes to the consumer (from producer)
+ * @param rb Pointer to ringbuffer struct
+ * @param cursor Staging position reached by ringbuffer_stage()
+ */
+static inline void ringbuffer_commit(ringbuffer_t *rb, uint8_t cursor) {
+    rb->write_index = cursor;
+}
+
 /**
  * Reset buffer to empty state
  * @param rb Pointer to ringbuffer struct
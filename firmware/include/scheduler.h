@@ -0,0 +1,39 @@
+/**
+ * USBShark - Military-grade USB protocol analyzer
+ * Scheduler Header - Cooperative main-loop scheduler with prioritized tasks
+ */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Maximum number of registered tasks */
+#define SCHED_MAX_TASKS 8
+
+/* Timer1 runs at F_CPU/64, the timebase of usb_get_timestamp() */
+#define SCHED_TICKS_PER_MS (F_CPU / 64000UL)
+
+/* Task priorities, lower values run first */
+typedef enum {
+    SCHED_PRIO_CAPTURE      = 0,  // Drain the capture ring
+    SCHED_PRIO_TX           = 1,  // Feed deferred frames to the UART
+    SCHED_PRIO_COMMAND      = 2,  // Poll host commands
+    SCHED_PRIO_HOUSEKEEPING = 3   // Bus state, LEDs, periodic status
+} sched_priority_t;
+
+/**
+ * Task function
+ * @return true if work remains, so the task gets another turn before
+ *         lower-priority tasks run
+ */
+typedef bool (*sched_task_fn_t)(void);
+
+/* Scheduler Functions */
+void scheduler_init(void);
+bool scheduler_add_task(sched_task_fn_t fn, sched_priority_t priority, uint16_t period_ms);
+void scheduler_run_once(void);
+uint16_t scheduler_get_max_latency(bool reset);
+
+#endif /* SCHEDULER_H */
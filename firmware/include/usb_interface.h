@@ -32,6 +32,11 @@ typedef enum {
     USB_PID_RESERVED = 0xF0
 } usb_pid_t;
 
+/* Snap length settings */
+#define USB_ENDPOINT_COUNT  16    // Endpoint numbers 0-15
+#define USB_ENDPOINT_ALL    0xFF  // usb_set_snaplen() wildcard
+#define USB_SNAPLEN_NONE    0xFF  // Send the full data stage
+
 /* USB Speed */
 typedef enum {
     USB_SPEED_LOW  = 0,
@@ -41,13 +46,14 @@ typedef enum {
 
 /* USB Packet Structure */
 typedef struct {
-    uint32_t timestamp;  // Microsecond timestamp
+    uint32_t timestamp;  // Timer1 ticks of 4 us
     usb_pid_t pid;       // Packet ID
     uint8_t endpoint;    // Endpoint number
     uint8_t dev_addr;    // Device address
     uint16_t data_len;   // Length of data
     uint8_t *data;       // Pointer to data buffer
     bool crc_valid;      // CRC validity flag
+    bool gap;            // Packets were dropped on the device before this one
 } usb_packet_t;
 
 /* USB Device State */
@@ -61,6 +67,21 @@ typedef enum {
     USB_STATE_SUSPENDED
 } usb_state_t;
 
+/* Bus events, values match the PACKET_TYPE_USB_STATE_CHANGE event byte */
+typedef enum {
+    USB_EVENT_DETACHED = 0,
+    USB_EVENT_ATTACHED = 1,
+    USB_EVENT_RESET    = 2
+} usb_event_type_t;
+
+/* Queued bus event (type and argument bytes in the event ring) */
+#define USB_EVENT_RECORD_SIZE 2
+
+typedef struct {
+    usb_event_type_t type;
+    uint8_t arg;         // usb_speed_t for USB_EVENT_ATTACHED
+} usb_event_t;
+
 /* USB Monitoring Configuration */
 typedef struct {
     usb_speed_t speed;
@@ -77,8 +98,10 @@ typedef struct {
 /* USB Detection and Monitoring Functions */
 void usb_init(void);
 bool usb_detect_bus_state(void);
+bool usb_get_event(usb_event_t *event);
 void usb_monitor_enable(const usb_monitor_config_t *config);
 void usb_monitor_disable(void);
+void usb_monitor_set_filter(const usb_monitor_config_t *config);
 uint8_t usb_get_device_count(void);
 
 /* USB Data Capture Functions */
@@ -86,6 +109,12 @@ bool usb_capture_packet(usb_packet_t *packet);
 void usb_process_packet(const usb_packet_t *packet);
 void usb_send_packet_to_host(const usb_packet_t *packet);
 
+/* Snap Length Functions (usb_snaplen.c) */
+void usb_snaplen_init(void);
+bool usb_set_snaplen(uint8_t endpoint, uint8_t snaplen);
+uint8_t usb_get_snaplen(uint8_t endpoint);
+uint8_t usb_snap_length(uint8_t pid, uint8_t endpoint, uint8_t length);
+
 /* Direct Hardware Interface Functions */
 void usb_dp_set_input(void);
 void usb_dp_set_output(void);
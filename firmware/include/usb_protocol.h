@@ -8,6 +8,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "usb_interface.h"
 
 /* USB Token packet bit definitions */
 #define USB_TOKEN_PID_MASK    0xF0
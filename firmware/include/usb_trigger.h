@@ -0,0 +1,67 @@
+/**
+ * USBShark - Military-grade USB protocol analyzer
+ * USB Trigger Header - Pre/post-trigger capture windows held in device RAM
+ */
+
+#ifndef USB_TRIGGER_H
+#define USB_TRIGGER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "usb_interface.h"
+
+/* Pre-trigger window size in bytes (records are 11 bytes plus data) */
+#ifndef USB_TRIGGER_BUFFER_SIZE
+#define USB_TRIGGER_BUFFER_SIZE 512
+#endif
+
+/* Data bytes kept per record, longer data stages are truncated. A record
+ * with every byte escaped must still fit the 128-byte UART TX ring */
+#define USB_TRIGGER_MAX_DATA 48
+
+/* Wildcard for USB_TRIGGER_SETUP arguments */
+#define USB_TRIGGER_ANY 0xFF
+
+/* Trigger conditions */
+typedef enum {
+    USB_TRIGGER_NONE      = 0x00,  // Trigger mode off, packets go straight to the host
+    USB_TRIGGER_PID       = 0x01,  // arg0 = PID (e.g. USB_PID_STALL)
+    USB_TRIGGER_SETUP     = 0x02,  // arg0 = bmRequestType, arg1 = bRequest
+    USB_TRIGGER_CRC_ERROR = 0x03   // Any packet with an invalid CRC
+} usb_trigger_condition_t;
+
+/* Trigger states */
+typedef enum {
+    USB_TRIGGER_STATE_OFF   = 0x00,  // Trigger mode off
+    USB_TRIGGER_STATE_ARMED = 0x01,  // Recording the pre-trigger window
+    USB_TRIGGER_STATE_FIRED = 0x02,  // Flushing the window and post-trigger packets
+    USB_TRIGGER_STATE_DONE  = 0x03   // Window delivered, discarding until re-armed
+} usb_trigger_state_t;
+
+/* Trigger configuration */
+typedef struct {
+    usb_trigger_condition_t condition;
+    uint8_t arg0;
+    uint8_t arg1;
+    uint16_t post_count;  // Packets recorded after the trigger packet
+} usb_trigger_config_t;
+
+/* Trigger status (PACKET_TYPE_TRIGGER payload, big endian on the wire) */
+typedef struct {
+    usb_trigger_state_t state;
+    uint32_t timestamp;   // Timestamp of the trigger packet
+    uint16_t pre_count;   // Packets in the pre-trigger window, trigger packet included
+    uint16_t post_count;  // Packets recorded after the trigger packet
+    uint16_t dropped;     // Post-trigger packets lost to a full buffer
+} usb_trigger_status_t;
+
+/* Trigger Functions */
+void usb_trigger_init(void);
+bool usb_trigger_configure(const usb_trigger_config_t *config);
+void usb_trigger_rearm(void);
+bool usb_trigger_active(void);
+bool usb_trigger_record(const usb_packet_t *packet, uint8_t length);
+void usb_trigger_task(void);
+void usb_trigger_get_status(usb_trigger_status_t *status);
+
+#endif /* USB_TRIGGER_H */
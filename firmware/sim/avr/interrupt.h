@@ -0,0 +1,18 @@
+/**
+ * USBShark - Military-grade USB protocol analyzer
+ * Simulator shim for <avr/interrupt.h>
+ */
+
+#ifndef SIM_AVR_INTERRUPT_H
+#define SIM_AVR_INTERRUPT_H
+
+#include "io.h"
+
+/* Global interrupt flag lives in the emulated SREG so save/restore works */
+#define sei() (SREG |= (1 << SREG_I))
+#define cli() (SREG &= (uint8_t)~(1 << SREG_I))
+
+/* Interrupt vectors become plain functions dispatched by sim_hw_poll() */
+#define ISR(vector, ...) void vector(void); void vector(void)
+
+#endif /* SIM_AVR_INTERRUPT_H */
@@ -0,0 +1,46 @@
+/**
+ * USBShark - Military-grade USB protocol analyzer
+ * Simulator shim for <avr/io.h> - emulated ATmega328P USART0 registers
+ */
+
+#ifndef SIM_AVR_IO_H
+#define SIM_AVR_IO_H
+
+#include <stdint.h>
+#include "../sim_hw.h"
+
+/* Status register (only the I flag is modelled) */
+#define SREG    sim_sreg
+#define SREG_I  7
+
+/* USART0 registers - UCSR0A and UDR0 are serviced on every access */
+#define UBRR0H  sim_ubrr0h
+#define UBRR0L  sim_ubrr0l
+#define UCSR0A  (*sim_uart_ucsr0a())
+#define UCSR0B  sim_ucsr0b
+#define UCSR0C  sim_ucsr0c
+#define UDR0    (*sim_uart_udr0())
+
+/* UCSR0A bits */
+#define RXC0    7
+#define TXC0    6
+#define UDRE0   5
+#define FE0     4
+#define DOR0    3
+#define UPE0    2
+#define U2X0    1
+#define MPCM0   0
+
+/* UCSR0B bits */
+#define RXCIE0  7
+#define TXCIE0  6
+#define UDRIE0  5
+#define RXEN0   4
+#define TXEN0   3
+#define UCSZ02  2
+
+/* UCSR0C bits */
+#define UCSZ01  2
+#define UCSZ00  1
+
+#endif /* SIM_AVR_IO_H */
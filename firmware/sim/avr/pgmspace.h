@@ -0,0 +1,15 @@
+/**
+ * USBShark - Military-grade USB protocol analyzer
+ * Simulator shim for <avr/pgmspace.h> - flash and RAM share one address space
+ */
+
+#ifndef SIM_AVR_PGMSPACE_H
+#define SIM_AVR_PGMSPACE_H
+
+#include <stdint.h>
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+
+#endif /* SIM_AVR_PGMSPACE_H */
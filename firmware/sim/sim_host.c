@@ -0,0 +1,370 @@
+/**
+ * USBShark - Military-grade USB protocol analyzer
+ * Simulator Host Implementation
+ *
+ * Reads the slave side of the pty the way the desktop application would,
+ * decodes frames with the firmware's own CRC routine and keeps link
+ * statistics (frame rate, loss and capture-to-host latency).
+ */
+
+#include "sim_host.h"
+#include "sim_hw.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * Initialize host end
+ * @param host Host state
+ * @param fd Non-blocking pty slave descriptor
+ */
+void sim_host_init(sim_host_t *host, int fd) {
+    memset(host, 0, sizeof(*host));
+    host->fd = fd;
+    host->state = HOST_STATE_WAIT_SYNC;
+    host->stats.latency_min_us = UINT32_MAX;
+    host->last_ack = -1;
+    host->last_nack = -1;
+    host->epoch_ns = sim_now_ns();
+}
+
+/**
+ * Append a byte to an output frame with escaping
+ * @param frame Frame buffer
+ * @param len Current frame length, updated
+ * @param byte Byte to append
+ */
+static void host_put_escaped(uint8_t *frame, uint16_t *len, uint8_t byte) {
+    if (byte == COMM_SYNC_BYTE || byte == COMM_ESCAPE_BYTE) {
+        frame[(*len)++] = COMM_ESCAPE_BYTE;
+        frame[(*len)++] = byte ^ COMM_ESCAPE_XOR;
+    } else {
+        frame[(*len)++] = byte;
+    }
+}
+
+/**
+ * Send a command frame to the device
+ * @param host Host state
+ * @param type Packet type
+ * @param data Payload
+ * @param length Payload length
+ * @return true if the frame was written
+ */
+bool sim_host_send(sim_host_t *host, packet_type_t type, const uint8_t *data, uint8_t length) {
+    uint8_t frame[1 + 2 * (COMM_HEADER_SIZE - 1 + COMM_MAX_PACKET_SIZE + COMM_FOOTER_SIZE)];
+    uint16_t len = 0;
+    uint8_t header[3] = {type, length, host->tx_sequence++};
+    
+    uint16_t crc = comm_calculate_crc(header, 3);
+    crc = comm_calculate_crc_continue(data, length, crc);
+    
+    frame[len++] = COMM_SYNC_BYTE;
+    for (uint8_t i = 0; i < 3; i++) {
+        host_put_escaped(frame, &len, header[i]);
+    }
+    for (uint8_t i = 0; i < length; i++) {
+        host_put_escaped(frame, &len, data[i]);
+    }
+    host_put_escaped(frame, &len, (crc >> 8) & 0xFF);
+    host_put_escaped(frame, &len, crc & 0xFF);
+    
+    uint16_t written = 0;
+    while (written < len) {
+        ssize_t n = write(host->fd, &frame[written], len - written);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            return false;
+        }
+        written += (uint16_t)n;
+    }
+    
+    return true;
+}
+
+/**
+ * Get the length of run-length encoded data once expanded
+ * @param data Encoded data
+ * @param length Encoded length
+ * @return Expanded length, -1 if malformed
+ */
+static int host_rle_length(const uint8_t *data, uint8_t length) {
+    int expanded = 0;
+    uint8_t i = 0;
+    
+    while (i < length) {
+        uint8_t control = data[i++];
+        
+        if (control < 0x80) {
+            if (i + control + 1 > length) {
+                return -1;
+            }
+            expanded += control + 1;
+            i += control + 1;
+        } else if (control < 0xFF && i < length) {
+            expanded += control - 0x80 + 3;
+            i++;
+        } else {
+            return -1;
+        }
+    }
+    
+    return expanded;
+}
+
+/**
+ * Account for the data of a USB packet frame, undoing compression
+ * @param host Host state
+ * @param length Frame payload length
+ */
+static void host_usb_data(sim_host_t *host, uint8_t length) {
+    if (length < COMM_USB_HEADER_SIZE) {
+        return;
+    }
+    
+    uint8_t addr = host->data[5];
+    uint8_t endpoint = host->data[6];
+    uint8_t flags = host->data[7];
+    uint8_t header_length = COMM_USB_HEADER_SIZE;
+    
+    if (flags & COMM_USB_FLAG_TRUNCATED) {
+        host->stats.truncated_data++;
+        header_length += 2;
+        
+        if (length < header_length) {
+            host->stats.decode_errors++;
+            return;
+        }
+    }
+    
+    uint8_t data_len = length - header_length;
+    int expanded = data_len;
+    
+    if (flags & COMM_USB_FLAG_REPEAT) {
+        host->stats.repeats++;
+        
+        if (!host->repeat_valid || host->repeat_addr != addr || host->repeat_endpoint != endpoint) {
+            host->stats.decode_errors++;
+            return;
+        }
+        host->stats.capture_bytes += host->repeat_length;
+        return;
+    }
+    
+    if (flags & COMM_USB_FLAG_COMPRESSED) {
+        host->stats.compressed++;
+        expanded = host_rle_length(&host->data[header_length], data_len);
+        
+        if (expanded < 0) {
+            host->stats.decode_errors++;
+            host->repeat_valid = false;
+            return;
+        }
+    }
+    
+    host->stats.capture_bytes += (uint64_t)expanded;
+    
+    if (expanded > 0) {
+        host->repeat_valid = expanded <= COMM_REPEAT_SLOT_SIZE;
+        host->repeat_addr = addr;
+        host->repeat_endpoint = endpoint;
+        host->repeat_length = (uint8_t)expanded;
+    }
+}
+
+/**
+ * Account for a frame whose CRC checked out
+ * @param host Host state
+ */
+static void host_frame_complete(sim_host_t *host) {
+    uint8_t type = host->header[0];
+    uint8_t length = host->header[1];
+    uint8_t sequence = host->header[2];
+    
+    host->stats.frames++;
+    host->stats.payload_bytes += length;
+    
+    if (host->seq_valid && sequence != (uint8_t)(host->last_seq + 1)) {
+        host->stats.seq_gaps += (uint8_t)(sequence - host->last_seq - 1);
+        // The frame the device's repeat slot refers to may be the lost one
+        host->repeat_valid = false;
+    }
+    host->last_seq = sequence;
+    host->seq_valid = true;
+    
+    switch (type) {
+        case PACKET_TYPE_USB_PACKET:
+            host->stats.usb_packets++;
+            host_usb_data(host, length);
+            
+            if (length >= 4) {
+                // Simulated capture timestamps are ticks since epoch_ns
+                uint32_t captured = ((uint32_t)host->data[0] << 24) | ((uint32_t)host->data[1] << 16) |
+                                    ((uint32_t)host->data[2] << 8) | host->data[3];
+                uint32_t now = (uint32_t)((sim_now_ns() - host->epoch_ns) / 1000ULL);
+                
+                captured *= COMM_TIMESTAMP_TICK_US;
+                uint32_t latency = now - captured;
+                
+                host->stats.latency_sum_us += latency;
+                if (latency < host->stats.latency_min_us) host->stats.latency_min_us = latency;
+                if (latency > host->stats.latency_max_us) host->stats.latency_max_us = latency;
+            }
+            break;
+        
+        case PACKET_TYPE_TRIGGER:
+            host->stats.trigger_frames++;
+            if (length >= 11) {
+                host->trigger_state = host->data[0];
+                host->trigger_timestamp = ((uint32_t)host->data[1] << 24) | ((uint32_t)host->data[2] << 16) |
+                                          ((uint32_t)host->data[3] << 8) | host->data[4];
+                host->trigger_pre = ((uint16_t)host->data[5] << 8) | host->data[6];
+                host->trigger_post = ((uint16_t)host->data[7] << 8) | host->data[8];
+                host->trigger_dropped = ((uint16_t)host->data[9] << 8) | host->data[10];
+            }
+            break;
+        
+        case PACKET_TYPE_ACK:
+            host->stats.acks++;
+            if (length >= 1) {
+                host->last_ack = host->data[0];
+            }
+            break;
+        
+        case PACKET_TYPE_NACK:
+            host->stats.nacks++;
+            if (length >= 1) {
+                host->last_nack = host->data[0];
+            }
+            break;
+        
+        default:
+            break;
+    }
+}
+
+/**
+ * Feed one raw byte into the frame decoder
+ * @param host Host state
+ * @param byte Raw byte from the link
+ */
+static void host_rx_byte(sim_host_t *host, uint8_t byte) {
+    // A sync byte never occurs escaped, so it always starts a new frame
+    if (byte == COMM_SYNC_BYTE) {
+        if (host->state != HOST_STATE_WAIT_SYNC) {
+            host->stats.truncated++;
+        }
+        host->state = HOST_STATE_HEADER;
+        host->count = 0;
+        host->escape_next = false;
+        return;
+    }
+    
+    if (host->state == HOST_STATE_WAIT_SYNC) {
+        return;
+    }
+    
+    if (host->escape_next) {
+        byte ^= COMM_ESCAPE_XOR;
+        host->escape_next = false;
+        
+        if (byte != COMM_SYNC_BYTE && byte != COMM_ESCAPE_BYTE) {
+            host->stats.truncated++;
+            host->state = HOST_STATE_WAIT_SYNC;
+            return;
+        }
+    } else if (byte == COMM_ESCAPE_BYTE) {
+        host->escape_next = true;
+        return;
+    }
+    
+    switch (host->state) {
+        case HOST_STATE_HEADER:
+            host->header[host->count++] = byte;
+            if (host->count == 3) {
+                host->count = 0;
+                host->state = (host->header[1] > 0) ? HOST_STATE_DATA : HOST_STATE_CRC;
+            }
+            break;
+        
+        case HOST_STATE_DATA:
+            host->data[host->count++] = byte;
+            if (host->count == host->header[1]) {
+                host->count = 0;
+                host->state = HOST_STATE_CRC;
+            }
+            break;
+        
+        case HOST_STATE_CRC:
+            if (host->count++ == 0) {
+                host->crc = (uint16_t)byte << 8;
+                break;
+            }
+            host->crc |= byte;
+            
+            uint16_t crc = comm_calculate_crc(host->header, 3);
+            crc = comm_calculate_crc_continue(host->data, host->header[1], crc);
+            
+            if (crc == host->crc) {
+                host_frame_complete(host);
+            } else {
+                host->stats.crc_errors++;
+            }
+            host->state = HOST_STATE_WAIT_SYNC;
+            break;
+        
+        default:
+            host->state = HOST_STATE_WAIT_SYNC;
+            break;
+    }
+}
+
+/**
+ * Drain everything the device has sent so far
+ * @param host Host state
+ */
+void sim_host_poll(sim_host_t *host) {
+    uint8_t buffer[256];
+    ssize_t count;
+    
+    while ((count = read(host->fd, buffer, sizeof(buffer))) > 0) {
+        for (ssize_t i = 0; i < count; i++) {
+            host_rx_byte(host, buffer[i]);
+        }
+    }
+}
+
+/**
+ * Send a command and wait for its ACK/NACK
+ * @param host Host state
+ * @param type Packet type
+ * @param data Payload
+ * @param length Payload length
+ * @param device_poll Called while waiting so the device side keeps running
+ * @return true if the command was acknowledged within 500 ms
+ */
+bool sim_host_command(sim_host_t *host, packet_type_t type, const uint8_t *data, uint8_t length,
+                      void (*device_poll)(void)) {
+    uint8_t sequence = host->tx_sequence;
+    uint64_t deadline = sim_now_ns() + 500000000ULL;
+    
+    if (!sim_host_send(host, type, data, length)) {
+        return false;
+    }
+    
+    while (sim_now_ns() < deadline) {
+        device_poll();
+        sim_host_poll(host);
+        
+        if (host->last_ack == sequence) {
+            return true;
+        }
+        if (host->last_nack == sequence) {
+            return false;
+        }
+    }
+    
+    return false;
+}
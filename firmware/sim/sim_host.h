@@ -0,0 +1,75 @@
+/**
+ * USBShark - Military-grade USB protocol analyzer
+ * Simulator Host Header - Host end of the serial link for loopback runs
+ */
+
+#ifndef SIM_HOST_H
+#define SIM_HOST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "comm_protocol.h"
+
+/* Frame decoder states */
+typedef enum {
+    HOST_STATE_WAIT_SYNC,
+    HOST_STATE_HEADER,
+    HOST_STATE_DATA,
+    HOST_STATE_CRC
+} host_state_t;
+
+/* Link statistics gathered by the host end */
+typedef struct {
+    uint64_t frames;          // Frames with valid CRC
+    uint64_t usb_packets;     // PACKET_TYPE_USB_PACKET frames
+    uint64_t acks;            // PACKET_TYPE_ACK frames
+    uint64_t nacks;           // PACKET_TYPE_NACK frames
+    uint64_t crc_errors;      // Complete frames failing CRC
+    uint64_t truncated;       // Frames cut short by a new sync byte
+    uint64_t seq_gaps;        // Missing sequence numbers
+    uint64_t payload_bytes;   // Unescaped payload bytes in valid frames
+    uint64_t capture_bytes;   // USB data bytes after decompression
+    uint64_t truncated_data;  // USB packets with COMM_USB_FLAG_TRUNCATED
+    uint64_t trigger_frames;  // PACKET_TYPE_TRIGGER frames
+    uint64_t compressed;      // USB packets with COMM_USB_FLAG_COMPRESSED
+    uint64_t repeats;         // USB packets with COMM_USB_FLAG_REPEAT
+    uint64_t decode_errors;   // Malformed RLE data or repeat without reference
+    uint64_t latency_sum_us;  // Sum of capture-to-host latencies
+    uint32_t latency_min_us;
+    uint32_t latency_max_us;
+} host_stats_t;
+
+/* Host end of the link */
+typedef struct {
+    int fd;
+    host_state_t state;
+    bool escape_next;
+    uint8_t header[3];
+    uint8_t count;
+    uint8_t data[COMM_MAX_PACKET_SIZE];
+    uint16_t crc;
+    bool seq_valid;
+    uint8_t last_seq;
+    uint8_t tx_sequence;
+    int16_t last_ack;         // Sequence of the last ACK, -1 if none
+    int16_t last_nack;        // Sequence of the last NACK, -1 if none
+    uint64_t epoch_ns;        // Device capture start, for latency
+    bool repeat_valid;        // Mirror of the device repeat slot
+    uint8_t repeat_addr;
+    uint8_t repeat_endpoint;
+    uint8_t repeat_length;
+    uint8_t trigger_state;    // Last PACKET_TYPE_TRIGGER status
+    uint32_t trigger_timestamp;
+    uint16_t trigger_pre;
+    uint16_t trigger_post;
+    uint16_t trigger_dropped;
+    host_stats_t stats;
+} sim_host_t;
+
+void sim_host_init(sim_host_t *host, int fd);
+bool sim_host_send(sim_host_t *host, packet_type_t type, const uint8_t *data, uint8_t length);
+void sim_host_poll(sim_host_t *host);
+bool sim_host_command(sim_host_t *host, packet_type_t type, const uint8_t *data, uint8_t length,
+                      void (*device_poll)(void));
+
+#endif /* SIM_HOST_H */
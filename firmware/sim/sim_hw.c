@@ -0,0 +1,218 @@
+/**
+ * USBShark - Military-grade USB protocol analyzer
+ * Simulator Hardware Implementation
+ *
+ * Emulates USART0 of the ATmega328P on top of a pty master. Bytes written to
+ * UDR0 leave at the configured line rate and the RX/UDRE vectors of
+ * comm_protocol.c are dispatched from sim_hw_poll() whenever the I flag in
+ * the emulated SREG is set, just like on the real part.
+ *
+ * Transmit complete is raised when the transmitter goes idle. A flag that
+ * goes idle with TXCIE0 off is dropped, since the firmware always clears
+ * TXC0 before enabling the interrupt.
+ */
+
+#include "sim_hw.h"
+#include <avr/io.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+/* Bits per UART frame: start + 8 data + stop */
+#define UART_FRAME_BITS 10
+
+/* Vectors implemented by the firmware under test */
+void USART_RX_vect(void);
+void USART_UDRE_vect(void);
+void USART_TX_vect(void);
+
+/* Emulated registers */
+volatile uint8_t sim_sreg;
+volatile uint8_t sim_ubrr0h;
+volatile uint8_t sim_ubrr0l;
+volatile uint8_t sim_ucsr0b;
+volatile uint8_t sim_ucsr0c;
+
+static volatile uint8_t ucsr0a_reg;
+static volatile uint8_t udr0_tx_reg;
+static volatile uint8_t udr0_rx_reg;
+
+/* Emulation state */
+static int uart_fd = -1;
+static uint32_t baud_fixed = 0;
+static bool udr0_written = false;
+static bool in_rx_isr = false;
+static bool txc_flag = false;
+static uint64_t tx_free_at_ns = 0;
+static uint64_t tx_bytes = 0;
+static uint64_t rx_bytes = 0;
+
+/**
+ * Get monotonic time
+ * @return Nanoseconds since an arbitrary epoch
+ */
+uint64_t sim_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Get the effective line rate
+ * @return Baud rate from the override or from UBRR0/U2X0 as programmed
+ */
+uint32_t sim_hw_baud(void) {
+    if (baud_fixed != 0) {
+        return baud_fixed;
+    }
+    
+    uint16_t ubrr = ((uint16_t)sim_ubrr0h << 8) | sim_ubrr0l;
+    uint32_t divisor = (ucsr0a_reg & (1 << U2X0)) ? 8UL : 16UL;
+    
+    return (uint32_t)(F_CPU / (divisor * (ubrr + 1UL)));
+}
+
+/**
+ * Move a pending UDR0 write onto the wire
+ */
+static void uart_service(void) {
+    if (!udr0_written) {
+        return;
+    }
+    
+    udr0_written = false;
+    
+    if (!(sim_ucsr0b & (1 << TXEN0))) {
+        return;
+    }
+    
+    uint8_t data = udr0_tx_reg;
+    while (write(uart_fd, &data, 1) < 0 && errno == EINTR);
+    tx_bytes++;
+    txc_flag = true;
+    
+    // The next byte may only be loaded once this one has been shifted out
+    uint64_t now = sim_now_ns();
+    uint64_t byte_time = (UART_FRAME_BITS * 1000000000ULL) / sim_hw_baud();
+    
+    if (tx_free_at_ns < now) {
+        tx_free_at_ns = now;
+    }
+    tx_free_at_ns += byte_time;
+}
+
+/**
+ * UCSR0A access - reflects UDRE0 from the emulated shift timing
+ * @return Pointer to the status register
+ */
+volatile uint8_t *sim_uart_ucsr0a(void) {
+    uart_service();
+    
+    if (sim_now_ns() >= tx_free_at_ns) {
+        ucsr0a_reg |= (1 << UDRE0);
+    } else {
+        ucsr0a_reg &= (uint8_t)~(1 << UDRE0);
+    }
+    
+    return &ucsr0a_reg;
+}
+
+/**
+ * UDR0 access - reads return the received byte inside the RX vector,
+ * anything else is treated as a transmit write
+ * @return Pointer to the data register
+ */
+volatile uint8_t *sim_uart_udr0(void) {
+    if (in_rx_isr) {
+        return &udr0_rx_reg;
+    }
+    
+    uart_service();
+    udr0_written = true;
+    
+    return &udr0_tx_reg;
+}
+
+/**
+ * Attach the emulated UART to a file descriptor
+ * @param fd Non-blocking pty master descriptor
+ * @param baud_override Line rate to emulate, 0 to follow UBRR0
+ */
+void sim_hw_init(int fd, uint32_t baud_override) {
+    uart_fd = fd;
+    baud_fixed = baud_override;
+    sim_sreg = 0;
+    ucsr0a_reg = (1 << UDRE0);
+    udr0_written = false;
+    in_rx_isr = false;
+    txc_flag = false;
+    tx_free_at_ns = 0;
+    tx_bytes = 0;
+    rx_bytes = 0;
+}
+
+/**
+ * Dispatch pending UART interrupts
+ */
+void sim_hw_poll(void) {
+    uart_service();
+    
+    if (!(sim_sreg & (1 << SREG_I))) {
+        return;
+    }
+    
+    // Receive side: one RX Complete interrupt per byte
+    uint8_t rx[64];
+    ssize_t count = read(uart_fd, rx, sizeof(rx));
+    
+    for (ssize_t i = 0; i < count; i++) {
+        rx_bytes++;
+        
+        if ((sim_ucsr0b & (1 << RXEN0)) && (sim_ucsr0b & (1 << RXCIE0))) {
+            udr0_rx_reg = rx[i];
+            in_rx_isr = true;
+            USART_RX_vect();
+            in_rx_isr = false;
+            uart_service();
+        }
+    }
+    
+    // Transmit side: UDRE fires while the data register is empty
+    while ((sim_ucsr0b & (1 << UDRIE0)) && sim_now_ns() >= tx_free_at_ns) {
+        USART_UDRE_vect();
+        
+        if (!udr0_written) {
+            break;
+        }
+        uart_service();
+    }
+    
+    // Transmit complete once the last byte has been shifted out
+    if (txc_flag && !udr0_written && sim_now_ns() >= tx_free_at_ns) {
+        txc_flag = false;
+        
+        if (sim_ucsr0b & (1 << TXCIE0)) {
+            USART_TX_vect();
+        }
+    }
+}
+
+/**
+ * Get number of bytes transmitted by the firmware
+ * @return Byte count
+ */
+uint64_t sim_hw_tx_bytes(void) {
+    return tx_bytes;
+}
+
+/**
+ * Get number of bytes delivered to the firmware
+ * @return Byte count
+ */
+uint64_t sim_hw_rx_bytes(void) {
+    return rx_bytes;
+}
@@ -0,0 +1,31 @@
+/**
+ * USBShark - Military-grade USB protocol analyzer
+ * Simulator Hardware Header - Emulated USART0 backed by a pseudo-terminal
+ */
+
+#ifndef SIM_HW_H
+#define SIM_HW_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Emulated registers referenced by the <avr/io.h> shim */
+extern volatile uint8_t sim_sreg;
+extern volatile uint8_t sim_ubrr0h;
+extern volatile uint8_t sim_ubrr0l;
+extern volatile uint8_t sim_ucsr0b;
+extern volatile uint8_t sim_ucsr0c;
+
+/* Register accessors with side effects */
+volatile uint8_t *sim_uart_ucsr0a(void);
+volatile uint8_t *sim_uart_udr0(void);
+
+/* Simulator control */
+void sim_hw_init(int fd, uint32_t baud_override);
+void sim_hw_poll(void);
+uint32_t sim_hw_baud(void);
+uint64_t sim_hw_tx_bytes(void);
+uint64_t sim_hw_rx_bytes(void);
+uint64_t sim_now_ns(void);
+
+#endif /* SIM_HW_H */
@@ -0,0 +1,670 @@
+/**
+ * USBShark - Military-grade USB protocol analyzer
+ * Device Simulator Entry Point
+ *
+ * Runs comm_protocol.c on the host behind a pseudo-terminal so the desktop
+ * application (or the built-in loopback host) can talk to it exactly as it
+ * would to an Arduino. While capturing, synthetic USB traffic is framed as
+ * PACKET_TYPE_USB_PACKET and paced at the emulated UART line rate.
+ */
+
+#define _GNU_SOURCE
+#include "sim_hw.h"
+#include "sim_host.h"
+#include "comm_protocol.h"
+#include "usb_interface.h"
+#include "usb_trigger.h"
+#include <avr/interrupt.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Largest full-speed bulk payload generated */
+#define SIM_MAX_USB_PAYLOAD 64
+
+/* Traffic patterns */
+typedef enum {
+    PATTERN_IDLE,
+    PATTERN_SOF,
+    PATTERN_HID,
+    PATTERN_BULK,
+    PATTERN_CONTROL,
+    PATTERN_MIXED,
+    PATTERN_ZERO,
+    PATTERN_STALL
+} traffic_pattern_t;
+
+static const struct {
+    const char *name;
+    traffic_pattern_t pattern;
+    uint32_t default_rate;      // Transactions per second
+} pattern_table[] = {
+    { "idle",    PATTERN_IDLE,    0     },
+    { "sof",     PATTERN_SOF,     1000  },
+    { "hid",     PATTERN_HID,     1000  },
+    { "bulk",    PATTERN_BULK,    4000  },
+    { "control", PATTERN_CONTROL, 200   },
+    { "mixed",   PATTERN_MIXED,   2000  },
+    { "zero",    PATTERN_ZERO,    4000  },
+    { "stall",   PATTERN_STALL,   4000  }
+};
+
+/* Trigger conditions selectable with -T */
+static const struct {
+    const char *name;
+    usb_trigger_condition_t condition;
+    uint8_t arg0;
+    uint8_t arg1;
+} trigger_table[] = {
+    { "stall", USB_TRIGGER_PID,       USB_PID_STALL,   0               },
+    { "setup", USB_TRIGGER_SETUP,     USB_TRIGGER_ANY, USB_TRIGGER_ANY },
+    { "crc",   USB_TRIGGER_CRC_ERROR, 0,               0               }
+};
+
+#define TRIGGER_COUNT (sizeof(trigger_table) / sizeof(trigger_table[0]))
+
+#define PATTERN_COUNT (sizeof(pattern_table) / sizeof(pattern_table[0]))
+
+/* Simulator options */
+typedef struct {
+    uint32_t baud;              // 0 = follow UBRR0 as programmed by firmware
+    traffic_pattern_t pattern;
+    uint32_t rate;
+    double duration;            // Seconds, 0 = run until interrupted
+    const char *link_path;
+    bool loopback;
+    uint32_t link_baud;         // Rate negotiated by the loopback host, 0 = boot rate
+    bool compression;           // Loopback host enables payload compression
+    uint8_t snaplen;            // Loopback host snap length for all endpoints
+    int trigger;                // Loopback host trigger_table index, -1 = none
+    uint16_t post_count;        // Loopback host post-trigger packets
+} sim_options_t;
+
+/* Device state */
+static volatile bool running = true;
+static bool capturing = false;
+static uint64_t capture_epoch_ns = 0;
+static uint16_t frame_number = 0;
+static uint8_t data_toggle = 0;
+
+/* Device side statistics */
+static uint64_t transactions_generated = 0;
+static uint64_t frames_offered = 0;
+static uint64_t frames_dropped = 0;
+
+/**
+ * Signal handler - request a clean shutdown
+ * @param sig Signal number
+ */
+static void handle_signal(int sig) {
+    (void)sig;
+    running = false;
+}
+
+/**
+ * Get simulated capture timestamp
+ * @return Timestamp ticks since capture start, as usb_get_timestamp() counts them
+ */
+static uint32_t sim_timestamp(void) {
+    return (uint32_t)((sim_now_ns() - capture_epoch_ns) / (1000ULL * COMM_TIMESTAMP_TICK_US));
+}
+
+/**
+ * Frame one captured USB packet the way usb_send_packet_to_host() does
+ * @param pid USB PID
+ * @param addr Device address
+ * @param endpoint Endpoint number
+ * @param data Payload
+ * @param data_len Payload length
+ */
+static void sim_send_usb_packet(uint8_t pid, uint8_t addr, uint8_t endpoint,
+                                const uint8_t *data, uint8_t data_len) {
+    uint8_t length;
+    
+    if (data_len > SIM_MAX_USB_PAYLOAD) {
+        data_len = SIM_MAX_USB_PAYLOAD;
+    }
+    
+    length = usb_snap_length(pid, endpoint, data_len);
+    
+    frames_offered++;
+    
+    if (usb_trigger_active()) {
+        usb_packet_t packet = {
+            .timestamp = sim_timestamp(),
+            .pid = (usb_pid_t)pid,
+            .endpoint = endpoint,
+            .dev_addr = addr,
+            .data_len = data_len,
+            .data = (uint8_t *)data,
+            .crc_valid = true
+        };
+        
+        usb_trigger_record(&packet, length);
+        return;
+    }
+    
+    if (!comm_send_usb_packet(data, length, data_len, sim_timestamp(), pid, addr, endpoint,
+                              COMM_USB_FLAG_CRC_VALID)) {
+        frames_dropped++;
+    }
+}
+
+/**
+ * Emit a token/data/handshake triplet
+ * @param token Token PID
+ * @param addr Device address
+ * @param endpoint Endpoint number
+ * @param data Data stage payload
+ * @param data_len Payload length
+ */
+static void sim_transaction(uint8_t token, uint8_t addr, uint8_t endpoint,
+                            const uint8_t *data, uint8_t data_len) {
+    sim_send_usb_packet(token, addr, endpoint, NULL, 0);
+    sim_send_usb_packet(data_toggle ? USB_PID_DATA1 : USB_PID_DATA0, addr, endpoint, data, data_len);
+    sim_send_usb_packet(USB_PID_ACK, addr, endpoint, NULL, 0);
+    
+    data_toggle ^= 1;
+    transactions_generated++;
+}
+
+/**
+ * Generate one unit of traffic for the selected pattern
+ * @param pattern Traffic pattern
+ */
+static void sim_generate(traffic_pattern_t pattern) {
+    static const uint8_t get_device_descriptor[8] = {0x80, 0x06, 0x00, 0x01, 0x00, 0x00, 0x12, 0x00};
+    static const uint8_t device_descriptor[18] = {
+        0x12, 0x01, 0x00, 0x02, 0x00, 0x00, 0x00, 0x40,
+        0x41, 0x23, 0x43, 0x00, 0x01, 0x00, 0x01, 0x02, 0x03, 0x01
+    };
+    static uint8_t hid_report[8];
+    static uint8_t bulk_data[SIM_MAX_USB_PAYLOAD];
+    static uint32_t mixed_step = 0;
+    
+    switch (pattern) {
+        case PATTERN_IDLE:
+            break;
+        
+        case PATTERN_SOF: {
+            uint8_t frame[2] = {frame_number & 0xFF, (frame_number >> 8) & 0x07};
+            sim_send_usb_packet(USB_PID_SOF, 0, 0, frame, 2);
+            frame_number = (frame_number + 1) & 0x07FF;
+            transactions_generated++;
+            break;
+        }
+        
+        case PATTERN_HID:
+            // Mouse-style report, X/Y only move on every 8th poll
+            if ((transactions_generated & 0x07) == 0) {
+                hid_report[1]++;
+                hid_report[2]--;
+            }
+            sim_transaction(USB_PID_IN, 1, 1, hid_report, sizeof(hid_report));
+            break;
+        
+        case PATTERN_BULK:
+            for (uint8_t i = 0; i < sizeof(bulk_data); i++) {
+                bulk_data[i] = (uint8_t)(transactions_generated + i);
+            }
+            sim_transaction(USB_PID_IN, 1, 2, bulk_data, sizeof(bulk_data));
+            break;
+        
+        case PATTERN_ZERO:
+            // Bulk reads of an erased/sparse medium
+            memset(bulk_data, 0, sizeof(bulk_data));
+            bulk_data[0] = (uint8_t)transactions_generated;
+            sim_transaction(USB_PID_IN, 1, 2, bulk_data, sizeof(bulk_data));
+            break;
+        
+        case PATTERN_STALL:
+            // Busy bulk endpoint that stalls once every 1000 transactions
+            if (transactions_generated % 1000 == 999) {
+                sim_send_usb_packet(USB_PID_IN, 1, 2, NULL, 0);
+                sim_send_usb_packet(USB_PID_STALL, 1, 2, NULL, 0);
+                transactions_generated++;
+            } else {
+                sim_generate(PATTERN_BULK);
+            }
+            break;
+        
+        case PATTERN_CONTROL:
+            data_toggle = 0;
+            sim_transaction(USB_PID_SETUP, 0, 0, get_device_descriptor, sizeof(get_device_descriptor));
+            sim_transaction(USB_PID_IN, 0, 0, device_descriptor, sizeof(device_descriptor));
+            sim_transaction(USB_PID_OUT, 0, 0, NULL, 0);
+            break;
+        
+        case PATTERN_MIXED:
+            switch (mixed_step++ % 8) {
+                case 0:  sim_generate(PATTERN_SOF);     break;
+                case 1:  sim_generate(PATTERN_CONTROL); break;
+                case 2:
+                case 5:  sim_generate(PATTERN_HID);     break;
+                default: sim_generate(PATTERN_BULK);    break;
+            }
+            break;
+    }
+}
+
+/**
+ * Handle command packets from host (mirrors handle_command_packet in main.c)
+ * @param packet Received command
+ */
+static void sim_handle_command(const comm_packet_t *packet) {
+    switch (packet->type) {
+        case PACKET_TYPE_CMD_RESET:
+        case PACKET_TYPE_CMD_STOP_CAPTURE:
+            capturing = false;
+            comm_send_ack(packet->sequence);
+            break;
+        
+        case PACKET_TYPE_CMD_START_CAPTURE:
+            capturing = true;
+            capture_epoch_ns = sim_now_ns();
+            usb_trigger_rearm();
+            comm_send_ack(packet->sequence);
+            break;
+        
+        case PACKET_TYPE_CMD_SET_FILTER:
+            comm_send_ack(packet->sequence);
+            break;
+        
+        case PACKET_TYPE_CMD_SET_CONFIG:
+            if (comm_handle_config(packet)) {
+                break;
+            }
+            
+            comm_send_nack(packet->sequence, ERR_INVALID_COMMAND);
+            break;
+        
+        case PACKET_TYPE_CMD_GET_STATUS:
+            comm_send_status_report(1, capturing ? 1 : 0, 0, 0);
+            comm_send_ack(packet->sequence);
+            break;
+        
+        case PACKET_TYPE_CMD_SET_TIMESTAMP:
+            capture_epoch_ns = sim_now_ns();
+            comm_send_ack(packet->sequence);
+            break;
+        
+        default:
+            comm_send_nack(packet->sequence, ERR_INVALID_COMMAND);
+            break;
+    }
+}
+
+/**
+ * Run the UART and command path once
+ */
+static void sim_device_poll(void) {
+    sim_hw_poll();
+    
+    const comm_packet_t *packet = comm_receive_packet();
+    
+    if (packet != NULL) {
+        sim_handle_command(packet);
+        comm_release_packet();
+    }
+    
+    usb_trigger_task();
+}
+
+/**
+ * Open a raw pseudo-terminal pair
+ * @param master_fd Master descriptor (device side)
+ * @param slave_fd Slave descriptor (host side)
+ * @return true if successful
+ */
+static bool sim_open_pty(int *master_fd, int *slave_fd) {
+    struct termios tio;
+    
+    *master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (*master_fd < 0 || grantpt(*master_fd) < 0 || unlockpt(*master_fd) < 0) {
+        return false;
+    }
+    
+    // Keep the slave open so the master never sees EIO between host sessions
+    *slave_fd = open(ptsname(*master_fd), O_RDWR | O_NOCTTY);
+    if (*slave_fd < 0) {
+        return false;
+    }
+    
+    tcgetattr(*slave_fd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(*slave_fd, TCSANOW, &tio);
+    
+    fcntl(*master_fd, F_SETFL, fcntl(*master_fd, F_GETFL) | O_NONBLOCK);
+    fcntl(*slave_fd, F_SETFL, fcntl(*slave_fd, F_GETFL) | O_NONBLOCK);
+    
+    return true;
+}
+
+/**
+ * Print usage information
+ * @param prog Program name
+ */
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  -b BAUD      emulated line rate (default: as programmed by firmware)\n"
+        "  -p PATTERN   traffic pattern: idle, sof, hid, bulk, control, mixed, zero,\n"
+        "               stall (default: mixed)\n"
+        "  -r RATE      transactions per second (default: per pattern)\n"
+        "  -d SECONDS   stop after SECONDS (default: run until interrupted)\n"
+        "  -l PATH      create a symlink to the pty slave at PATH\n"
+        "  -L           loopback: act as the host and report link statistics\n"
+        "  -s BAUD      loopback: negotiate BAUD via SET_CONFIG before capturing\n"
+        "  -c           loopback: enable payload compression via SET_CONFIG\n"
+        "  -t BYTES     loopback: snap data stages to BYTES on all endpoints\n"
+        "  -T TRIGGER   loopback: capture a trigger window on stall, setup or crc\n"
+        "  -P COUNT     loopback: post-trigger packets (default: 16)\n",
+        prog);
+}
+
+/**
+ * Parse command line
+ * @param argc Argument count
+ * @param argv Argument vector
+ * @param opts Options to fill
+ * @return true if valid
+ */
+static bool parse_options(int argc, char **argv, sim_options_t *opts) {
+    bool rate_given = false;
+    int c;
+    
+    memset(opts, 0, sizeof(*opts));
+    opts->pattern = PATTERN_MIXED;
+    opts->snaplen = USB_SNAPLEN_NONE;
+    opts->trigger = -1;
+    opts->post_count = 16;
+    
+    while ((c = getopt(argc, argv, "b:p:r:d:l:Ls:ct:T:P:h")) != -1) {
+        switch (c) {
+            case 'b':
+                opts->baud = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'p': {
+                size_t i;
+                for (i = 0; i < PATTERN_COUNT; i++) {
+                    if (strcmp(optarg, pattern_table[i].name) == 0) {
+                        opts->pattern = pattern_table[i].pattern;
+                        break;
+                    }
+                }
+                if (i == PATTERN_COUNT) {
+                    fprintf(stderr, "Unknown pattern '%s'\n", optarg);
+                    return false;
+                }
+                break;
+            }
+            case 'r':
+                opts->rate = (uint32_t)strtoul(optarg, NULL, 10);
+                rate_given = true;
+                break;
+            case 'd':
+                opts->duration = strtod(optarg, NULL);
+                break;
+            case 'l':
+                opts->link_path = optarg;
+                break;
+            case 'L':
+                opts->loopback = true;
+                break;
+            case 's':
+                opts->link_baud = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'c':
+                opts->compression = true;
+                break;
+            case 't':
+                opts->snaplen = (uint8_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'T': {
+                size_t i;
+                for (i = 0; i < TRIGGER_COUNT; i++) {
+                    if (strcmp(optarg, trigger_table[i].name) == 0) {
+                        opts->trigger = (int)i;
+                        break;
+                    }
+                }
+                if (i == TRIGGER_COUNT) {
+                    fprintf(stderr, "Unknown trigger '%s'\n", optarg);
+                    return false;
+                }
+                break;
+            }
+            case 'P':
+                opts->post_count = (uint16_t)strtoul(optarg, NULL, 10);
+                break;
+            default:
+                return false;
+        }
+    }
+    
+    if (!rate_given) {
+        opts->rate = pattern_table[opts->pattern].default_rate;
+    }
+    
+    return true;
+}
+
+/**
+ * Print link statistics
+ * @param opts Simulator options
+ * @param host Loopback host, NULL if not in loopback mode
+ * @param elapsed Seconds of capture
+ */
+static void print_report(const sim_options_t *opts, const sim_host_t *host, double elapsed) {
+    printf("link:    %u baud, pattern %s, %u/s, %.2f s\n",
+           sim_hw_baud(), pattern_table[opts->pattern].name, opts->rate, elapsed);
+    printf("device:  %llu transactions, %llu frames offered, %llu dropped (tx ring full), %llu bytes on wire\n",
+           (unsigned long long)transactions_generated, (unsigned long long)frames_offered,
+           (unsigned long long)frames_dropped, (unsigned long long)sim_hw_tx_bytes());
+    
+    if (host == NULL) {
+        return;
+    }
+    
+    const host_stats_t *s = &host->stats;
+    double loss = frames_offered ? 100.0 * (double)(frames_offered - s->usb_packets) / (double)frames_offered : 0.0;
+    
+    printf("host:    %llu frames, %llu usb packets, %llu acks, %llu nacks\n",
+           (unsigned long long)s->frames, (unsigned long long)s->usb_packets,
+           (unsigned long long)s->acks, (unsigned long long)s->nacks);
+    printf("errors:  %llu crc, %llu truncated, %llu sequence gaps, %.2f%% usb packet loss\n",
+           (unsigned long long)s->crc_errors, (unsigned long long)s->truncated,
+           (unsigned long long)s->seq_gaps, loss);
+    printf("rate:    %.1f usb packets/s, %.1f kB/s payload, %.1f kB/s usb data\n",
+           elapsed > 0 ? (double)s->usb_packets / elapsed : 0.0,
+           elapsed > 0 ? (double)s->payload_bytes / elapsed / 1000.0 : 0.0,
+           elapsed > 0 ? (double)s->capture_bytes / elapsed / 1000.0 : 0.0);
+    
+    if (opts->snaplen != USB_SNAPLEN_NONE) {
+        printf("snaplen: %u bytes, %llu data stages truncated\n",
+               opts->snaplen, (unsigned long long)s->truncated_data);
+    }
+    
+    if (opts->trigger >= 0) {
+        printf("trigger: %s, %llu status frames, last state %u at %u us, %u pre + %u post packets, %u dropped\n",
+               trigger_table[opts->trigger].name, (unsigned long long)s->trigger_frames,
+               host->trigger_state, host->trigger_timestamp * COMM_TIMESTAMP_TICK_US, host->trigger_pre,
+               host->trigger_post, host->trigger_dropped);
+    }
+    
+    if (opts->compression) {
+        printf("compress: %llu rle, %llu repeats, %llu decode errors\n",
+               (unsigned long long)s->compressed, (unsigned long long)s->repeats,
+               (unsigned long long)s->decode_errors);
+    }
+    
+    if (s->usb_packets > 0) {
+        printf("latency: min %u us, avg %llu us, max %u us\n",
+               s->latency_min_us, (unsigned long long)(s->latency_sum_us / s->usb_packets),
+               s->latency_max_us);
+    }
+}
+
+/**
+ * Simulator entry point
+ */
+int main(int argc, char **argv) {
+    sim_options_t opts;
+    sim_host_t host;
+    int master_fd, slave_fd;
+    
+    if (!parse_options(argc, argv, &opts)) {
+        usage(argv[0]);
+        return 1;
+    }
+    
+    if (!sim_open_pty(&master_fd, &slave_fd)) {
+        perror("pty");
+        return 1;
+    }
+    
+    if (opts.link_path != NULL) {
+        unlink(opts.link_path);
+        if (symlink(ptsname(master_fd), opts.link_path) < 0) {
+            perror("symlink");
+            return 1;
+        }
+    }
+    
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+    
+    // Bring up the firmware side exactly as hardware_init()/main() do
+    usb_snaplen_init();
+    usb_trigger_init();
+    sim_hw_init(master_fd, opts.baud);
+    comm_init();
+    sei();
+    comm_send_status_report(1, 0, 0, 0);
+    
+    fprintf(stderr, "USBShark simulator on %s (%u baud)\n",
+            opts.link_path ? opts.link_path : ptsname(master_fd), sim_hw_baud());
+    
+    if (opts.loopback) {
+        sim_host_init(&host, slave_fd);
+        
+        if (opts.link_baud != 0) {
+            uint8_t config[5] = {
+                CONFIG_KEY_LINK_BAUD,
+                (opts.link_baud >> 24) & 0xFF, (opts.link_baud >> 16) & 0xFF,
+                (opts.link_baud >> 8) & 0xFF, opts.link_baud & 0xFF
+            };
+            
+            if (!sim_host_command(&host, PACKET_TYPE_CMD_SET_CONFIG, config, sizeof(config), sim_device_poll)) {
+                fprintf(stderr, "Link speed %u rejected\n", opts.link_baud);
+                return 1;
+            }
+        }
+        
+        if (opts.compression) {
+            uint8_t config[2] = {CONFIG_KEY_COMPRESSION, 1};
+            
+            if (!sim_host_command(&host, PACKET_TYPE_CMD_SET_CONFIG, config, sizeof(config), sim_device_poll)) {
+                fprintf(stderr, "Compression rejected\n");
+                return 1;
+            }
+        }
+        
+        if (opts.snaplen != USB_SNAPLEN_NONE) {
+            uint8_t config[3] = {CONFIG_KEY_SNAPLEN, USB_ENDPOINT_ALL, opts.snaplen};
+            
+            if (!sim_host_command(&host, PACKET_TYPE_CMD_SET_CONFIG, config, sizeof(config), sim_device_poll)) {
+                fprintf(stderr, "Snap length rejected\n");
+                return 1;
+            }
+        }
+        
+        if (opts.trigger >= 0) {
+            uint8_t config[6] = {
+                CONFIG_KEY_TRIGGER, trigger_table[opts.trigger].condition,
+                trigger_table[opts.trigger].arg0, trigger_table[opts.trigger].arg1,
+                (opts.post_count >> 8) & 0xFF, opts.post_count & 0xFF
+            };
+            
+            if (!sim_host_command(&host, PACKET_TYPE_CMD_SET_CONFIG, config, sizeof(config), sim_device_poll)) {
+                fprintf(stderr, "Trigger rejected\n");
+                return 1;
+            }
+        }
+        
+        sim_host_send(&host, PACKET_TYPE_CMD_START_CAPTURE, NULL, 0);
+    }
+    
+    uint64_t interval_ns = opts.rate ? 1000000000ULL / opts.rate : 0;
+    uint64_t next_ns = sim_now_ns();
+    uint64_t start_ns = 0;
+    bool was_capturing = false;
+    
+    while (running) {
+        sim_device_poll();
+        
+        uint64_t now = sim_now_ns();
+        
+        if (capturing && !was_capturing) {
+            start_ns = now;
+            next_ns = now;
+            if (opts.loopback) {
+                host.epoch_ns = capture_epoch_ns;
+            }
+        }
+        was_capturing = capturing;
+        
+        if (capturing && interval_ns != 0 && now >= next_ns) {
+            sim_generate(opts.pattern);
+            next_ns += interval_ns;
+            
+            // Never try to catch up on more than a few milliseconds of backlog
+            if (now > next_ns + 5000000ULL) {
+                next_ns = now;
+            }
+        }
+        
+        if (opts.loopback) {
+            sim_host_poll(&host);
+        }
+        
+        if (capturing && opts.duration > 0 && (double)(now - start_ns) / 1e9 >= opts.duration) {
+            running = false;
+        }
+        
+        if (!capturing || interval_ns == 0) {
+            struct timespec idle = {0, 50000};
+            nanosleep(&idle, NULL);
+        }
+    }
+    
+    double elapsed = start_ns ? (double)(sim_now_ns() - start_ns) / 1e9 : 0.0;
+    
+    if (opts.loopback) {
+        // Let the UART drain, then collect the tail of the stream
+        capturing = false;
+        uint64_t drain_until = sim_now_ns() + 200000000ULL;
+        while (sim_now_ns() < drain_until) {
+            sim_hw_poll();
+            sim_host_poll(&host);
+        }
+    }
+    
+    print_report(&opts, opts.loopback ? &host : NULL, elapsed);
+    
+    if (opts.link_path != NULL) {
+        unlink(opts.link_path);
+    }
+    
+    close(slave_fd);
+    close(master_fd);
+    
+    return 0;
+}
@@ -5,13 +5,17 @@
 
 #include "../include/comm_protocol.h"
 #include "../include/ringbuffer.h"
+#include "../include/profile.h"
+#include "../include/crc.h"
+#include "../include/usb_interface.h"
+#include "../include/usb_trigger.h"
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <string.h>
 
-/* UART settings */
-#define UART_BAUD 1000000UL  // 1 Mbps for high-speed data transfer
-#define UBRR_VALUE ((F_CPU / (UART_BAUD * 16UL)) - 1)
+/* UART settings - always double speed (U2X0) so 2 Mbps is reachable at 16 MHz */
+#define UART_DIVISOR 8UL
+#define UART_UBRR_MAX 4095
 
 /* Protocol state machine */
 typedef enum {
@@ -24,9 +28,11 @@ typedef enum {
     PROTO_STATE_CRC_LOW
 } proto_state_t;
 
-/* Ring buffers for UART TX and RX */
+/* Command queue slots index mask */
+#define CMD_QUEUE_MASK (COMM_CMD_QUEUE_DEPTH - 1)
+
+/* Ring buffer for UART TX */
 static ringbuffer_t uart_tx_buffer;
-static ringbuffer_t uart_rx_buffer;
 
 /* Protocol state variables */
 static volatile proto_state_t rx_state = PROTO_STATE_WAIT_SYNC;
@@ -34,57 +40,108 @@ static volatile uint8_t rx_data_count = 0;
 static volatile uint8_t rx_packet_length = 0;
 static volatile uint8_t tx_sequence = 0;
 static volatile uint8_t rx_sequence = 0;
-static comm_packet_t rx_packet;
-static volatile bool packet_ready = false;
-
-/* CRC-16 lookup table */
-static const uint16_t crc16_table[256] = {
-    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
-    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
-    0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
-    0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
-    0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
-    0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
-    0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
-    0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
-    0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
-    0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
-    0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
-    0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
-    0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
-    0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
-    0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
-    0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
-    0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
-    0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
-    0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
-    0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
-    0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
-    0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
-    0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
-    0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
-    0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
-    0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
-    0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
-    0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
-    0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
-    0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
-    0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
-    0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
-};
+
+/* Received command queue - the receive interrupt assembles each frame in
+ * the slot at cmd_queue_head and publishes it by advancing the head. A frame
+ * that fails its CRC check is published as a PACKET_TYPE_NACK slot, so the
+ * main loop sends that NACK in order with the other replies. */
+static volatile comm_packet_t cmd_queue[COMM_CMD_QUEUE_DEPTH];
+static volatile uint8_t cmd_queue_head = 0;   // Written by the receive interrupt
+static volatile uint8_t cmd_queue_tail = 0;   // Written by the main loop
+
+/* Recently handled commands - a retransmitted command is recognized by its
+ * sequence number and CRC and only gets its reply again. Commands that are
+ * safe to run twice are never remembered, so a repeated status request
+ * gets its report again. reply is ERR_NONE
+ * for an ACK, the error code of a NACK, or CMD_REPLY_NONE if nothing went
+ * out through comm_send_ack()/comm_send_nack() (the link speed ACK). */
+#define CMD_REPLY_NONE 0xFE
+
+typedef struct {
+    uint8_t sequence;
+    uint16_t crc;
+    uint8_t reply;
+} cmd_history_t;
+
+static cmd_history_t cmd_history[COMM_CMD_HISTORY_DEPTH];
+static uint8_t cmd_history_count = 0;
+static uint8_t cmd_history_next = 0;
+static uint8_t cmd_reply = CMD_REPLY_NONE;    // Reply to the command being handled
+
+/* Link speed state */
+static volatile uint32_t link_baud = BAUD;
+static volatile uint32_t pending_baud = 0;
+static volatile uint16_t pending_ubrr = 0;
+static volatile bool link_ack_queued = false;
+static volatile uint8_t rx_frame_errors = 0;
+
+/* Payload compression state - last data sent, for repeat suppression */
+static bool compression_enabled = false;
+static uint8_t repeat_slot[COMM_REPEAT_SLOT_SIZE];
+static uint8_t repeat_length = 0;
+static uint8_t repeat_addr = 0;
+static uint8_t repeat_endpoint = 0;
+static bool repeat_valid = false;
+
+static bool send_frame(packet_type_t type, const uint8_t *data, uint8_t length);
+
+/**
+ * Calculate the double-speed UBRR value for a baud rate
+ * @param baud Requested baud rate
+ * @param ubrr Pointer to store the register value
+ * @return true if the rate is within the error budget
+ */
+static bool uart_calc_ubrr(uint32_t baud, uint16_t *ubrr) {
+    if (baud == 0 || baud > F_CPU / UART_DIVISOR) {
+        return false;
+    }
+    
+    // Rounded F_CPU / (8 * baud)
+    uint32_t divider = ((F_CPU / (UART_DIVISOR / 2)) / baud + 1) / 2;
+    if (divider == 0 || divider > UART_UBRR_MAX + 1) {
+        return false;
+    }
+    
+    // Check the rate actually produced against the error budget
+    uint32_t actual = F_CPU / (UART_DIVISOR * divider);
+    uint32_t error = (actual > baud) ? (actual - baud) : (baud - actual);
+    
+    if (error * 1000UL > baud * COMM_BAUD_MAX_ERROR_PERMILLE) {
+        return false;
+    }
+    
+    *ubrr = (uint16_t)(divider - 1);
+    return true;
+}
+
+/**
+ * Program the baud rate register
+ * @param ubrr UBRR value for double speed mode
+ */
+static void uart_set_ubrr(uint16_t ubrr) {
+    UBRR0H = (uint8_t)(ubrr >> 8);
+    UBRR0L = (uint8_t)ubrr;
+}
 
 /**
  * Initialize communication module
  */
 void comm_init(void) {
-    // Initialize ring buffers
+    uint16_t ubrr = 0;
+    
+    // Initialize ring buffer
     ringbuffer_init(&uart_tx_buffer);
-    ringbuffer_init(&uart_rx_buffer);
     
     // Configure UART
-    // Set baud rate
-    UBRR0H = (uint8_t)(UBRR_VALUE >> 8);
-    UBRR0L = (uint8_t)UBRR_VALUE;
+    // Double speed mode, boot rate from the Makefile
+    UCSR0A = (1 << U2X0);
+    uart_calc_ubrr(BAUD, &ubrr);
+    uart_set_ubrr(ubrr);
+    link_baud = BAUD;
+    link_ack_queued = false;
+    rx_frame_errors = 0;
+    compression_enabled = false;
+    repeat_valid = false;
     
     // Enable receiver, transmitter and RX Complete interrupt
     UCSR0B = (1 << RXEN0) | (1 << TXEN0) | (1 << RXCIE0);
@@ -96,136 +153,227 @@ void comm_init(void) {
     rx_state = PROTO_STATE_WAIT_SYNC;
     tx_sequence = 0;
     rx_sequence = 0;
-    packet_ready = false;
+    cmd_queue_head = 0;
+    cmd_queue_tail = 0;
+    cmd_history_count = 0;
+    cmd_history_next = 0;
 }
 
 /**
- * Send byte to UART
- * @param data Byte to send
+ * Stage one frame byte in the TX buffer, escaped
+ * @param cursor Staging position in uart_tx_buffer, updated
+ * @param data Unescaped byte
  * @return true if successful, false if buffer full
  */
-static bool uart_send_byte(uint8_t data) {
-    // If UART data register is empty and TX buffer is empty, send directly
-    if ((UCSR0A & (1 << UDRE0)) && ringbuffer_empty(&uart_tx_buffer)) {
-        UDR0 = data;
-        return true;
+static bool frame_stage(uint8_t *cursor, uint8_t data) {
+    if (data == COMM_SYNC_BYTE || data == COMM_ESCAPE_BYTE) {
+        return ringbuffer_stage(&uart_tx_buffer, cursor, COMM_ESCAPE_BYTE) &&
+               ringbuffer_stage(&uart_tx_buffer, cursor, data ^ COMM_ESCAPE_XOR);
     }
     
-    // Otherwise, add to TX buffer
-    uint8_t buffer_status;
-    
-    // Disable interrupts while modifying buffer
-    uint8_t sreg = SREG;
-    cli();
-    
-    buffer_status = ringbuffer_push(&uart_tx_buffer, data);
-    
-    // If this is the first byte, enable TX Complete interrupt
-    if (buffer_status && ringbuffer_count(&uart_tx_buffer) == 1) {
-        UCSR0B |= (1 << UDRIE0);
+    return ringbuffer_stage(&uart_tx_buffer, cursor, data);
+}
+
+/**
+ * Fold a frame byte into the CRC and stage it, escaped
+ * @param cursor Staging position in uart_tx_buffer, updated
+ * @param crc Running CRC, updated
+ * @param data Unescaped byte
+ * @return true if successful, false if buffer full
+ */
+static bool frame_put(uint8_t *cursor, uint16_t *crc, uint8_t data) {
+    *crc = crc_ccitt_byte(*crc, data);
+    return frame_stage(cursor, data);
+}
+
+/**
+ * Look a received command up among the recently handled ones
+ * @param packet Received command
+ * @return History entry of the same command, NULL if it is new
+ */
+static const cmd_history_t *find_handled_command(const comm_packet_t *packet) {
+    for (uint8_t i = 0; i < cmd_history_count; i++) {
+        if (cmd_history[i].sequence == packet->sequence && cmd_history[i].crc == packet->crc) {
+            return &cmd_history[i];
+        }
     }
     
-    // Restore interrupt state
-    SREG = sreg;
+    return NULL;
+}
+
+/**
+ * Get the next queued command from the host, without copying it
+ * The slot stays with the main loop, untouched by the receive interrupt,
+ * until comm_release_packet(). Also sends the NACKs for frames the receive
+ * interrupt rejected and the replies to retransmitted commands, leaving
+ * COMM_COMMAND_TX_RESERVE bytes of TX space for the command returned.
+ * @return Received packet, NULL if none is waiting or the TX buffer is short
+ */
+const comm_packet_t *comm_receive_packet(void) {
+    // The slot at the tail belongs to the main loop until the tail moves on
+    while (cmd_queue_tail != cmd_queue_head) {
+        // Only look at a slot once its replies fit whole
+        if (comm_tx_free() < COMM_COMMAND_TX_RESERVE) {
+            return NULL;
+        }
+        
+        const comm_packet_t *packet = (const comm_packet_t *)&cmd_queue[cmd_queue_tail & CMD_QUEUE_MASK];
+        
+        if (packet->type == PACKET_TYPE_NACK) {
+            comm_send_nack(packet->sequence, (error_code_t)packet->data[0]);
+            cmd_queue_tail++;
+            continue;
+        }
+        
+        // A new host session may reuse recent sequence numbers, forget them
+        if (packet->type == PACKET_TYPE_CMD_RESET) {
+            cmd_history_count = 0;
+            cmd_history_next = 0;
+        }
+        
+        const cmd_history_t *handled = find_handled_command(packet);
+        
+        if (handled == NULL) {
+            cmd_reply = CMD_REPLY_NONE;
+            return packet;
+        }
+        
+        // Already run, the host lost the reply
+        if (handled->reply == ERR_NONE) {
+            comm_send_ack(packet->sequence);
+        } else if (handled->reply != CMD_REPLY_NONE) {
+            comm_send_nack(packet->sequence, (error_code_t)handled->reply);
+        }
+        cmd_queue_tail++;
+    }
     
-    return buffer_status;
+    return NULL;
 }
 
 /**
- * Receive a packet from the host
- * @param packet Pointer to store the received packet
- * @return true if packet received, false otherwise
+ * Hand the packet returned by comm_receive_packet() back to the receive interrupt
  */
-bool comm_receive_packet(comm_packet_t *packet) {
+void comm_release_packet(void) {
+    if (cmd_queue_tail != cmd_queue_head) {
+        const comm_packet_t *packet = (const comm_packet_t *)&cmd_queue[cmd_queue_tail & CMD_QUEUE_MASK];
+        
+        // Remember the command and its reply for retransmissions
+        if (packet->type != PACKET_TYPE_CMD_RESET && packet->type != PACKET_TYPE_CMD_GET_STATUS) {
+            cmd_history_t *entry = &cmd_history[cmd_history_next];
+            
+            entry->sequence = packet->sequence;
+            entry->crc = packet->crc;
+            entry->reply = cmd_reply;
+            cmd_history_next = (cmd_history_next + 1) % COMM_CMD_HISTORY_DEPTH;
+            if (cmd_history_count < COMM_CMD_HISTORY_DEPTH) {
+                cmd_history_count++;
+            }
+        }
+        
+        cmd_queue_tail++;
+    }
+}
+
+/**
+ * Check whether a link rate can be used
+ * @param baud Requested baud rate
+ * @return true if within the error budget at F_CPU
+ */
+bool comm_link_baud_supported(uint32_t baud) {
+    uint16_t ubrr;
+    return uart_calc_ubrr(baud, &ubrr);
+}
+
+/**
+ * Acknowledge a link speed change and switch once the ACK has left the UART
+ * Until the switch, no other frame is queued behind the ACK, so nothing
+ * else goes out at the old rate after the host has moved on.
+ * @param sequence Sequence number of the SET_CONFIG command
+ * @param baud New baud rate
+ * @return true if handled, false if the rate is unsupported
+ */
+bool comm_set_link_baud(uint8_t sequence, uint32_t baud) {
+    uint16_t ubrr;
+    uint8_t ack_data = sequence;
+    
+    if (!uart_calc_ubrr(baud, &ubrr)) {
+        return false;
+    }
+    
     uint8_t sreg = SREG;
     cli();
     
-    bool result = packet_ready;
+    // Clear any stale transmit complete flag before the ACK is queued
+    UCSR0A = (1 << TXC0) | (1 << U2X0);
     
-    if (packet_ready) {
-        // Copy the received packet
-        memcpy(packet, (void*)&rx_packet, sizeof(comm_packet_t));
-        packet_ready = false;
+    // The ACK still goes out at the old rate. If it cannot be queued the
+    // rate stays, and the host, which never retransmits this key, keeps it too
+    if (send_frame(PACKET_TYPE_ACK, &ack_data, 1)) {
+        pending_ubrr = ubrr;
+        pending_baud = baud;
+        link_ack_queued = true;
+        UCSR0B |= (1 << TXCIE0);
     }
     
     SREG = sreg;
-    return result;
+    
+    return true;
 }
 
 /**
- * Send packet to host
+ * Get the current link rate
+ * @return Baud rate
+ */
+uint32_t comm_get_link_baud(void) {
+    return link_baud;
+}
+
+/**
+ * Frame a packet into the UART buffer
+ * Each byte is folded into the CRC, escaped and staged in one pass. The
+ * frame is only handed to the UART once complete, so a full buffer drops
+ * the whole frame instead of leaving a truncated one on the wire.
  * @param type Packet type
  * @param data Packet data
- * @param length Data length
+ * @param length Data length, within COMM_MAX_PACKET_SIZE by its type
  * @return true if successful, false if transmission failed
  */
-bool comm_send_packet(packet_type_t type, const uint8_t *data, uint8_t length) {
-    // Check if length is valid
-    if (length > COMM_MAX_PACKET_SIZE) {
+static bool send_frame(packet_type_t type, const uint8_t *data, uint8_t length) {
+    // Nothing may follow a link speed ACK until the UART has switched
+    if (link_ack_queued) {
         return false;
     }
     
-    // Calculate CRC of header and data
-    uint8_t header[3] = {type, length, tx_sequence};
-    uint16_t crc = comm_calculate_crc(header, 3);
-    crc = comm_calculate_crc_continue(data, length, crc);
+    uint8_t cursor = uart_tx_buffer.write_index;
+    uint16_t crc = CRC_CCITT_INIT;
     
-    // Send sync byte (without escaping)
-    if (!uart_send_byte(COMM_SYNC_BYTE)) {
-        return false;
-    }
+    // Sync byte unescaped and outside the CRC, then header and data
+    bool staged = ringbuffer_stage(&uart_tx_buffer, &cursor, COMM_SYNC_BYTE) &&
+                  frame_put(&cursor, &crc, type) &&
+                  frame_put(&cursor, &crc, length) &&
+                  frame_put(&cursor, &crc, tx_sequence);
     
-    // Send packet type with escaping
-    if (type == COMM_SYNC_BYTE || type == COMM_ESCAPE_BYTE) {
-        if (!uart_send_byte(COMM_ESCAPE_BYTE)) return false;
-        if (!uart_send_byte(type ^ 0xFF)) return false;
-    } else {
-        if (!uart_send_byte(type)) return false;
+    for (uint8_t i = 0; staged && i < length; i++) {
+        staged = frame_put(&cursor, &crc, data[i]);
     }
     
-    // Send length with escaping
-    if (length == COMM_SYNC_BYTE || length == COMM_ESCAPE_BYTE) {
-        if (!uart_send_byte(COMM_ESCAPE_BYTE)) return false;
-        if (!uart_send_byte(length ^ 0xFF)) return false;
-    } else {
-        if (!uart_send_byte(length)) return false;
-    }
-    
-    // Send sequence with escaping
-    if (tx_sequence == COMM_SYNC_BYTE || tx_sequence == COMM_ESCAPE_BYTE) {
-        if (!uart_send_byte(COMM_ESCAPE_BYTE)) return false;
-        if (!uart_send_byte(tx_sequence ^ 0xFF)) return false;
-    } else {
-        if (!uart_send_byte(tx_sequence)) return false;
-    }
+    staged = staged &&
+             frame_stage(&cursor, (crc >> 8) & 0xFF) &&
+             frame_stage(&cursor, crc & 0xFF);
     
-    // Send data with escaping
-    for (uint8_t i = 0; i < length; i++) {
-        if (data[i] == COMM_SYNC_BYTE || data[i] == COMM_ESCAPE_BYTE) {
-            if (!uart_send_byte(COMM_ESCAPE_BYTE)) return false;
-            if (!uart_send_byte(data[i] ^ 0xFF)) return false;
-        } else {
-            if (!uart_send_byte(data[i])) return false;
-        }
+    if (!staged) {
+        uart_tx_buffer.overflow_count++;
+        return false;
     }
     
-    // Send CRC with escaping
-    uint8_t crc_high = (crc >> 8) & 0xFF;
-    uint8_t crc_low = crc & 0xFF;
+    // Publish the frame and make sure the transmit interrupt is draining
+    uint8_t sreg = SREG;
+    cli();
     
-    if (crc_high == COMM_SYNC_BYTE || crc_high == COMM_ESCAPE_BYTE) {
-        if (!uart_send_byte(COMM_ESCAPE_BYTE)) return false;
-        if (!uart_send_byte(crc_high ^ 0xFF)) return false;
-    } else {
-        if (!uart_send_byte(crc_high)) return false;
-    }
+    ringbuffer_commit(&uart_tx_buffer, cursor);
+    UCSR0B |= (1 << UDRIE0);
     
-    if (crc_low == COMM_SYNC_BYTE || crc_low == COMM_ESCAPE_BYTE) {
-        if (!uart_send_byte(COMM_ESCAPE_BYTE)) return false;
-        if (!uart_send_byte(crc_low ^ 0xFF)) return false;
-    } else {
-        if (!uart_send_byte(crc_low)) return false;
-    }
+    SREG = sreg;
     
     // Increment sequence number
     tx_sequence++;
@@ -233,6 +381,35 @@ bool comm_send_packet(packet_type_t type, const uint8_t *data, uint8_t length) {
     return true;
 }
 
+/**
+ * Send packet to host
+ * @param type Packet type
+ * @param data Packet data
+ * @param length Data length
+ * @return true if successful, false if transmission failed
+ */
+bool comm_send_packet(packet_type_t type, const uint8_t *data, uint8_t length) {
+    PROFILE_BEGIN(PROFILE_SEND_PACKET);
+    bool result = send_frame(type, data, length);
+    PROFILE_END(PROFILE_SEND_PACKET);
+    
+    return result;
+}
+
+/**
+ * Get free space in the UART transmit buffer
+ * @return Number of bytes that can be queued without blocking a frame
+ */
+uint8_t comm_tx_free(void) {
+    uint8_t sreg = SREG;
+    cli();
+    // Frames are held back while a link speed change is pending
+    uint8_t free_bytes = link_ack_queued ? 0 : ringbuffer_free(&uart_tx_buffer);
+    SREG = sreg;
+    
+    return free_bytes;
+}
+
 /**
  * Process received packet
  * @param packet Received packet
@@ -248,43 +425,43 @@ bool comm_process_command(const comm_packet_t *packet) {
             // To be implemented
             result = true;
             break;
-            
+        
         case PACKET_TYPE_CMD_START_CAPTURE:
             // Start USB capture with config in packet data
             // To be implemented
             result = true;
             break;
-            
+        
         case PACKET_TYPE_CMD_STOP_CAPTURE:
             // Stop USB capture
             // To be implemented
             result = true;
             break;
-            
+        
         case PACKET_TYPE_CMD_SET_FILTER:
             // Set USB packet filter
             // To be implemented
             result = true;
             break;
-            
+        
         case PACKET_TYPE_CMD_GET_STATUS:
             // Return system status
             // To be implemented
             result = true;
             break;
-            
+        
         case PACKET_TYPE_CMD_SET_TIMESTAMP:
             // Set timestamp value
             // To be implemented
             result = true;
             break;
-            
+        
         case PACKET_TYPE_CMD_SET_CONFIG:
             // Set system configuration
             // To be implemented
             result = true;
             break;
-            
+        
         default:
             // Unknown command
             comm_send_nack(packet->sequence, ERR_INVALID_COMMAND);
@@ -300,12 +477,80 @@ bool comm_process_command(const comm_packet_t *packet) {
     return result;
 }
 
+/**
+ * Handle the keys of PACKET_TYPE_CMD_SET_CONFIG shared with the simulator
+ * @param packet Received SET_CONFIG command
+ * @return true if the key was handled and ACK/NACK sent, false otherwise
+ */
+bool comm_handle_config(const comm_packet_t *packet) {
+    if (packet->length < 1) {
+        return false;
+    }
+    
+    switch (packet->data[0]) {
+        case CONFIG_KEY_LINK_BAUD:
+            if (packet->length < 5) {
+                comm_send_nack(packet->sequence, ERR_INVALID_COMMAND);
+            } else {
+                uint32_t baud = ((uint32_t)packet->data[1] << 24) | ((uint32_t)packet->data[2] << 16) |
+                                ((uint32_t)packet->data[3] << 8) | packet->data[4];
+                
+                // ACK goes out at the current rate, the UART switches afterwards
+                if (!comm_set_link_baud(packet->sequence, baud)) {
+                    comm_send_nack(packet->sequence, ERR_UNSUPPORTED);
+                }
+            }
+            return true;
+        
+        case CONFIG_KEY_COMPRESSION:
+            if (packet->length < 2 || packet->data[1] > 1) {
+                comm_send_nack(packet->sequence, ERR_INVALID_COMMAND);
+            } else {
+                comm_set_compression(packet->data[1] != 0);
+                comm_send_ack(packet->sequence);
+            }
+            return true;
+        
+        case CONFIG_KEY_SNAPLEN:
+            if (packet->length < 3 || !usb_set_snaplen(packet->data[1], packet->data[2])) {
+                comm_send_nack(packet->sequence, ERR_INVALID_COMMAND);
+            } else {
+                comm_send_ack(packet->sequence);
+            }
+            return true;
+        
+        case CONFIG_KEY_TRIGGER:
+            if (packet->length < 6) {
+                comm_send_nack(packet->sequence, ERR_INVALID_COMMAND);
+            } else {
+                usb_trigger_config_t trigger = {
+                    .condition = (usb_trigger_condition_t)packet->data[1],
+                    .arg0 = packet->data[2],
+                    .arg1 = packet->data[3],
+                    .post_count = ((uint16_t)packet->data[4] << 8) | packet->data[5]
+                };
+                
+                if (usb_trigger_configure(&trigger)) {
+                    comm_send_ack(packet->sequence);
+                } else {
+                    comm_send_nack(packet->sequence, ERR_INVALID_COMMAND);
+                }
+            }
+            return true;
+        
+        default:
+            return false;
+    }
+}
+
 /**
  * Send acknowledgment
  * @param sequence Sequence number to acknowledge
  */
 void comm_send_ack(uint8_t sequence) {
     uint8_t ack_data = sequence;
+    
+    cmd_reply = ERR_NONE;
     comm_send_packet(PACKET_TYPE_ACK, &ack_data, 1);
 }
 
@@ -316,6 +561,8 @@ void comm_send_ack(uint8_t sequence) {
  */
 void comm_send_nack(uint8_t sequence, error_code_t error) {
     uint8_t nack_data[2] = {sequence, error};
+    
+    cmd_reply = error;
     comm_send_packet(PACKET_TYPE_NACK, nack_data, 2);
 }
 
@@ -326,13 +573,7 @@ void comm_send_nack(uint8_t sequence, error_code_t error) {
  * @return CRC-16 value
  */
 uint16_t comm_calculate_crc(const uint8_t *data, uint16_t length) {
-    uint16_t crc = 0xFFFF;
-    
-    for (uint16_t i = 0; i < length; i++) {
-        crc = (crc << 8) ^ crc16_table[(crc >> 8) ^ data[i]];
-    }
-    
-    return crc;
+    return crc_ccitt_update(CRC_CCITT_INIT, data, length);
 }
 
 /**
@@ -343,11 +584,7 @@ uint16_t comm_calculate_crc(const uint8_t *data, uint16_t length) {
  * @return Updated CRC-16 value
  */
 uint16_t comm_calculate_crc_continue(const uint8_t *data, uint16_t length, uint16_t crc) {
-    for (uint16_t i = 0; i < length; i++) {
-        crc = (crc << 8) ^ crc16_table[(crc >> 8) ^ data[i]];
-    }
-    
-    return crc;
+    return crc_ccitt_update(crc, data, length);
 }
 
 /**
@@ -363,7 +600,7 @@ void comm_escape_data(uint8_t *dest, const uint8_t *src, uint8_t length, uint8_t
     for (uint8_t i = 0; i < length; i++) {
         if (src[i] == COMM_SYNC_BYTE || src[i] == COMM_ESCAPE_BYTE) {
             dest[out_idx++] = COMM_ESCAPE_BYTE;
-            dest[out_idx++] = src[i] ^ 0xFF;
+            dest[out_idx++] = src[i] ^ COMM_ESCAPE_XOR;
         } else {
             dest[out_idx++] = src[i];
         }
@@ -386,7 +623,13 @@ bool comm_unescape_data(uint8_t *dest, const uint8_t *src, uint8_t length, uint8
     
     for (uint8_t i = 0; i < length; i++) {
         if (escape_next) {
-            dest[out_idx++] = src[i] ^ 0xFF;
+            uint8_t byte = src[i] ^ COMM_ESCAPE_XOR;
+            
+            // Only framing bytes are ever escaped
+            if (byte != COMM_SYNC_BYTE && byte != COMM_ESCAPE_BYTE) {
+                return false;
+            }
+            dest[out_idx++] = byte;
             escape_next = false;
         } else if (src[i] == COMM_ESCAPE_BYTE) {
             escape_next = true;
@@ -404,17 +647,106 @@ bool comm_unescape_data(uint8_t *dest, const uint8_t *src, uint8_t length, uint8
     return true;
 }
 
+/**
+ * Enable or disable payload compression for USB packet frames
+ * @param enabled true to compress
+ */
+void comm_set_compression(bool enabled) {
+    compression_enabled = enabled;
+    repeat_valid = false;
+}
+
+/**
+ * Check whether payload compression is enabled
+ * @return true if enabled
+ */
+bool comm_compression_enabled(void) {
+    return compression_enabled;
+}
+
+/**
+ * Run-length encode data (PackBits style)
+ * Control byte 0x00-0x7F: 1-128 literal bytes follow
+ * Control byte 0x80-0xFE: next byte repeated 3-129 times
+ * @param dest Destination buffer
+ * @param limit Maximum output length
+ * @param src Source data
+ * @param length Source length
+ * @return Encoded length, 0 if it would not fit in limit
+ */
+uint8_t comm_compress_data(uint8_t *dest, uint8_t limit, const uint8_t *src, uint8_t length) {
+    uint8_t in = 0;
+    uint8_t out = 0;
+    
+    while (in < length) {
+        // Measure the run starting here
+        uint8_t run = 1;
+        while ((uint16_t)in + run < length && src[in + run] == src[in] && run < 129) {
+            run++;
+        }
+        
+        if (run >= 3) {
+            if ((uint16_t)out + 2 > limit) {
+                return 0;
+            }
+            dest[out++] = 0x80 + (run - 3);
+            dest[out++] = src[in];
+            in += run;
+            continue;
+        }
+        
+        // Literal block up to the next run of three
+        uint8_t start = in;
+        uint8_t literal = 0;
+        
+        while (in < length && literal < 128) {
+            if ((uint16_t)in + 2 < length && src[in] == src[in + 1] && src[in] == src[in + 2]) {
+                break;
+            }
+            in++;
+            literal++;
+        }
+        
+        if ((uint16_t)out + 1 + literal > limit) {
+            return 0;
+        }
+        dest[out++] = literal - 1;
+        memcpy(&dest[out], &src[start], literal);
+        out += literal;
+    }
+    
+    return out;
+}
+
 /**
  * Send USB packet to host
  * @param data USB packet data
- * @param length Data length
+ * @param length Data length to send
+ * @param orig_length Captured data length, larger than length if truncated
  * @param timestamp Packet timestamp
  * @param pid USB PID
+ * @param dev_addr Device address
+ * @param endpoint Endpoint number
+ * @param flags COMM_USB_FLAG_CRC_VALID or 0
  * @return true if successful
  */
-bool comm_send_usb_packet(const uint8_t *data, uint8_t length, uint32_t timestamp, uint8_t pid) {
+bool comm_send_usb_packet(const uint8_t *data, uint8_t length, uint16_t orig_length, uint32_t timestamp,
+                          uint8_t pid, uint8_t dev_addr, uint8_t endpoint, uint8_t flags) {
+    uint8_t header_length = COMM_USB_HEADER_SIZE;
+    
+    if (orig_length > length) {
+        flags |= COMM_USB_FLAG_TRUNCATED;
+        header_length += 2;
+    }
+    
+    if (length > COMM_MAX_PACKET_SIZE - header_length) {
+        return false;
+    }
+    
     // Create a buffer for the packet data
-    uint8_t packet_data[8 + length];
+    uint8_t packet_data[header_length + length];
+    uint8_t data_length = length;
+    bool repeat = false;
     
     // Add timestamp (4 bytes, big endian)
     packet_data[0] = (timestamp >> 24) & 0xFF;
@@ -422,21 +754,62 @@ bool comm_send_usb_packet(const uint8_t *data, uint8_t length, uint32_t timestam
     packet_data[2] = (timestamp >> 8) & 0xFF;
     packet_data[3] = timestamp & 0xFF;
     
-    // Add PID
+    // Add PID, device address and endpoint
     packet_data[4] = pid;
+    packet_data[5] = dev_addr;
+    packet_data[6] = endpoint;
+    
+    // Add original length (2 bytes, big endian) if the data was cut short
+    if (flags & COMM_USB_FLAG_TRUNCATED) {
+        packet_data[8] = (orig_length >> 8) & 0xFF;
+        packet_data[9] = orig_length & 0xFF;
+    }
+    
+    if (compression_enabled && length > 0) {
+        // Identical to the last data sent on this address/endpoint?
+        repeat = repeat_valid && repeat_length == length &&
+                 repeat_addr == dev_addr && repeat_endpoint == endpoint &&
+                 memcmp(repeat_slot, data, length) == 0;
+        
+        if (repeat) {
+            flags |= COMM_USB_FLAG_REPEAT;
+            data_length = 0;
+        } else {
+            // Only keep the encoded form if it is strictly smaller
+            uint8_t encoded = comm_compress_data(&packet_data[header_length], length - 1, data, length);
+            
+            if (encoded > 0) {
+                flags |= COMM_USB_FLAG_COMPRESSED;
+                data_length = encoded;
+            }
+        }
+    }
     
-    // Add reserved bytes
-    packet_data[5] = 0;
-    packet_data[6] = 0;
-    packet_data[7] = 0;
+    // Add flags and raw packet data
+    packet_data[7] = flags;
     
-    // Add packet data
-    if (length > 0) {
-        memcpy(&packet_data[8], data, length);
+    if (data_length > 0 && !(flags & COMM_USB_FLAG_COMPRESSED)) {
+        memcpy(&packet_data[header_length], data, length);
     }
     
     // Send packet
-    return comm_send_packet(PACKET_TYPE_USB_PACKET, packet_data, 8 + length);
+    if (!comm_send_packet(PACKET_TYPE_USB_PACKET, packet_data, header_length + data_length)) {
+        return false;
+    }
+    
+    // Only data the host has actually been sent may be referenced later
+    if (compression_enabled && length > 0 && !repeat) {
+        repeat_valid = length <= COMM_REPEAT_SLOT_SIZE;
+        
+        if (repeat_valid) {
+            memcpy(repeat_slot, data, length);
+            repeat_length = length;
+            repeat_addr = dev_addr;
+            repeat_endpoint = endpoint;
+        }
+    }
+    
+    return true;
 }
 
 /**
@@ -444,16 +817,20 @@ bool comm_send_usb_packet(const uint8_t *data, uint8_t length, uint32_t timestam
  * @param device_count Number of connected devices
  * @param capture_state Current capture state
  * @param buffer_usage Buffer usage percentage
+ * @param loop_latency_us Worst-case main loop pass in microseconds
  */
-void comm_send_status_report(uint8_t device_count, uint8_t capture_state, uint16_t buffer_usage) {
-    uint8_t status_data[4];
+void comm_send_status_report(uint8_t device_count, uint8_t capture_state, uint16_t buffer_usage,
+                             uint16_t loop_latency_us) {
+    uint8_t status_data[6];
     
     status_data[0] = device_count;
     status_data[1] = capture_state;
     status_data[2] = (buffer_usage >> 8) & 0xFF;
     status_data[3] = buffer_usage & 0xFF;
+    status_data[4] = (loop_latency_us >> 8) & 0xFF;
+    status_data[5] = loop_latency_us & 0xFF;
     
-    comm_send_packet(PACKET_TYPE_STATUS_REPORT, status_data, 4);
+    comm_send_packet(PACKET_TYPE_STATUS_REPORT, status_data, sizeof(status_data));
 }
 
 /**
@@ -477,11 +854,41 @@ void comm_send_error(error_code_t error_code, uint8_t context) {
 static void process_rx_byte(uint8_t byte) {
     static bool escape_next = false;
     static uint8_t unescaped_byte;
+    static uint16_t rx_crc;
+    static uint16_t received_crc;
+    static volatile comm_packet_t *rx_slot;
+    
+    // An unescaped sync byte always starts a frame, whatever came before
+    if (byte == COMM_SYNC_BYTE) {
+        // Nowhere to put it, the host retransmits once its timeout expires
+        if ((uint8_t)(cmd_queue_head - cmd_queue_tail) >= COMM_CMD_QUEUE_DEPTH) {
+            rx_state = PROTO_STATE_WAIT_SYNC;
+            return;
+        }
+        
+        // An abandoned partial frame simply gets overwritten
+        rx_slot = &cmd_queue[cmd_queue_head & CMD_QUEUE_MASK];
+        rx_state = PROTO_STATE_TYPE;
+        rx_data_count = 0;
+        rx_crc = CRC_CCITT_INIT;
+        escape_next = false;
+        return;
+    }
+    
+    if (rx_state == PROTO_STATE_WAIT_SYNC) {
+        return;
+    }
     
     // Handle escape sequence
     if (escape_next) {
-        unescaped_byte = byte ^ 0xFF;
+        unescaped_byte = byte ^ COMM_ESCAPE_XOR;
         escape_next = false;
+        
+        // Anything but an escaped framing byte is line noise, drop the frame
+        if (unescaped_byte != COMM_SYNC_BYTE && unescaped_byte != COMM_ESCAPE_BYTE) {
+            rx_state = PROTO_STATE_WAIT_SYNC;
+            return;
+        }
     } else if (byte == COMM_ESCAPE_BYTE) {
         escape_next = true;
         return;
@@ -492,26 +899,24 @@ static void process_rx_byte(uint8_t byte) {
     // Process based on current state
     switch (rx_state) {
         case PROTO_STATE_WAIT_SYNC:
-            if (byte == COMM_SYNC_BYTE) {
-                // Found sync byte, move to next state
-                rx_state = PROTO_STATE_TYPE;
-                rx_data_count = 0;
-            }
             break;
-            
+        
         case PROTO_STATE_TYPE:
-            rx_packet.type = unescaped_byte;
+            rx_crc = crc_ccitt_byte(rx_crc, unescaped_byte);
+            rx_slot->type = unescaped_byte;
             rx_state = PROTO_STATE_LENGTH;
             break;
-            
+        
         case PROTO_STATE_LENGTH:
-            rx_packet.length = unescaped_byte;
+            rx_crc = crc_ccitt_byte(rx_crc, unescaped_byte);
+            rx_slot->length = unescaped_byte;
             rx_packet_length = unescaped_byte;
             rx_state = PROTO_STATE_SEQUENCE;
             break;
-            
+        
         case PROTO_STATE_SEQUENCE:
-            rx_packet.sequence = unescaped_byte;
+            rx_crc = crc_ccitt_byte(rx_crc, unescaped_byte);
+            rx_slot->sequence = unescaped_byte;
             
             if (rx_packet_length > 0) {
                 rx_state = PROTO_STATE_DATA;
@@ -519,46 +924,45 @@ static void process_rx_byte(uint8_t byte) {
                 rx_state = PROTO_STATE_CRC_HIGH;
             }
             break;
-            
+        
         case PROTO_STATE_DATA:
-            if (rx_data_count < COMM_MAX_PACKET_SIZE) {
-                rx_packet.data[rx_data_count++] = unescaped_byte;
+            rx_crc = crc_ccitt_byte(rx_crc, unescaped_byte);
+            
+            // Oversized payloads are still checked, then NACKed
+            if (rx_data_count < COMM_MAX_COMMAND_SIZE) {
+                rx_slot->data[rx_data_count] = unescaped_byte;
             }
+            rx_data_count++;
             
             if (rx_data_count >= rx_packet_length) {
                 rx_state = PROTO_STATE_CRC_HIGH;
             }
             break;
-            
+        
         case PROTO_STATE_CRC_HIGH:
-            rx_packet.crc = unescaped_byte << 8;
+            received_crc = unescaped_byte << 8;
             rx_state = PROTO_STATE_CRC_LOW;
             break;
-            
+        
         case PROTO_STATE_CRC_LOW:
-            rx_packet.crc |= unescaped_byte;
-            
-            // Verify CRC
-            uint8_t header[3] = {rx_packet.type, rx_packet.length, rx_packet.sequence};
-            uint16_t calculated_crc = comm_calculate_crc(header, 3);
-            calculated_crc = comm_calculate_crc_continue(rx_packet.data, rx_packet.length, calculated_crc);
+            received_crc |= unescaped_byte;
             
-            if (calculated_crc == rx_packet.crc) {
-                // Valid packet received
-                if (rx_packet.type & 0x80) {
-                    // This is a data packet, not a command
-                    // Process immediately
-                    comm_process_command(&rx_packet);
-                } else {
-                    // This is a command packet from host
-                    // Set flag for main loop to handle
-                    packet_ready = true;
+            // The CRC was accumulated as the bytes came in
+            if (rx_crc == received_crc) {
+                if (rx_packet_length > COMM_MAX_COMMAND_SIZE) {
+                    rx_slot->type = PACKET_TYPE_NACK;
+                    rx_slot->data[0] = ERR_INVALID_COMMAND;
                 }
             } else {
-                // Send NACK for invalid CRC
-                comm_send_nack(rx_packet.sequence, ERR_CRC_FAILURE);
+                // NACK the invalid CRC from the main loop, not from here
+                rx_slot->type = PACKET_TYPE_NACK;
+                rx_slot->data[0] = ERR_CRC_FAILURE;
             }
             
+            // Hand the slot to the main loop
+            rx_slot->crc = received_crc;
+            cmd_queue_head++;
+            
             // Reset state machine
             rx_state = PROTO_STATE_WAIT_SYNC;
             break;
@@ -571,19 +975,35 @@ static void process_rx_byte(uint8_t byte) {
  * UART RX Complete interrupt handler
  */
 ISR(USART_RX_vect) {
+    // Status must be read before the data register
+    bool frame_error = UCSR0A & (1 << FE0);
     uint8_t data = UDR0;
     
+    // A host stuck at another rate only produces framing errors, fall back
+    // to the boot rate so it can reconnect. Scattered line noise during a
+    // long capture never adds up, one clean byte starts the count over.
+    if (!frame_error) {
+        rx_frame_errors = 0;
+    } else if (++rx_frame_errors >= COMM_LINK_FALLBACK_ERRORS) {
+        rx_frame_errors = 0;
+        
+        if (link_baud != BAUD) {
+            uint16_t ubrr = 0;
+            uart_calc_ubrr(BAUD, &ubrr);
+            uart_set_ubrr(ubrr);
+            link_baud = BAUD;
+        }
+    }
+    
     // Process received byte
     process_rx_byte(data);
-    
-    // Also store to RX buffer for debugging or additional processing
-    ringbuffer_push(&uart_rx_buffer, data);
 }
 
 /**
  * UART Data Register Empty interrupt handler
  */
 ISR(USART_UDRE_vect) {
+    PROFILE_BEGIN(PROFILE_ISR_UART_UDRE);
     uint8_t data;
     
     if (ringbuffer_pop(&uart_tx_buffer, &data)) {
@@ -593,4 +1013,21 @@ ISR(USART_UDRE_vect) {
         // Buffer is empty, disable interrupt
         UCSR0B &= ~(1 << UDRIE0);
     }
-} 
\ No newline at end of file
+    
+    PROFILE_END(PROFILE_ISR_UART_UDRE);
+}
+
+/**
+ * UART TX Complete interrupt handler - applies a pending link speed change
+ */
+ISR(USART_TX_vect) {
+    if (!link_ack_queued || !ringbuffer_empty(&uart_tx_buffer)) {
+        // Earlier traffic drained before the ACK went out, wait for the ACK
+        return;
+    }
+    
+    uart_set_ubrr(pending_ubrr);
+    link_baud = pending_baud;
+    link_ack_queued = false;
+    UCSR0B &= ~(1 << TXCIE0);
+}
@@ -5,12 +5,14 @@
 
 #include "../include/usb_interface.h"
 #include "../include/usb_protocol.h"
+#include "../include/usb_trigger.h"
+#include "../include/scheduler.h"
+#include "../include/profile.h"
 #include "../include/ringbuffer.h"
 #include "../include/comm_protocol.h"
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/wdt.h>
-#include <util/delay.h>
 #include <string.h>
 #include <stdlib.h>
 
@@ -22,6 +24,16 @@
 #define LED_PORT     PORTB
 #define LED_DDR      DDRB
 
+/* Main loop timing */
+#define CAPTURE_BUDGET        10    // Packets decoded per capture task run
+#define BUS_STATE_PERIOD_MS   10
+#define BUS_EVENT_TX_RESERVE  40    // Escaped STATE_CHANGE plus status report frames
+#define LED_PERIOD_MS         10
+#define STATUS_PERIOD_MS      1000
+#define ACTIVITY_LED_MS       100
+#define RESET_BLINK_MS        100   // Length of each phase of the reset blink
+#define RESET_BLINK_PHASES    4     // On, off, on, off
+
 /* Program states */
 typedef enum {
     STATE_INIT,
@@ -35,9 +47,9 @@ static volatile program_state_t current_state = STATE_INIT;
 static volatile uint32_t activity_timestamp = 0;
 static volatile uint8_t error_code = 0;
 static volatile bool usb_activity = false;
-static volatile uint32_t idle_counter = 0;
+static uint32_t reset_blink_start = 0;
+static bool reset_blink_active = false;
 static volatile uint16_t buffer_usage = 0;
-static volatile bool usb_reset_flag = false;
 
 /* Monitoring configuration */
 static usb_monitor_config_t default_config = {
@@ -52,6 +64,32 @@ static usb_monitor_config_t default_config = {
     .filter_out = false
 };
 
+/**
+ * Decode a monitor configuration sent by the host
+ * @param data Payload in the COMM_MONITOR_CONFIG_SIZE wire layout
+ * @param length Payload length
+ * @param config Configuration to fill
+ * @return true if successful, false if the payload is too short
+ */
+static bool decode_monitor_config(const uint8_t *data, uint8_t length, usb_monitor_config_t *config) {
+    // The struct layout depends on the compiler, the wire layout does not
+    if (length < COMM_MONITOR_CONFIG_SIZE) {
+        return false;
+    }
+    
+    config->speed = (data[0] == USB_SPEED_LOW) ? USB_SPEED_LOW : USB_SPEED_FULL;
+    config->capture_control = data[1] != 0;
+    config->capture_bulk = data[2] != 0;
+    config->capture_interrupt = data[3] != 0;
+    config->capture_isoc = data[4] != 0;
+    config->addr_filter = data[5];
+    config->ep_filter = data[6];
+    config->filter_in = data[7] != 0;
+    config->filter_out = data[8] != 0;
+    
+    return true;
+}
+
 /**
  * Initialize hardware
  */
@@ -68,6 +106,9 @@ static void hardware_init(void) {
     // Initialize communication protocol
     comm_init();
     
+    // Start the cycle counter (PROFILE=1 builds only)
+    profile_init();
+    
     // Setup watchdog timer
     wdt_enable(WDTO_1S);
 }
@@ -80,26 +121,32 @@ static void send_initial_status(void) {
     uint8_t device_count = usb_get_device_count();
     
     // Send status report
-    comm_send_status_report(device_count, 0, 0);
+    comm_send_status_report(device_count, 0, 0, 0);
 }
 
 /**
- * Handle incoming USB packets
+ * Handle incoming USB packets (capture task)
+ * @return true if the capture ring still holds packets
  */
-static void process_usb_packets(void) {
+static bool process_usb_packets(void) {
     usb_packet_t packet;
     uint8_t packets_processed = 0;
     
-    // Process up to 10 packets at a time to avoid blocking too long
-    while (packets_processed < 10 && usb_capture_packet(&packet)) {
-        usb_process_packet(&packet);
-        
+    if (current_state != STATE_MONITORING) {
+        return false;
+    }
+    
+    // Decode a bounded batch, the scheduler comes back if more are waiting.
+    // usb_capture_packet() already runs the packet through the filter pipeline.
+    while (packets_processed < CAPTURE_BUDGET && usb_capture_packet(&packet)) {
         // Update activity indicator
         usb_activity = true;
         activity_timestamp = usb_get_timestamp();
         
         packets_processed++;
     }
+    
+    return packets_processed == CAPTURE_BUDGET;
 }
 
 /**
@@ -113,53 +160,59 @@ static void handle_command_packet(const comm_packet_t *packet) {
             usb_monitor_disable();
             comm_send_ack(packet->sequence);
             break;
-            
+        
         case PACKET_TYPE_CMD_START_CAPTURE:
             // Start capturing with default or provided config
-            if (packet->length >= sizeof(usb_monitor_config_t)) {
-                // Use configuration provided in packet
+            {
                 usb_monitor_config_t config;
-                memcpy(&config, packet->data, sizeof(usb_monitor_config_t));
-                usb_monitor_enable(&config);
-            } else {
-                // Use default configuration
-                usb_monitor_enable(&default_config);
+                
+                if (decode_monitor_config(packet->data, packet->length, &config)) {
+                    // Use configuration provided in packet
+                    usb_monitor_enable(&config);
+                } else {
+                    // Use default configuration
+                    usb_monitor_enable(&default_config);
+                }
             }
             current_state = STATE_MONITORING;
+            
+            // Every capture starts with an empty pre-trigger window
+            usb_trigger_rearm();
             comm_send_ack(packet->sequence);
             break;
-            
+        
         case PACKET_TYPE_CMD_STOP_CAPTURE:
             // Stop capturing
             usb_monitor_disable();
             current_state = STATE_IDLE;
             comm_send_ack(packet->sequence);
             break;
-            
+        
         case PACKET_TYPE_CMD_SET_FILTER:
             // Set packet filters
-            if (packet->length >= sizeof(usb_monitor_config_t)) {
-                // Update filter configuration
-                memcpy(&default_config, packet->data, sizeof(usb_monitor_config_t));
-                
-                // Apply immediately if monitoring is active
-                if (current_state == STATE_MONITORING) {
-                    usb_monitor_enable(&default_config);
-                }
+            if (!decode_monitor_config(packet->data, packet->length, &default_config)) {
+                comm_send_nack(packet->sequence, ERR_INVALID_COMMAND);
+                break;
+            }
+            
+            // A running capture switches over at the next packet boundary
+            if (current_state == STATE_MONITORING) {
+                usb_monitor_set_filter(&default_config);
             }
             comm_send_ack(packet->sequence);
             break;
-            
+        
         case PACKET_TYPE_CMD_GET_STATUS:
             // Send status report to host
             {
                 uint8_t device_count = usb_get_device_count();
                 uint8_t capture_state = (current_state == STATE_MONITORING) ? 1 : 0;
-                comm_send_status_report(device_count, capture_state, buffer_usage);
+                comm_send_status_report(device_count, capture_state, buffer_usage,
+                                        scheduler_get_max_latency(false));
                 comm_send_ack(packet->sequence);
             }
             break;
-            
+        
         case PACKET_TYPE_CMD_SET_TIMESTAMP:
             // Reset timestamp counter
             if (packet->length >= 4) {
@@ -168,7 +221,16 @@ static void handle_command_packet(const comm_packet_t *packet) {
             }
             comm_send_ack(packet->sequence);
             break;
+        
+        case PACKET_TYPE_CMD_SET_CONFIG:
+            // Every SET_CONFIG key is handled by the comm layer
+            if (comm_handle_config(packet)) {
+                break;
+            }
             
+            comm_send_nack(packet->sequence, ERR_INVALID_COMMAND);
+            break;
+        
         default:
             // Unknown command
             comm_send_nack(packet->sequence, ERR_INVALID_COMMAND);
@@ -177,16 +239,31 @@ static void handle_command_packet(const comm_packet_t *packet) {
 }
 
 /**
- * Update status LEDs
+ * Update status LEDs (housekeeping task)
+ * @return false, LEDs never have work left over
  */
-static void update_leds(void) {
-    // Activity LED - blink on USB traffic
-    if (usb_activity) {
+static bool update_leds(void) {
+    uint32_t now = usb_get_timestamp();
+    
+    if (reset_blink_active) {
+        // Bus reset blink runs from the timestamp instead of delays
+        uint32_t phase = (now - reset_blink_start) / ((uint32_t)RESET_BLINK_MS * SCHED_TICKS_PER_MS);
+        
+        if (phase >= RESET_BLINK_PHASES) {
+            reset_blink_active = false;
+            LED_PORT &= ~(1 << LED_ACTIVITY);
+        } else if (phase % 2 == 0) {
+            LED_PORT |= (1 << LED_ACTIVITY);
+        } else {
+            LED_PORT &= ~(1 << LED_ACTIVITY);
+        }
+    } else if (usb_activity) {
+        // Activity LED - blink on USB traffic
         LED_PORT |= (1 << LED_ACTIVITY);
         
         // Clear flag, will be set again if there's more activity
         usb_activity = false;
-    } else if (usb_get_timestamp() - activity_timestamp > 100000) {
+    } else if (now - activity_timestamp > (uint32_t)ACTIVITY_LED_MS * SCHED_TICKS_PER_MS) {
         // Turn off after 100ms of no activity
         LED_PORT &= ~(1 << LED_ACTIVITY);
     }
@@ -201,7 +278,7 @@ static void update_leds(void) {
     // Error LED - on when in error state
     if (current_state == STATE_ERROR) {
         // Blink to indicate error code
-        if ((idle_counter / 50000) % 10 < error_code) {
+        if ((now / (200UL * SCHED_TICKS_PER_MS)) % 10 < error_code) {
             LED_PORT |= (1 << LED_ERROR);
         } else {
             LED_PORT &= ~(1 << LED_ERROR);
@@ -209,6 +286,8 @@ static void update_leds(void) {
     } else {
         LED_PORT &= ~(1 << LED_ERROR);
     }
+    
+    return false;
 }
 
 /**
@@ -216,21 +295,99 @@ static void update_leds(void) {
  */
 static void handle_usb_reset(void) {
     // In real implementation, this would reset the state of the monitored USB bus
-    usb_reset_flag = false;
-    
-    // Flash the USB activity LED to indicate reset
-    LED_PORT |= (1 << LED_ACTIVITY);
-    _delay_ms(100);
-    LED_PORT &= ~(1 << LED_ACTIVITY);
-    _delay_ms(100);
-    LED_PORT |= (1 << LED_ACTIVITY);
-    _delay_ms(100);
-    LED_PORT &= ~(1 << LED_ACTIVITY);
+    // Flash the USB activity LED to indicate reset, update_leds() runs the blink
+    reset_blink_start = usb_get_timestamp();
+    reset_blink_active = true;
     
     // Send status update to host
     uint8_t device_count = usb_get_device_count();
     uint8_t capture_state = (current_state == STATE_MONITORING) ? 1 : 0;
-    comm_send_status_report(device_count, capture_state, buffer_usage);
+    comm_send_status_report(device_count, capture_state, buffer_usage, scheduler_get_max_latency(false));
+}
+
+/**
+ * Flush deferred frames (TX task)
+ * @return false, the trigger flush resumes on the next pass
+ */
+static bool flush_tx(void) {
+    // Flush a fired trigger window as the link allows
+    usb_trigger_task();
+    
+    return false;
+}
+
+/**
+ * Process the next queued command from the host (command task)
+ * @return true if more pipelined commands may be waiting
+ */
+static bool poll_commands(void) {
+    // Handled in place in its queue slot, once its replies fit whole
+    const comm_packet_t *packet = comm_receive_packet();
+    
+    if (packet == NULL) {
+        return false;
+    }
+    
+    handle_command_packet(packet);
+    comm_release_packet();
+    
+    return true;
+}
+
+/**
+ * Forward queued bus events to the host (housekeeping task)
+ * @return true if events are left waiting for UART buffer space
+ */
+static bool process_bus_events(void) {
+    usb_event_t event;
+    
+    // Only take an event off the ring once its frames fit whole
+    while (comm_tx_free() >= BUS_EVENT_TX_RESERVE) {
+        if (!usb_get_event(&event)) {
+            return false;
+        }
+        
+        if (event.type == USB_EVENT_ATTACHED) {
+            uint8_t event_data[2] = {event.type, event.arg};
+            comm_send_packet(PACKET_TYPE_USB_STATE_CHANGE, event_data, 2);
+        } else {
+            uint8_t event_data[1] = {event.type};
+            comm_send_packet(PACKET_TYPE_USB_STATE_CHANGE, event_data, 1);
+        }
+        
+        if (event.type == USB_EVENT_RESET) {
+            handle_usb_reset();
+        }
+    }
+    
+    return true;
+}
+
+/**
+ * Send periodic status update (housekeeping task)
+ * @return false, runs on its period
+ */
+static bool send_periodic_status(void) {
+    uint8_t device_count = usb_get_device_count();
+    uint8_t capture_state = (current_state == STATE_MONITORING) ? 1 : 0;
+    
+    // Calculate buffer usage as percentage
+    // In real implementation, this would measure actual buffer usage
+    if (current_state == STATE_MONITORING) {
+        // Simulate varying buffer usage for testing
+        buffer_usage = (buffer_usage + 7) % 100;
+    } else {
+        buffer_usage = 0;
+    }
+    
+    // Report the worst loop latency of the last period, then start over
+    comm_send_status_report(device_count, capture_state, buffer_usage, scheduler_get_max_latency(true));
+    
+    // Section cycle counts follow in PROFILE=1 builds, a busy UART just
+    // lets them accumulate until the next period
+    (void)profile_send_report();
+    
+    return false;
 }
 
 /**
@@ -260,54 +417,20 @@ int main(void) {
     default_config.filter_in = false;      // Don't filter IN transfers
     default_config.filter_out = false;     // Don't filter OUT transfers
     
+    // Register main loop tasks, highest priority first
+    scheduler_init();
+    scheduler_add_task(process_usb_packets, SCHED_PRIO_CAPTURE, 0);
+    scheduler_add_task(flush_tx, SCHED_PRIO_TX, 0);
+    scheduler_add_task(poll_commands, SCHED_PRIO_COMMAND, 0);
+    scheduler_add_task(process_bus_events, SCHED_PRIO_HOUSEKEEPING, BUS_STATE_PERIOD_MS);
+    scheduler_add_task(update_leds, SCHED_PRIO_HOUSEKEEPING, LED_PERIOD_MS);
+    scheduler_add_task(send_periodic_status, SCHED_PRIO_HOUSEKEEPING, STATUS_PERIOD_MS);
+    
     while (1) {
         // Reset watchdog
         wdt_reset();
         
-        // Check for USB bus reset
-        if (usb_reset_flag) {
-            handle_usb_reset();
-        }
-        
-        // Check USB bus state
-        if (!usb_detect_bus_state()) {
-            // No USB power detected, reset device count
-            // This is handled in usb_detect_bus_state()
-        }
-        
-        // Process any captured USB packets
-        if (current_state == STATE_MONITORING) {
-            process_usb_packets();
-        }
-        
-        // Process any command packets from host
-        comm_packet_t rx_packet;
-        if (comm_receive_packet(&rx_packet)) {
-            handle_command_packet(&rx_packet);
-        }
-        
-        // Update status LEDs
-        update_leds();
-        
-        // Update idle counter (used for timing certain operations)
-        idle_counter++;
-        
-        // Send periodic status update (every ~1 second)
-        if (idle_counter % 100000 == 0) {
-            uint8_t device_count = usb_get_device_count();
-            uint8_t capture_state = (current_state == STATE_MONITORING) ? 1 : 0;
-            
-            // Calculate buffer usage as percentage
-            // In real implementation, this would measure actual buffer usage
-            if (current_state == STATE_MONITORING) {
-                // Simulate varying buffer usage for testing
-                buffer_usage = (buffer_usage + 7) % 100;
-            } else {
-                buffer_usage = 0;
-            }
-            
-            comm_send_status_report(device_count, capture_state, buffer_usage);
-        }
+        scheduler_run_once();
     }
     
     return 0;  // Never reached
@@ -0,0 +1,187 @@
+/**
+ * USBShark - Military-grade USB protocol analyzer
+ * Profiling Implementation
+ *
+ * Timer0 runs at the CPU clock and its overflows extend it to a 24-bit
+ * cycle counter. Each section accumulates count, min, max and total cycles
+ * between reports. Times are inclusive: nested sections and interrupts that
+ * hit a section count towards it. An interrupt section longer than 512
+ * cycles under-counts, its own blocked overflow is only caught once.
+ */
+
+#ifdef USBSHARK_PROFILE
+
+#include "../include/profile.h"
+#include "../include/comm_protocol.h"
+#include "../include/crc.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <string.h>
+
+/* Per-section statistics */
+typedef struct {
+    uint16_t count;
+    uint16_t min;
+    uint16_t max;
+    uint32_t total;
+} profile_stats_t;
+
+static profile_stats_t profile_stats[PROFILE_SECTION_COUNT];
+static volatile uint16_t profile_overflows = 0;
+
+/* Cycles taken by an empty PROFILE_BEGIN/PROFILE_END pair */
+static uint16_t profile_overhead = 0;
+
+/**
+ * Reset all section statistics
+ */
+static void profile_reset(void) {
+    memset(profile_stats, 0, sizeof(profile_stats));
+    
+    for (uint8_t i = 0; i < PROFILE_SECTION_COUNT; i++) {
+        profile_stats[i].min = 0xFFFF;
+    }
+}
+
+/**
+ * Initialize profiling, starts Timer0 at the CPU clock
+ */
+void profile_init(void) {
+    TCCR0A = 0;               // Normal mode
+    TCCR0B = (1 << CS00);     // No prescaler, one tick per cycle
+    TCNT0 = 0;
+    TIMSK0 |= (1 << TOIE0);   // Enable overflow interrupt
+    
+    // Measure the bracket itself so reports show the section alone
+    profile_overhead = 0;
+    profile_reset();
+    PROFILE_BEGIN(PROFILE_ISR_INT0);
+    PROFILE_END(PROFILE_ISR_INT0);
+    profile_overhead = profile_stats[PROFILE_ISR_INT0].min;
+    profile_reset();
+}
+
+/**
+ * Read the cycle counter
+ * @return Cycles since profile_init(), wraps every 2^24 cycles
+ */
+uint32_t profile_cycles(void) {
+    uint8_t sreg = SREG;
+    cli();
+    
+    uint16_t overflows = profile_overflows;
+    uint8_t count = TCNT0;
+    
+    // Overflow pending but not yet serviced (interrupts off, or inside an ISR)
+    if ((TIFR0 & (1 << TOV0)) && count < 0xFF) {
+        overflows++;
+    }
+    
+    SREG = sreg;
+    
+    return ((uint32_t)overflows << 8) | count;
+}
+
+/**
+ * Account for one run of a section
+ * @param section Profiled section
+ * @param start profile_cycles() value at the start of the section
+ */
+void profile_record(profile_section_t section, uint32_t start) {
+    uint32_t cycles = (profile_cycles() - start) & 0x00FFFFFFUL;
+    profile_stats_t *stats = &profile_stats[section];
+    
+    cycles = (cycles > profile_overhead) ? cycles - profile_overhead : 0;
+    
+    uint8_t sreg = SREG;
+    cli();
+    
+    // Interrupt sections record into the same table
+    if (stats->count < 0xFFFF) {
+        uint16_t saturated = (cycles > 0xFFFF) ? 0xFFFF : (uint16_t)cycles;
+        
+        stats->count++;
+        stats->total += cycles;
+        if (saturated < stats->min) stats->min = saturated;
+        if (saturated > stats->max) stats->max = saturated;
+    }
+    
+    SREG = sreg;
+}
+
+/**
+ * Time both host frame CRC engines over the same block
+ */
+static void profile_crc_benchmark(void) {
+    uint8_t block[PROFILE_CRC_BENCH_SIZE];
+    
+    // Table lookups take the same time whatever the data
+    for (uint8_t i = 0; i < PROFILE_CRC_BENCH_SIZE; i++) {
+        block[i] = i;
+    }
+    
+    PROFILE_BEGIN(PROFILE_CRC_TABLE);
+    crc_ccitt_update_table(CRC_CCITT_INIT, block, PROFILE_CRC_BENCH_SIZE);
+    PROFILE_END(PROFILE_CRC_TABLE);
+    
+    PROFILE_BEGIN(PROFILE_CRC_NIBBLE);
+    crc_ccitt_update_nibble(CRC_CCITT_INIT, block, PROFILE_CRC_BENCH_SIZE);
+    PROFILE_END(PROFILE_CRC_NIBBLE);
+}
+
+/**
+ * Send the statistics of every section and start a new window
+ * @return true if successful, false if the report did not fit the UART buffer
+ */
+bool profile_send_report(void) {
+    uint8_t data[PROFILE_SECTION_COUNT * PROFILE_ENTRY_SIZE];
+    uint8_t length = 0;
+    
+    // A partial report would be worse than a late one
+    if (comm_tx_free() < sizeof(data) + 16) {
+        return false;
+    }
+    
+    profile_crc_benchmark();
+    
+    // Take the window and start a new one, the divisions run with interrupts on
+    profile_stats_t window[PROFILE_SECTION_COUNT];
+    uint8_t sreg = SREG;
+    cli();
+    
+    memcpy(window, profile_stats, sizeof(window));
+    profile_reset();
+    
+    SREG = sreg;
+    
+    for (uint8_t i = 0; i < PROFILE_SECTION_COUNT; i++) {
+        const profile_stats_t *stats = &window[i];
+        uint16_t min = (stats->count > 0) ? stats->min : 0;
+        uint32_t avg = (stats->count > 0) ? stats->total / stats->count : 0;
+        
+        if (avg > 0xFFFF) {
+            avg = 0xFFFF;
+        }
+        
+        data[length++] = i;
+        data[length++] = (stats->count >> 8) & 0xFF;
+        data[length++] = stats->count & 0xFF;
+        data[length++] = (min >> 8) & 0xFF;
+        data[length++] = min & 0xFF;
+        data[length++] = (avg >> 8) & 0xFF;
+        data[length++] = avg & 0xFF;
+        data[length++] = (stats->max >> 8) & 0xFF;
+        data[length++] = stats->max & 0xFF;
+    }
+    
+    return comm_send_packet(PACKET_TYPE_PROFILE, data, length);
+}
+
+/**
+ * Timer0 Overflow interrupt handler, extends the cycle counter
+ */
+ISR(TIMER0_OVF_vect) {
+    profile_overflows++;
+}
+
+#endif /* USBSHARK_PROFILE */
@@ -0,0 +1,115 @@
+/**
+ * USBShark - Military-grade USB protocol analyzer
+ * Scheduler Implementation
+ *
+ * Every pass runs each due task once in priority order. Between two tasks,
+ * any higher-priority task that reported remaining work runs again, so the
+ * capture ring waits at most for one lower-priority task. No task may block.
+ */
+
+#include "../include/scheduler.h"
+#include "../include/usb_interface.h"
+
+/* Registered task */
+typedef struct {
+    sched_task_fn_t fn;
+    sched_priority_t priority;
+    uint32_t period_ticks;   // 0 = every pass
+    uint32_t last_run;
+    bool pending;            // Work left after the last run
+} sched_task_t;
+
+/* Task table, sorted by priority */
+static sched_task_t tasks[SCHED_MAX_TASKS];
+static uint8_t task_count = 0;
+
+/* Longest pass in timer ticks since the last reset */
+static uint32_t max_pass_ticks = 0;
+
+/**
+ * Initialize scheduler
+ */
+void scheduler_init(void) {
+    task_count = 0;
+    max_pass_ticks = 0;
+}
+
+/**
+ * Register a task
+ * @param fn Task function
+ * @param priority Task priority
+ * @param period_ms Minimum time between runs, 0 to run every pass
+ * @return true if successful, false if the task table is full
+ */
+bool scheduler_add_task(sched_task_fn_t fn, sched_priority_t priority, uint16_t period_ms) {
+    if (task_count >= SCHED_MAX_TASKS) {
+        return false;
+    }
+    
+    // Insert after tasks of the same or higher priority
+    uint8_t index = task_count;
+    while (index > 0 && tasks[index - 1].priority > priority) {
+        tasks[index] = tasks[index - 1];
+        index--;
+    }
+    
+    tasks[index].fn = fn;
+    tasks[index].priority = priority;
+    tasks[index].period_ticks = (uint32_t)period_ms * SCHED_TICKS_PER_MS;
+    tasks[index].last_run = usb_get_timestamp();
+    tasks[index].pending = false;
+    task_count++;
+    
+    return true;
+}
+
+/**
+ * Run one pass over all due tasks
+ */
+void scheduler_run_once(void) {
+    uint32_t pass_start = usb_get_timestamp();
+    
+    for (uint8_t i = 0; i < task_count; i++) {
+        sched_task_t *task = &tasks[i];
+        
+        // Unsigned difference also copes with usb_reset_timestamp()
+        if (task->period_ticks != 0) {
+            uint32_t now = usb_get_timestamp();
+            
+            if (now - task->last_run < task->period_ticks) {
+                continue;
+            }
+            task->last_run = now;
+        }
+        
+        task->pending = task->fn();
+        
+        // Higher-priority tasks with work left get another turn first
+        for (uint8_t j = 0; j < i; j++) {
+            if (tasks[j].pending) {
+                tasks[j].pending = tasks[j].fn();
+            }
+        }
+    }
+    
+    uint32_t pass_ticks = usb_get_timestamp() - pass_start;
+    
+    if (pass_ticks > max_pass_ticks && pass_ticks < 0x80000000UL) {
+        max_pass_ticks = pass_ticks;
+    }
+}
+
+/**
+ * Get the worst-case main loop latency
+ * @param reset true to start a new measurement window
+ * @return Longest pass in microseconds, saturated at 65535
+ */
+uint16_t scheduler_get_max_latency(bool reset) {
+    uint32_t us = max_pass_ticks * (1000UL / SCHED_TICKS_PER_MS);
+    
+    if (reset) {
+        max_pass_ticks = 0;
+    }
+    
+    return (us > 0xFFFF) ? 0xFFFF : (uint16_t)us;
+}
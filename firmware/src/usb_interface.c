@@ -7,8 +7,11 @@
 #include "../include/usb_protocol.h"
 #include "../include/ringbuffer.h"
 #include "../include/comm_protocol.h"
+#include "../include/usb_trigger.h"
+#include "../include/profile.h"
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <util/atomic.h>
 #include <util/delay.h>
 #include <string.h>
 
@@ -32,19 +35,41 @@
 #define USB_VSENSE_PORT PORTC
 #define USB_VSENSE_DDR  DDRC
 
+/* VBUS hysteresis thresholds in ADC counts (AVCC reference, 1023 = 5V) */
+#define VBUS_ON_LEVEL   800   // ~3.9V
+#define VBUS_OFF_LEVEL  700   // ~3.4V
+
+/* Debounce, in ADC samples (16MHz / 128 / 13 cycles = ~104us per sample) */
+#define VBUS_DEBOUNCE_SAMPLES  16    // ~1.7ms
+#define LINE_DEBOUNCE_SAMPLES  8     // ~0.8ms, far longer than any EOP
+#define LINE_DETACH_SAMPLES    1000  // ~104ms of SE0, longer than any bus reset
+
+/* Data line states seen by the ADC interrupt */
+typedef enum {
+    LINE_SE0,       // Both low: reset, or nothing attached
+    LINE_FS_IDLE,   // D+ high: full speed idle
+    LINE_LS_IDLE,   // D- high: low speed idle
+    LINE_SE1        // Both high: invalid
+} line_state_t;
+
 /* USB bit timing (in CPU cycles) */
 #define USB_FULL_SPEED_BIT_TIME  125  // 8MHz CPU / 12Mbps = 0.666us ≈ 5.33 cycles
 #define USB_LOW_SPEED_BIT_TIME   1000 // 8MHz CPU / 1.5Mbps = 5.33us ≈ 42.7 cycles
 
+/* Capture record in usb_packet_buffer: timestamp (4), flags, length,
+ * then length raw packet bytes starting with the PID */
+#define CAPTURE_RECORD_HEADER  6
+#define CAPTURE_FLAG_GAP       0x01  // Packets were dropped before this record
+
 /* USB Packet Buffer Size */
 #define USB_MAX_PACKET_SIZE 64
 #define USB_PACKET_BUFFER_SIZE 256
 
 /* USB states and buffers */
 static volatile usb_state_t usb_state = USB_STATE_DETACHED;
-static volatile usb_monitor_config_t monitor_config;
 static volatile bool monitoring_enabled = false;
 static volatile bool bus_reset_detected = false;
+static volatile bool vbus_present = false;
 static volatile uint8_t connected_devices = 0;
 static volatile bool packet_in_progress = false;
 static volatile uint8_t current_pid = 0;
@@ -52,13 +77,29 @@ static volatile uint8_t current_pid = 0;
 /* Timestamp counter using Timer1 */
 static volatile uint32_t timestamp_counter = 0;
 
-/* Ring buffer for USB packet data */
+/* Ring buffers for USB packet data and bus event records, both filled from
+ * interrupt context and drained by the main loop */
 static ringbuffer_t usb_packet_buffer;
 static ringbuffer_t usb_event_buffer;
 
 /* Temporary storage for packet data */
 static uint8_t packet_data_buffer[USB_MAX_PACKET_SIZE];
 static volatile uint8_t packet_data_length = 0;
+static volatile uint32_t packet_start_time = 0;
+
+/* Capture ring overflow tracking */
+static volatile bool capture_gap_pending = false;   // Producer: mark the next record
+static bool capture_gap = false;                    // Consumer: mark the next packet sent
+
+/* Monitor configuration, double buffered so the host can change filters
+ * during a capture: usb_monitor_set_filter() fills the inactive copy and
+ * usb_process_packet() switches over between two packets */
+static usb_monitor_config_t monitor_configs[2];
+static const usb_monitor_config_t *monitor_config = &monitor_configs[0];
+static bool monitor_filter_pending = false;
+
+/* TX space for an escaped PACKET_TYPE_FILTER_CHANGE frame */
+#define FILTER_CHANGE_TX_RESERVE (1 + 2 * (COMM_HEADER_SIZE - 1 + COMM_FILTER_CHANGE_SIZE + COMM_FOOTER_SIZE))
 
 /* USB transaction tracking */
 static volatile uint8_t last_token_pid = 0;
@@ -99,6 +140,12 @@ void usb_init(void) {
     ringbuffer_init(&usb_packet_buffer);
     ringbuffer_init(&usb_event_buffer);
     
+    // Send full data stages until the host sets a snap length
+    usb_snaplen_init();
+    
+    // Trigger mode off until the host configures one
+    usb_trigger_init();
+    
     // Configure external interrupt on D+ for USB state change detection
     EICRA |= (1 << ISC00);    // Any logical change on INT0 generates interrupt
     EIMSK |= (1 << INT0);     // Enable INT0 interrupt
@@ -109,84 +156,78 @@ void usb_init(void) {
     TCNT1 = 0;                            // Reset counter
     TIMSK1 |= (1 << TOIE1);               // Enable overflow interrupt
     
-    // Initialize ADC for voltage sensing
+    // Initialize ADC for voltage sensing, free running with the complete
+    // interrupt doing bus state detection
     ADMUX = (1 << REFS0) | (USB_VSENSE_PIN & 0x07); // AVCC reference, channel 0
-    ADCSRA = (1 << ADEN) | (1 << ADPS2) | (1 << ADPS1) | (1 << ADPS0); // Enable ADC, prescaler 128
+    ADCSRB = 0;                                      // Free running trigger source
+    ADCSRA = (1 << ADEN) | (1 << ADATE) | (1 << ADIE) |
+             (1 << ADPS2) | (1 << ADPS1) | (1 << ADPS0); // Enable ADC, prescaler 128
+    ADCSRA |= (1 << ADSC);                           // Start the first conversion
     
     // Initialize USB protocol module
     usb_protocol_init();
-    
-    // Initial bus state detection
-    usb_detect_bus_state();
 }
 
 /**
- * Detect USB bus state by checking voltage on D+ and D-
+ * Get the debounced bus power state
+ * The ADC-complete interrupt tracks VBUS and the data lines and queues
+ * attach, detach and reset events, so this never touches the ADC
  * @return true if bus powered, false otherwise
  */
 bool usb_detect_bus_state(void) {
-    bool bus_powered = false;
+    return vbus_present;
+}
+
+/**
+ * Queue a bus event record, called from interrupt context
+ * Records are pushed whole or not at all. Interrupts do not nest, so the
+ * edge and ADC handlers never interleave their records
+ * @param type Event type
+ * @param arg Event argument
+ */
+static void usb_queue_event(usb_event_type_t type, uint8_t arg) {
+    if (ringbuffer_free(&usb_event_buffer) < USB_EVENT_RECORD_SIZE) {
+        usb_event_buffer.overflow_count++;
+        return;
+    }
     
-    // Start ADC conversion
-    ADCSRA |= (1 << ADSC);
-    while (ADCSRA & (1 << ADSC)); // Wait for conversion to complete
+    ringbuffer_push(&usb_event_buffer, type);
+    ringbuffer_push(&usb_event_buffer, arg);
+}
+
+/**
+ * Queue a bus reset event, called from interrupt context
+ * The edge and ADC interrupts can both see the same reset, only the first
+ * one is queued until the bus idles again
+ */
+static void usb_queue_reset(void) {
+    if (bus_reset_detected) {
+        return;
+    }
     
-    // Check if USB voltage is present (>4V - ADC value ~800 at 5V reference)
-    if (ADC > 800) {
-        bus_powered = true;
-        
-        // Check for device presence by examining D+ and D- states
-        uint8_t data_pins = usb_read_data_pins();
-        bool dp_high = data_pins & (1 << USB_DP_PIN);
-        bool dm_high = data_pins & (1 << USB_DM_PIN);
-        
-        // Full speed device pulls D+ high, low speed pulls D- high
-        if (dp_high && !dm_high) {
-            // Full speed device detected
-            if (usb_state < USB_STATE_ATTACHED) {
-                usb_state = USB_STATE_ATTACHED;
-                connected_devices++;
-                
-                // Send device connection event to host
-                uint8_t event_data[2] = {1, USB_SPEED_FULL};
-                comm_send_packet(PACKET_TYPE_USB_STATE_CHANGE, event_data, 2);
-            }
-        } else if (!dp_high && dm_high) {
-            // Low speed device detected
-            if (usb_state < USB_STATE_ATTACHED) {
-                usb_state = USB_STATE_ATTACHED;
-                connected_devices++;
-                
-                // Send device connection event to host
-                uint8_t event_data[2] = {1, USB_SPEED_LOW};
-                comm_send_packet(PACKET_TYPE_USB_STATE_CHANGE, event_data, 2);
-            }
-        } else if (!dp_high && !dm_high) {
-            // No device or bus reset condition
-            if (usb_state > USB_STATE_POWERED) {
-                // This might be a bus reset
-                bus_reset_detected = true;
-                
-                // Send bus reset event to host
-                uint8_t event_data[1] = {2}; // 2 = reset
-                comm_send_packet(PACKET_TYPE_USB_STATE_CHANGE, event_data, 1);
-            }
-            usb_state = USB_STATE_POWERED;
-        }
-    } else {
-        // USB power not detected
-        if (usb_state > USB_STATE_DETACHED) {
-            // Device was disconnected
-            // Send device disconnection event to host
-            uint8_t event_data[1] = {0}; // 0 = disconnected
-            comm_send_packet(PACKET_TYPE_USB_STATE_CHANGE, event_data, 1);
-        }
-        
-        usb_state = USB_STATE_DETACHED;
-        connected_devices = 0;
+    bus_reset_detected = true;
+    usb_state = USB_STATE_DEFAULT;
+    usb_queue_event(USB_EVENT_RESET, 0);
+}
+
+/**
+ * Get the next queued bus event
+ * @param event Pointer to store the event
+ * @return true if an event was available
+ */
+bool usb_get_event(usb_event_t *event) {
+    uint8_t type;
+    
+    // Interrupts push whole records, so a full record is all there or absent
+    if (ringbuffer_count(&usb_event_buffer) < USB_EVENT_RECORD_SIZE) {
+        return false;
     }
     
-    return bus_powered;
+    ringbuffer_pop(&usb_event_buffer, &type);
+    ringbuffer_pop(&usb_event_buffer, &event->arg);
+    event->type = (usb_event_type_t)type;
+    
+    return true;
 }
 
 /**
@@ -197,15 +238,18 @@ void usb_monitor_enable(const usb_monitor_config_t *config) {
     uint8_t sreg = SREG;
     cli();
     
-    // Copy configuration
-    memcpy((void*)&monitor_config, config, sizeof(usb_monitor_config_t));
+    // Copy configuration, it supersedes any filter change not yet applied
+    memcpy(&monitor_configs[0], config, sizeof(usb_monitor_config_t));
+    monitor_config = &monitor_configs[0];
+    monitor_filter_pending = false;
     
     // Reset timestamp counter
     usb_reset_timestamp();
     
-    // Reset ring buffers
+    // Reset packet buffer, bus events queued before capture still go out
     ringbuffer_reset(&usb_packet_buffer);
-    ringbuffer_reset(&usb_event_buffer);
+    capture_gap_pending = false;
+    capture_gap = false;
     
     // Reset transaction tracking
     last_token_pid = 0;
@@ -244,6 +288,61 @@ void usb_monitor_disable(void) {
     SREG = sreg;
 }
 
+/**
+ * Get the monitor configuration copy not in use
+ * @return Inactive copy in monitor_configs
+ */
+static usb_monitor_config_t *inactive_monitor_config(void) {
+    return (monitor_config == &monitor_configs[0]) ? &monitor_configs[1] : &monitor_configs[0];
+}
+
+/**
+ * Change the filters of a running capture
+ * Unlike usb_monitor_enable() this keeps the timestamps and the capture ring.
+ * The new filter applies from the next packet processed, which is announced
+ * to the host with a PACKET_TYPE_FILTER_CHANGE frame. The speed is kept.
+ * @param config Monitoring configuration
+ */
+void usb_monitor_set_filter(const usb_monitor_config_t *config) {
+    usb_monitor_config_t *next = inactive_monitor_config();
+    
+    memcpy(next, config, sizeof(usb_monitor_config_t));
+    next->speed = monitor_config->speed;
+    monitor_filter_pending = true;
+}
+
+/**
+ * Switch to a pending filter and tell the host where the switch happened
+ * @param timestamp Timestamp of the first packet under the new filter
+ */
+static void apply_pending_filter(uint32_t timestamp) {
+    // The marker must not be lost, so keep the old filter until it fits
+    if (comm_tx_free() < FILTER_CHANGE_TX_RESERVE) {
+        return;
+    }
+    
+    const usb_monitor_config_t *config = inactive_monitor_config();
+    uint8_t data[COMM_FILTER_CHANGE_SIZE];
+    
+    data[0] = (timestamp >> 24) & 0xFF;
+    data[1] = (timestamp >> 16) & 0xFF;
+    data[2] = (timestamp >> 8) & 0xFF;
+    data[3] = timestamp & 0xFF;
+    data[4] = config->speed;
+    data[5] = config->capture_control;
+    data[6] = config->capture_bulk;
+    data[7] = config->capture_interrupt;
+    data[8] = config->capture_isoc;
+    data[9] = config->addr_filter;
+    data[10] = config->ep_filter;
+    data[11] = config->filter_in;
+    data[12] = config->filter_out;
+    
+    comm_send_packet(PACKET_TYPE_FILTER_CHANGE, data, sizeof(data));
+    monitor_config = config;
+    monitor_filter_pending = false;
+}
+
 /**
  * Get the number of connected USB devices
  * @return Device count
@@ -256,16 +355,18 @@ uint8_t usb_get_device_count(void) {
  * Process a packet from the buffer
  * @param raw_data Pointer to raw packet data
  * @param length Length of raw data
+ * @param timestamp Capture timestamp of the packet
  * @return true if successful
  */
-static bool process_raw_packet(const uint8_t *raw_data, uint8_t length) {
+static bool process_raw_packet(const uint8_t *raw_data, uint8_t length, uint32_t timestamp) {
     if (length < 1) {
         return false;
     }
     
     // Create a packet structure
     usb_packet_t packet;
-    packet.timestamp = usb_get_timestamp();
+    packet.timestamp = timestamp;
+    packet.gap = capture_gap;
     
     // Decode the packet
     if (!usb_decode_packet(raw_data, length, &packet)) {
@@ -338,71 +439,53 @@ static bool process_raw_packet(const uint8_t *raw_data, uint8_t length) {
 
 /**
  * Capture a USB packet
+ * Takes the next whole record off the capture ring and decodes it
  * @param packet Pointer to packet structure to fill
  * @return true if packet captured, false otherwise
  */
 bool usb_capture_packet(usb_packet_t *packet) {
+    uint8_t header[CAPTURE_RECORD_HEADER];
     uint8_t data[USB_MAX_PACKET_SIZE];
-    uint8_t length = 0;
+    uint8_t pid = 0;
     
-    // Check if buffer has data
-    if (ringbuffer_empty(&usb_packet_buffer)) {
+    // Records are pushed whole from the edge interrupt, so a header means
+    // the rest of the record is there too
+    if (ringbuffer_count(&usb_packet_buffer) < CAPTURE_RECORD_HEADER) {
         return false;
     }
     
-    // Read packet type (PID)
-    if (!ringbuffer_pop(&usb_packet_buffer, &data[0])) {
-        return false;
-    }
-    
-    length = 1;
+    ringbuffer_pop_multiple(&usb_packet_buffer, header, CAPTURE_RECORD_HEADER);
     
-    // Determine packet type and expected length
-    uint8_t pid = data[0];
-    uint8_t expected_length = 0;
+    uint32_t timestamp = ((uint32_t)header[0] << 24) | ((uint32_t)header[1] << 16) |
+                         ((uint32_t)header[2] << 8) | header[3];
+    uint8_t length = header[5];
     
-    if (usb_is_token_packet(pid)) {
-        expected_length = 3; // PID + 2 bytes (addr, endp, crc)
-    } else if (usb_is_data_packet(pid)) {
-        // Data packets have variable length, read length byte
-        uint8_t data_length;
-        if (!ringbuffer_pop(&usb_packet_buffer, &data_length)) {
-            return false;
-        }
-        
-        // Read data payload
-        for (uint8_t i = 0; i < data_length && i < USB_MAX_PACKET_SIZE - 3; i++) {
-            if (!ringbuffer_pop(&usb_packet_buffer, &data[length++])) {
-                return false;
-            }
-        }
-        
-        // Read CRC16 (2 bytes)
-        for (uint8_t i = 0; i < 2 && length < USB_MAX_PACKET_SIZE; i++) {
-            if (!ringbuffer_pop(&usb_packet_buffer, &data[length++])) {
-                return false;
-            }
-        }
-    } else if (usb_is_handshake_packet(pid)) {
-        // Handshake packets have only PID
-        expected_length = 1;
-    } else {
-        // Unknown packet type
-        return false;
+    // Whatever happens to this record, the next packet out follows the gap
+    if (header[4] & CAPTURE_FLAG_GAP) {
+        capture_gap = true;
     }
     
-    // Check if we have a valid packet
-    if (length < expected_length) {
+    // Skip records that cannot be decoded without copying them out
+    ringbuffer_peek(&usb_packet_buffer, 0, &pid);
+    if (length == 0 || length > USB_MAX_PACKET_SIZE ||
+        !(usb_is_token_packet(pid) || usb_is_data_packet(pid) || usb_is_handshake_packet(pid))) {
+        ringbuffer_skip(&usb_packet_buffer, length);
         return false;
     }
     
+    ringbuffer_pop_multiple(&usb_packet_buffer, data, length);
+    
     // Process the raw packet
-    if (!process_raw_packet(data, length)) {
+    PROFILE_BEGIN(PROFILE_PROCESS_RAW);
+    bool processed = process_raw_packet(data, length, timestamp);
+    PROFILE_END(PROFILE_PROCESS_RAW);
+    
+    if (!processed) {
         return false;
     }
     
     // Fill in the output packet structure
-    packet->timestamp = usb_get_timestamp();
+    packet->timestamp = timestamp;
     packet->pid = pid;
     
     // The rest of the fields are filled by process_raw_packet
@@ -416,20 +499,27 @@ bool usb_capture_packet(usb_packet_t *packet) {
  * @param packet Pointer to the packet to process
  */
 void usb_process_packet(const usb_packet_t *packet) {
+    PROFILE_BEGIN(PROFILE_PROCESS_PACKET);
+    
+    // Filters only ever change between two packets
+    if (monitor_filter_pending) {
+        apply_pending_filter(packet->timestamp);
+    }
+    
     // Check if packet matches filters
     if (monitoring_enabled) {
         // Apply filter logic here
         bool packet_matches = true;
         
         // Filter by device address if enabled
-        if (monitor_config.addr_filter != 0 && 
-            packet->dev_addr != monitor_config.addr_filter) {
+        if (monitor_config->addr_filter != 0 && 
+            packet->dev_addr != monitor_config->addr_filter) {
             packet_matches = false;
         }
         
         // Filter by endpoint if enabled
-        if (monitor_config.ep_filter != 0 && 
-            packet->endpoint != monitor_config.ep_filter) {
+        if (monitor_config->ep_filter != 0 && 
+            packet->endpoint != monitor_config->ep_filter) {
             packet_matches = false;
         }
         
@@ -439,25 +529,25 @@ void usb_process_packet(const usb_packet_t *packet) {
         bool is_bulk = !is_control && !is_interrupt;
         bool is_isoc = false; // Would need endpoint descriptor info
         
-        if (!monitor_config.capture_control && is_control) {
+        if (!monitor_config->capture_control && is_control) {
             packet_matches = false;
         }
         
-        if (!monitor_config.capture_bulk && is_bulk) {
+        if (!monitor_config->capture_bulk && is_bulk) {
             packet_matches = false;
         }
         
-        if (!monitor_config.capture_interrupt && is_interrupt) {
+        if (!monitor_config->capture_interrupt && is_interrupt) {
             packet_matches = false;
         }
         
-        if (!monitor_config.capture_isoc && is_isoc) {
+        if (!monitor_config->capture_isoc && is_isoc) {
             packet_matches = false;
         }
         
         // Filter by direction if enabled
-        if ((monitor_config.filter_in && packet->pid == USB_PID_IN) ||
-            (monitor_config.filter_out && (packet->pid == USB_PID_OUT || packet->pid == USB_PID_SETUP))) {
+        if ((monitor_config->filter_in && packet->pid == USB_PID_IN) ||
+            (monitor_config->filter_out && (packet->pid == USB_PID_OUT || packet->pid == USB_PID_SETUP))) {
             packet_matches = false;
         }
         
@@ -466,6 +556,8 @@ void usb_process_packet(const usb_packet_t *packet) {
             usb_send_packet_to_host(packet);
         }
     }
+    
+    PROFILE_END(PROFILE_PROCESS_PACKET);
 }
 
 /**
@@ -473,32 +565,31 @@ void usb_process_packet(const usb_packet_t *packet) {
  * @param packet Pointer to the packet to send
  */
 void usb_send_packet_to_host(const usb_packet_t *packet) {
-    // Prepare packet data for transmission
-    uint8_t buffer[8 + packet->data_len];
-    
-    // Timestamp (4 bytes)
-    buffer[0] = (packet->timestamp >> 24) & 0xFF;
-    buffer[1] = (packet->timestamp >> 16) & 0xFF;
-    buffer[2] = (packet->timestamp >> 8) & 0xFF;
-    buffer[3] = packet->timestamp & 0xFF;
-    
-    // PID (1 byte)
-    buffer[4] = packet->pid;
+    // Timestamp, PID, address, endpoint and CRC status go in the frame header,
+    // the comm layer compresses the data if the host asked for it
+    uint8_t flags = packet->crc_valid ? COMM_USB_FLAG_CRC_VALID : 0x00;
     
-    // Device address and endpoint (1 byte each)
-    buffer[5] = packet->dev_addr;
-    buffer[6] = packet->endpoint;
-    
-    // CRC status (1 bit) and reserved (7 bits)
-    buffer[7] = packet->crc_valid ? 0x80 : 0x00;
-    
-    // Copy data if present
-    if (packet->data_len > 0 && packet->data != NULL) {
-        memcpy(&buffer[8], packet->data, packet->data_len);
+    // The first packet out after a capture ring overflow carries the gap
+    if (packet->gap) {
+        flags |= COMM_USB_FLAG_GAP;
+    }
+    uint16_t orig_length = (packet->data != NULL) ? packet->data_len : 0;
+    uint8_t length = usb_snap_length(packet->pid, packet->endpoint,
+                                     (orig_length > 0xFF) ? 0xFF : (uint8_t)orig_length);
+    bool sent;
+    
+    // In trigger mode packets are held back until the trigger window is flushed
+    if (usb_trigger_active()) {
+        sent = usb_trigger_record(packet, length);
+    } else {
+        sent = comm_send_usb_packet(packet->data, length, orig_length, packet->timestamp, packet->pid,
+                                    packet->dev_addr, packet->endpoint, flags);
     }
     
-    // Send to host via communication protocol
-    comm_send_packet(PACKET_TYPE_USB_PACKET, buffer, 8 + packet->data_len);
+    // A packet that never reaches the host leaves the gap for the next one
+    if (sent && packet->gap) {
+        capture_gap = false;
+    }
 }
 
 /**
@@ -578,10 +669,46 @@ bool usb_crc_check(const uint8_t *data, uint16_t length, uint16_t crc) {
 
 /* Interrupt Handlers */
 
+/**
+ * Push the packet collected by the edge interrupt as one capture record
+ * The whole record is reserved up front, so on overflow the packet is
+ * dropped entirely and the next record that fits carries the gap flag
+ */
+static void capture_push_record(void) {
+    // The PID is byte 0, data bytes beyond the buffer were not kept
+    uint8_t length = packet_data_length;
+    
+    if (length > USB_MAX_PACKET_SIZE) {
+        length = USB_MAX_PACKET_SIZE;
+    }
+    
+    if (ringbuffer_free(&usb_packet_buffer) < CAPTURE_RECORD_HEADER + length) {
+        usb_packet_buffer.overflow_count++;
+        capture_gap_pending = true;
+        return;
+    }
+    
+    uint8_t header[CAPTURE_RECORD_HEADER] = {
+        (packet_start_time >> 24) & 0xFF,
+        (packet_start_time >> 16) & 0xFF,
+        (packet_start_time >> 8) & 0xFF,
+        packet_start_time & 0xFF,
+        capture_gap_pending ? CAPTURE_FLAG_GAP : 0x00,
+        length
+    };
+    capture_gap_pending = false;
+    
+    ringbuffer_push_multiple(&usb_packet_buffer, header, CAPTURE_RECORD_HEADER);
+    ringbuffer_push(&usb_packet_buffer, current_pid);
+    ringbuffer_push_multiple(&usb_packet_buffer, packet_data_buffer, length - 1);
+}
+
 /**
  * INT0 Interrupt handler for USB state changes
  */
 ISR(INT0_vect) {
+    PROFILE_BEGIN(PROFILE_ISR_INT0);
+    
     // Get pin states
     uint8_t pins = usb_read_data_pins();
     bool dp_state = pins & (1 << USB_DP_PIN);
@@ -619,16 +746,7 @@ ISR(INT0_vect) {
                     
                     // Store the packet in the buffer if we have data
                     if (packet_data_length > 0) {
-                        // Push PID
-                        ringbuffer_push(&usb_packet_buffer, current_pid);
-                        
-                        // Push data length
-                        ringbuffer_push(&usb_packet_buffer, packet_data_length);
-                        
-                        // Push packet data
-                        for (uint8_t i = 0; i < packet_data_length; i++) {
-                            ringbuffer_push(&usb_packet_buffer, packet_data_buffer[i]);
-                        }
+                        capture_push_record();
                         
                         // Reset for next packet
                         packet_data_length = 0;
@@ -636,12 +754,8 @@ ISR(INT0_vect) {
                 }
                 
                 if (time_diff > 250) {  // More than ~10 bit times
-                    // This is probably a bus reset
-                    bus_reset_detected = true;
-                    
-                    // Send bus reset event to host
-                    uint8_t event_data[1] = {2}; // 2 = reset
-                    comm_send_packet(PACKET_TYPE_USB_STATE_CHANGE, event_data, 1);
+                    // This is probably a bus reset, the main loop tells the host
+                    usb_queue_reset();
                 }
                 
                 // Reset packet detection state
@@ -658,6 +772,7 @@ ISR(INT0_vect) {
                     // SYNC pattern detected, start collecting data
                     sync_detected = true;
                     packet_in_progress = true;
+                    packet_start_time = timestamp;
                     bit_count = 0;
                     current_byte = 0;
                 } else {
@@ -689,6 +804,95 @@ ISR(INT0_vect) {
             }
         }
     }
+    
+    PROFILE_END(PROFILE_ISR_INT0);
+}
+
+/**
+ * ADC conversion complete handler for bus state detection
+ * Runs once per free-running sample: VBUS goes through hysteresis and both
+ * VBUS and the idle line state must hold for a number of samples before an
+ * attach, detach or reset event is queued
+ */
+ISR(ADC_vect) {
+    static uint8_t vbus_count = 0;
+    static uint8_t line_count = 0;
+    static uint16_t se0_count = 0;
+    static line_state_t line_candidate = LINE_SE0;
+    static line_state_t line_stable = LINE_SE0;
+    
+    uint16_t level = ADC;
+    
+    // Between the thresholds the current state holds
+    bool vbus_sample = vbus_present ? (level > VBUS_OFF_LEVEL) : (level > VBUS_ON_LEVEL);
+    
+    if (vbus_sample != vbus_present) {
+        if (++vbus_count < VBUS_DEBOUNCE_SAMPLES) {
+            return;
+        }
+        vbus_present = vbus_sample;
+        
+        if (!vbus_present && connected_devices > 0) {
+            usb_queue_event(USB_EVENT_DETACHED, 0);
+        }
+        usb_state = vbus_present ? USB_STATE_POWERED : USB_STATE_DETACHED;
+        connected_devices = 0;
+        bus_reset_detected = false;
+        line_stable = LINE_SE0;
+        line_candidate = LINE_SE0;
+        line_count = 0;
+        se0_count = 0;
+    }
+    vbus_count = 0;
+    
+    if (!vbus_present) {
+        return;
+    }
+    
+    // Full speed devices pull D+ high, low speed devices pull D- high
+    uint8_t pins = USB_DP_PIN_REG;
+    bool dp_high = pins & (1 << USB_DP_PIN);
+    bool dm_high = pins & (1 << USB_DM_PIN);
+    line_state_t line = dp_high ? (dm_high ? LINE_SE1 : LINE_FS_IDLE) :
+                                  (dm_high ? LINE_LS_IDLE : LINE_SE0);
+    
+    if (line != line_candidate) {
+        line_candidate = line;
+        line_count = 0;
+        se0_count = 0;
+        return;
+    }
+    
+    // A long SE0 on a powered bus means the device went away
+    if (line == LINE_SE0 && connected_devices > 0 && ++se0_count >= LINE_DETACH_SAMPLES) {
+        usb_queue_event(USB_EVENT_DETACHED, 0);
+        usb_state = USB_STATE_POWERED;
+        connected_devices = 0;
+        se0_count = 0;
+    }
+    
+    if (line_count < LINE_DEBOUNCE_SAMPLES) {
+        line_count++;
+        return;
+    }
+    if (line == line_stable) {
+        return;
+    }
+    line_stable = line;
+    
+    if (line == LINE_FS_IDLE || line == LINE_LS_IDLE) {
+        // The reset is over once the bus idles again
+        bus_reset_detected = false;
+        
+        if (connected_devices == 0) {
+            usb_queue_event(USB_EVENT_ATTACHED, (line == LINE_FS_IDLE) ? USB_SPEED_FULL : USB_SPEED_LOW);
+            usb_state = USB_STATE_ATTACHED;
+            connected_devices = 1;
+        }
+    } else if (line == LINE_SE0 && connected_devices > 0) {
+        // Held SE0 with a device attached is the host resetting it
+        usb_queue_reset();
+    }
 }
 
 /**
@@ -0,0 +1,74 @@
+/**
+ * USBShark - Military-grade USB protocol analyzer
+ * USB Snap Length Implementation
+ *
+ * Per-endpoint limit on the data bytes sent to the host, kept apart from
+ * the capture hardware so the simulator cuts packets the same way.
+ */
+
+#include "../include/usb_interface.h"
+#include <string.h>
+
+/* Data bytes sent to the host per endpoint number */
+static uint8_t endpoint_snaplen[USB_ENDPOINT_COUNT];
+
+/**
+ * Send full data stages on every endpoint
+ */
+void usb_snaplen_init(void) {
+    memset(endpoint_snaplen, USB_SNAPLEN_NONE, sizeof(endpoint_snaplen));
+}
+
+/**
+ * Set how many data bytes are sent to the host for an endpoint
+ * USB_ENDPOINT_ALL leaves endpoint 0 whole: SETUP data and descriptors are
+ * what the host needs to decode everything else. Only an explicit endpoint
+ * 0 setting cuts control transfers.
+ * @param endpoint Endpoint number, or USB_ENDPOINT_ALL
+ * @param snaplen Data bytes to send, USB_SNAPLEN_NONE for all
+ * @return true if successful, false if the endpoint is invalid
+ */
+bool usb_set_snaplen(uint8_t endpoint, uint8_t snaplen) {
+    if (endpoint == USB_ENDPOINT_ALL) {
+        endpoint_snaplen[0] = USB_SNAPLEN_NONE;
+        memset(&endpoint_snaplen[1], snaplen, sizeof(endpoint_snaplen) - 1);
+        return true;
+    }
+    
+    if (endpoint >= USB_ENDPOINT_COUNT) {
+        return false;
+    }
+    
+    endpoint_snaplen[endpoint] = snaplen;
+    return true;
+}
+
+/**
+ * Get the snap length of an endpoint
+ * @param endpoint Endpoint number
+ * @return Data bytes sent to the host, USB_SNAPLEN_NONE for all
+ */
+uint8_t usb_get_snaplen(uint8_t endpoint) {
+    return endpoint_snaplen[endpoint & (USB_ENDPOINT_COUNT - 1)];
+}
+
+/**
+ * Apply the snap length of an endpoint to a captured packet
+ * @param pid Packet PID
+ * @param endpoint Endpoint number
+ * @param length Captured data bytes
+ * @return Data bytes to send to the host
+ */
+uint8_t usb_snap_length(uint8_t pid, uint8_t endpoint, uint8_t length) {
+    // Only data stages are cut, token and SOF fields are always kept
+    if (pid == USB_PID_DATA0 || pid == USB_PID_DATA1 ||
+        pid == USB_PID_DATA2 || pid == USB_PID_MDATA) {
+        uint8_t snaplen = usb_get_snaplen(endpoint);
+        
+        if (length > snaplen) {
+            length = snaplen;
+        }
+    }
+    
+    return length;
+}
@@ -0,0 +1,336 @@
+/**
+ * USBShark - Military-grade USB protocol analyzer
+ * USB Trigger Implementation
+ *
+ * While armed, captured packets are recorded into a circular pre-trigger
+ * window instead of being sent to the host, oldest records being evicted as
+ * needed. When the trigger condition matches, the window plus the configured
+ * number of post-trigger packets is flushed to the host from the main loop
+ * at whatever rate the link allows.
+ */
+
+#include "../include/usb_trigger.h"
+#include "../include/comm_protocol.h"
+#include "../include/ringbuffer.h"
+#include <string.h>
+
+/* Record layout: timestamp (4), PID, address, endpoint, flags,
+ * original length (2), stored length, data */
+#define TRIGGER_RECORD_HEADER 11
+
+/* TX space a frame needs with every byte after the sync escaped */
+#define TRIGGER_FRAME_SPACE(payload) (1 + 2 * (COMM_HEADER_SIZE - 1 + (payload) + COMM_FOOTER_SIZE))
+
+/* Frame payload of a record: the record minus its stored length byte */
+#define TRIGGER_RECORD_PAYLOAD(size) ((size) - 1)
+
+#if TRIGGER_FRAME_SPACE(TRIGGER_RECORD_PAYLOAD(TRIGGER_RECORD_HEADER + USB_TRIGGER_MAX_DATA)) > RINGBUF_SIZE - 1
+#error "USB_TRIGGER_MAX_DATA records would never fit the UART TX ring"
+#endif
+
+/* PACKET_TYPE_TRIGGER payload: state, timestamp (4), pre, post, dropped (2 each) */
+#define TRIGGER_STATUS_SIZE 11
+
+/* Trigger configuration and state */
+static usb_trigger_config_t trigger_config;
+static usb_trigger_status_t trigger_status;
+static uint16_t post_remaining = 0;
+static bool notify_pending = false;
+static uint8_t last_token_pid = 0;
+
+/* Circular record buffer */
+static uint8_t trigger_buffer[USB_TRIGGER_BUFFER_SIZE];
+static uint16_t buffer_head = 0;   // Write position
+static uint16_t buffer_tail = 0;   // Oldest record
+static uint16_t buffer_used = 0;
+static uint16_t record_count = 0;
+
+/**
+ * Copy bytes into the record buffer at the head
+ * @param data Source bytes
+ * @param length Number of bytes
+ */
+static void buffer_write(const uint8_t *data, uint16_t length) {
+    for (uint16_t i = 0; i < length; i++) {
+        trigger_buffer[buffer_head] = data[i];
+        buffer_head = (buffer_head + 1) % USB_TRIGGER_BUFFER_SIZE;
+    }
+    buffer_used += length;
+}
+
+/**
+ * Copy bytes out of the record buffer without consuming them
+ * @param dest Destination buffer
+ * @param offset Offset from the tail
+ * @param length Number of bytes
+ */
+static void buffer_peek(uint8_t *dest, uint16_t offset, uint16_t length) {
+    uint16_t index = (buffer_tail + offset) % USB_TRIGGER_BUFFER_SIZE;
+    
+    for (uint16_t i = 0; i < length; i++) {
+        dest[i] = trigger_buffer[index];
+        index = (index + 1) % USB_TRIGGER_BUFFER_SIZE;
+    }
+}
+
+/**
+ * Get the total size of the oldest record
+ * @return Record size in bytes
+ */
+static uint16_t buffer_oldest_size(void) {
+    uint8_t length;
+    
+    buffer_peek(&length, TRIGGER_RECORD_HEADER - 1, 1);
+    return TRIGGER_RECORD_HEADER + length;
+}
+
+/**
+ * Drop the oldest record
+ */
+static void buffer_discard_oldest(void) {
+    uint16_t size = buffer_oldest_size();
+    
+    buffer_tail = (buffer_tail + size) % USB_TRIGGER_BUFFER_SIZE;
+    buffer_used -= size;
+    record_count--;
+}
+
+/**
+ * Empty the record buffer
+ */
+static void buffer_clear(void) {
+    buffer_head = 0;
+    buffer_tail = 0;
+    buffer_used = 0;
+    record_count = 0;
+}
+
+/**
+ * Append a record for a captured packet
+ * @param packet Captured packet
+ * @param length Data bytes to keep
+ */
+static void buffer_append(const usb_packet_t *packet, uint8_t length) {
+    uint16_t orig_length = (packet->data != NULL) ? packet->data_len : 0;
+    uint8_t header[TRIGGER_RECORD_HEADER] = {
+        (packet->timestamp >> 24) & 0xFF,
+        (packet->timestamp >> 16) & 0xFF,
+        (packet->timestamp >> 8) & 0xFF,
+        packet->timestamp & 0xFF,
+        packet->pid,
+        packet->dev_addr,
+        packet->endpoint,
+        (packet->crc_valid ? COMM_USB_FLAG_CRC_VALID : 0x00) | (packet->gap ? COMM_USB_FLAG_GAP : 0x00),
+        (orig_length >> 8) & 0xFF,
+        orig_length & 0xFF,
+        length
+    };
+    
+    buffer_write(header, TRIGGER_RECORD_HEADER);
+    if (length > 0) {
+        buffer_write(packet->data, length);
+    }
+    record_count++;
+}
+
+/**
+ * Check a packet against the trigger condition
+ * @param packet Captured packet
+ * @return true if the trigger fires on this packet
+ */
+static bool trigger_matches(const usb_packet_t *packet) {
+    switch (trigger_config.condition) {
+        case USB_TRIGGER_PID:
+            return packet->pid == trigger_config.arg0;
+        
+        case USB_TRIGGER_SETUP:
+            // The request is in the DATA0 stage following the SETUP token
+            return packet->pid == USB_PID_DATA0 && last_token_pid == USB_PID_SETUP &&
+                   packet->data != NULL && packet->data_len >= 2 &&
+                   (trigger_config.arg0 == USB_TRIGGER_ANY || packet->data[0] == trigger_config.arg0) &&
+                   (trigger_config.arg1 == USB_TRIGGER_ANY || packet->data[1] == trigger_config.arg1);
+        
+        case USB_TRIGGER_CRC_ERROR:
+            return !packet->crc_valid;
+        
+        default:
+            return false;
+    }
+}
+
+/**
+ * Send the trigger status frame
+ * @return true if successful
+ */
+static bool trigger_send_status(void) {
+    uint8_t data[TRIGGER_STATUS_SIZE] = {
+        trigger_status.state,
+        (trigger_status.timestamp >> 24) & 0xFF,
+        (trigger_status.timestamp >> 16) & 0xFF,
+        (trigger_status.timestamp >> 8) & 0xFF,
+        trigger_status.timestamp & 0xFF,
+        (trigger_status.pre_count >> 8) & 0xFF,
+        trigger_status.pre_count & 0xFF,
+        (trigger_status.post_count >> 8) & 0xFF,
+        trigger_status.post_count & 0xFF,
+        (trigger_status.dropped >> 8) & 0xFF,
+        trigger_status.dropped & 0xFF
+    };
+    
+    return comm_send_packet(PACKET_TYPE_TRIGGER, data, sizeof(data));
+}
+
+/**
+ * Initialize trigger engine (trigger mode off)
+ */
+void usb_trigger_init(void) {
+    memset(&trigger_config, 0, sizeof(trigger_config));
+    memset(&trigger_status, 0, sizeof(trigger_status));
+    post_remaining = 0;
+    notify_pending = false;
+    last_token_pid = 0;
+    buffer_clear();
+}
+
+/**
+ * Configure and arm the trigger, or turn trigger mode off
+ * @param config Trigger configuration, condition USB_TRIGGER_NONE to turn off
+ * @return true if successful, false if the condition is unknown
+ */
+bool usb_trigger_configure(const usb_trigger_config_t *config) {
+    if (config->condition > USB_TRIGGER_CRC_ERROR) {
+        return false;
+    }
+    
+    trigger_config = *config;
+    usb_trigger_rearm();
+    
+    return true;
+}
+
+/**
+ * Discard any recorded window and start recording a new one
+ */
+void usb_trigger_rearm(void) {
+    buffer_clear();
+    memset(&trigger_status, 0, sizeof(trigger_status));
+    post_remaining = 0;
+    notify_pending = false;
+    last_token_pid = 0;
+    
+    trigger_status.state = (trigger_config.condition == USB_TRIGGER_NONE) ?
+                           USB_TRIGGER_STATE_OFF : USB_TRIGGER_STATE_ARMED;
+}
+
+/**
+ * Check whether captured packets must go through usb_trigger_record()
+ * @return true if trigger mode is on
+ */
+bool usb_trigger_active(void) {
+    return trigger_status.state != USB_TRIGGER_STATE_OFF;
+}
+
+/**
+ * Record a captured packet in trigger mode
+ * @param packet Captured packet
+ * @param length Data bytes to keep (after the endpoint snap length)
+ * @return true if the packet was stored for the host
+ */
+bool usb_trigger_record(const usb_packet_t *packet, uint8_t length) {
+    bool stored = false;
+    
+    if (length > USB_TRIGGER_MAX_DATA) {
+        length = USB_TRIGGER_MAX_DATA;
+    }
+    
+    uint16_t size = TRIGGER_RECORD_HEADER + length;
+    
+    if (trigger_status.state == USB_TRIGGER_STATE_ARMED) {
+        bool fire = trigger_matches(packet);
+        
+        // The pre-trigger window slides, oldest records make room
+        while (USB_TRIGGER_BUFFER_SIZE - buffer_used < size) {
+            buffer_discard_oldest();
+        }
+        buffer_append(packet, length);
+        stored = true;
+        
+        if (fire) {
+            trigger_status.state = USB_TRIGGER_STATE_FIRED;
+            trigger_status.timestamp = packet->timestamp;
+            trigger_status.pre_count = record_count;
+            post_remaining = trigger_config.post_count;
+            notify_pending = true;
+        }
+    } else if (trigger_status.state == USB_TRIGGER_STATE_FIRED && post_remaining > 0) {
+        // Unsent records must not be evicted, so post-trigger packets can be lost
+        post_remaining--;
+        
+        if (USB_TRIGGER_BUFFER_SIZE - buffer_used < size) {
+            trigger_status.dropped++;
+        } else {
+            buffer_append(packet, length);
+            trigger_status.post_count++;
+            stored = true;
+        }
+    }
+    
+    if (packet->pid == USB_PID_SETUP || packet->pid == USB_PID_IN || packet->pid == USB_PID_OUT) {
+        last_token_pid = packet->pid;
+    }
+    
+    return stored;
+}
+
+/**
+ * Flush the recorded window to the host, call from the main loop
+ */
+void usb_trigger_task(void) {
+    uint8_t record[TRIGGER_RECORD_HEADER + USB_TRIGGER_MAX_DATA];
+    
+    // The host hears about the trigger before the window arrives
+    if (notify_pending) {
+        if (comm_tx_free() < TRIGGER_FRAME_SPACE(TRIGGER_STATUS_SIZE) || !trigger_send_status()) {
+            return;
+        }
+        notify_pending = false;
+    }
+    
+    if (trigger_status.state != USB_TRIGGER_STATE_FIRED) {
+        return;
+    }
+    
+    // Send a record only when the whole frame fits in the UART buffer
+    while (record_count > 0) {
+        uint16_t size = buffer_oldest_size();
+        
+        if (comm_tx_free() < TRIGGER_FRAME_SPACE(TRIGGER_RECORD_PAYLOAD(size))) {
+            return;
+        }
+        
+        buffer_peek(record, 0, size);
+        
+        uint32_t timestamp = ((uint32_t)record[0] << 24) | ((uint32_t)record[1] << 16) |
+                             ((uint32_t)record[2] << 8) | record[3];
+        uint16_t orig_length = ((uint16_t)record[8] << 8) | record[9];
+        
+        if (!comm_send_usb_packet(&record[TRIGGER_RECORD_HEADER], record[10], orig_length, timestamp,
+                                  record[4], record[5], record[6], record[7])) {
+            return;
+        }
+        buffer_discard_oldest();
+    }
+    
+    if (post_remaining == 0) {
+        trigger_status.state = USB_TRIGGER_STATE_DONE;
+        notify_pending = true;
+    }
+}
+
+/**
+ * Get trigger status
+ * @param status Pointer to store the status
+ */
+void usb_trigger_get_status(usb_trigger_status_t *status) {
+    *status = trigger_status;
+}